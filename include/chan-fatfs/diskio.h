@@ -12,7 +12,7 @@ extern "C" {
 #include "integer.h"
 
 // OS_USE_MICRO_OS_PLUS
-#include "chan-fatfs/ffconf.h"
+#include "chan-fatfs/ff.h"		/* Sector number type (LBA_t) */
 
 
 /* Status of Disk Functions */
@@ -35,8 +35,8 @@ typedef enum {
 
 DSTATUS disk_initialize (PDRV pdrv);
 DSTATUS disk_status (PDRV pdrv);
-DRESULT disk_read (PDRV pdrv, BYTE* buff, DWORD sector, UINT count);
-DRESULT disk_write (PDRV pdrv, const BYTE* buff, DWORD sector, UINT count);
+DRESULT disk_read (PDRV pdrv, BYTE* buff, LBA_t sector, UINT count);
+DRESULT disk_write (PDRV pdrv, const BYTE* buff, LBA_t sector, UINT count);
 DRESULT disk_ioctl (PDRV pdrv, BYTE cmd, void* buff);
 DSTATUS disk_deinitialize (PDRV pdrv);
 
@@ -44,8 +44,8 @@ DSTATUS disk_deinitialize (PDRV pdrv);
 
 DSTATUS disk_initialize (BYTE pdrv);
 DSTATUS disk_status (BYTE pdrv);
-DRESULT disk_read (BYTE pdrv, BYTE* buff, DWORD sector, UINT count);
-DRESULT disk_write (BYTE pdrv, const BYTE* buff, DWORD sector, UINT count);
+DRESULT disk_read (BYTE pdrv, BYTE* buff, LBA_t sector, UINT count);
+DRESULT disk_write (BYTE pdrv, const BYTE* buff, LBA_t sector, UINT count);
 DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void* buff);
 
 #endif
@@ -87,6 +87,18 @@ typedef DWORD FSIZE_t;
 #endif
 
 
+/* Type of sector number (LBA) variables */
+
+#if FF_LBA64
+#if !FF_FS_EXFAT
+#error exFAT needs to be enabled when enable 64-bit LBA
+#endif
+typedef QWORD LBA_t;
+#else
+typedef DWORD LBA_t;
+#endif
+
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wpadded"
 
@@ -115,12 +127,51 @@ typedef struct {
 #if FF_FS_EXFAT
 	BYTE*	dirbuf;			/* Directory entry block scratchpad buffer for exFAT */
 #endif
+#if FF_USE_LFN == 4 // OS_USE_MICRO_OS_PLUS
+	WCHAR	lfnwork[FF_MAX_LFN + 1];	/* LFN working buffer of the volume */
+#if FF_FS_EXFAT
+	BYTE	dirwork[(FF_MAX_LFN + 44U) / 15 * 32];	/* Directory entry block scratchpad buffer of the volume */
+#endif
+#endif
 #if FF_FS_REENTRANT
 	FF_SYNC_t	sobj;		/* Identifier of sync object */
 #endif
 #if !FF_FS_READONLY
 	DWORD	last_clst;		/* Last allocated cluster */
 	DWORD	free_clst;		/* Number of free clusters */
+#if FF_FS_FREEMAP
+	BYTE	fm_shift;		/* Free cluster map granularity, log2 of clusters per bit (0xFF:not built) */
+	DWORD	fm_map[FF_FS_FREEMAP / 4];	/* Free cluster map (1:the cluster or group can be free) */
+#endif
+#if FF_FS_FREESCAN
+	DWORD	fsc_clst;		/* Free cluster scan: cluster to be scanned next (0:not in progress) */
+	DWORD	fsc_free;		/* Free cluster scan: free clusters found so far */
+#endif
+#if FF_FS_RESERVE
+	void*	rsv_obj[FF_FS_RESERVE_FILES];	/* Object holding the allocation window (0:not in use) */
+	DWORD	rsv_clst[FF_FS_RESERVE_FILES];	/* Next cluster to be allocated in the window */
+	DWORD	rsv_end[FF_FS_RESERVE_FILES];	/* End of the window (rsv_clst == rsv_end:exhausted) */
+#endif
+#if FF_FS_FREEEXT
+	BYTE	fx_stat;		/* Free extent table status (0:not built, 1:built, 2:a free run is out of the table, 3:and clusters got free since) */
+	UINT	fx_n;			/* Number of free runs in the table */
+	void*	fx_obj;			/* Object being written with the size hint */
+	DWORD	fx_want;		/* Size hint: number of clusters to be written */
+	DWORD	fx_clst[FF_FS_FREEEXT];	/* Top cluster of the free run (in order of the length) */
+	DWORD	fx_len[FF_FS_FREEEXT];	/* Number of clusters in the free run */
+#endif
+#if FF_FS_DELALLOC
+	DWORD	da_clst;		/* Number of clusters promised to the delayed data of the files */
+	BYTE	da_run;			/* The delayed data is being allocated (the promise is not applied) */
+#endif
+#if FF_FS_DIRHINT
+	DWORD	dh_clock;		/* Free entry hint access clock (LRU time stamp source) */
+	DWORD	dh_dir[FF_FS_DIRHINT];	/* Start cluster of the directory (0:root) */
+	DWORD	dh_free[FF_FS_DIRHINT];	/* Offset of the first entry that can be blank */
+	DWORD	dh_end[FF_FS_DIRHINT];	/* Offset of the blank tail of the table (0xFFFFFFFF:not known) */
+	DWORD	dh_stamp[FF_FS_DIRHINT];	/* Last access time of each hint (0:not in use) */
+	BYTE	dh_run[FF_FS_DIRHINT];	/* Longest run of blank entries before the tail (0xFF:not known) */
+#endif
 #endif
 #if FF_FS_RPATH
 	DWORD	cdir;			/* Current directory start cluster (0:root) */
@@ -132,12 +183,61 @@ typedef struct {
 #endif
 	DWORD	n_fatent;		/* Number of FAT entries (number of clusters + 2) */
 	DWORD	fsize;			/* Size of an FAT [sectors] */
-	DWORD	volbase;		/* Volume base sector */
-	DWORD	fatbase;		/* FAT base sector */
-	DWORD	dirbase;		/* Root directory base sector/cluster */
-	DWORD	database;		/* Data base sector */
-	DWORD	winsect;		/* Current sector appearing in the win[] */
+	LBA_t	volbase;		/* Volume base sector */
+	LBA_t	fatbase;		/* FAT base sector */
+	LBA_t	dirbase;		/* Root directory base sector/cluster */
+	LBA_t	database;		/* Data base sector */
+#if FF_FS_WINCACHE
+	DWORD	wc_clock;		/* Cache access clock (LRU time stamp source) */
+	DWORD	wc_hit;			/* Number of window moves served by the cache */
+	DWORD	wc_miss;		/* Number of window moves read from the volume */
+	DWORD	wc_wback;		/* Number of dirty sectors written back to the volume */
+	LBA_t	wc_sect[FF_FS_WINCACHE];	/* Sector held by each cache line (all ones:empty) */
+	DWORD	wc_stamp[FF_FS_WINCACHE];	/* Last access time of each cache line */
+	BYTE	wc_flag[FF_FS_WINCACHE];	/* Cache line flags (b0:dirty) */
+#if FF_SS_HEAP
+	BYTE*	wc_buf[FF_FS_WINCACHE];	/* Cache lines (allocated following win[] at mount) */
+#else
+	BYTE	wc_buf[FF_FS_WINCACHE][FF_MAX_SS];	/* Cache lines */
+#endif
+#endif
+#if FF_FS_DCACHE
+	DWORD	dc_clock;		/* Dentry cache access clock (LRU time stamp source) */
+	DWORD	dc_hit;			/* Number of name lookups served by the dentry cache */
+	DWORD	dc_miss;		/* Number of name lookups that scanned the directory */
+	DWORD	dc_dir[FF_FS_DCACHE];	/* Start cluster of the parent directory (0:root) */
+	DWORD	dc_ofs[FF_FS_DCACHE];	/* Offset of the SFN entry in the directory (0xFFFFFFFF:not found) */
+	DWORD	dc_blk[FF_FS_DCACHE];	/* Offset of the LFN entry block (0xFFFFFFFF:no LFN) */
+	DWORD	dc_stamp[FF_FS_DCACHE];	/* Last access time of each entry (0:empty) */
+	WORD	dc_hash[FF_FS_DCACHE];	/* Hash of the case-folded name */
+	BYTE	dc_sum[FF_FS_DCACHE];	/* Checksum of the SFN entry to verify a hit */
+	WCHAR	dc_name[FF_FS_DCACHE][FF_FS_DCNAME];	/* Case-folded name */
+#endif
+#if FF_FS_NAMEINDEX
+	DWORD	ni_clock;		/* Name index access clock (LRU time stamp source) */
+	DWORD	ni_dir[FF_FS_NAMEINDEX_DIRS];	/* Start cluster of the indexed directory (0:root) */
+	DWORD	ni_stamp[FF_FS_NAMEINDEX_DIRS];	/* Last access time of each index (0:not in use) */
+	UINT	ni_base[FF_FS_NAMEINDEX_DIRS];	/* First slot of the hash table */
+	UINT	ni_size[FF_FS_NAMEINDEX_DIRS];	/* Number of slots of the hash table (0:not to be indexed) */
+	UINT	ni_used[FF_FS_NAMEINDEX_DIRS];	/* Number of keys in the hash table (not indexed: in the directory) */
+#if !FF_FS_READONLY && FF_FS_NUMNAME
+	DWORD	ni_tail[FF_FS_NAMEINDEX_DIRS];	/* Largest number after '~' of the SFNs in the directory */
+#endif
+	WORD	ni_hash[FF_FS_NAMEINDEX];	/* Hash of the name (0:empty slot) */
+	WORD	ni_ent[FF_FS_NAMEINDEX];	/* Index of the top entry of the entry block */
+#endif
+#if FF_FS_BULKBUF && FF_USE_LFN != 3 && !FF_SS_HEAP
+	BYTE	bulkbuf[FF_FS_BULKBUF];	/* Buffer of the multi-sector table clear and scan */
+#endif
+	LBA_t	winsect;		/* Current sector appearing in the win[] */
+#if FF_SS_HEAP && !FF_FS_TINY
+	BYTE*	fb_list;		/* Sector buffers of the files, released at unmount (linked by a header ahead of them) */
+#endif
+#if FF_SS_HEAP
+	BYTE*	win;			/* Disk access window for Directory, FAT (and file data at tiny cfg), allocated at mount */
+#else
 	BYTE	win[FF_MAX_SS];	/* Disk access window for Directory, FAT (and file data at tiny cfg) */
+#endif
 } FATFS;
 
 
@@ -171,28 +271,84 @@ typedef struct {
 	BYTE	err;			/* Abort flag (error code) */
 	FSIZE_t	fptr;			/* File read/write pointer (Zeroed on file open) */
 	DWORD	clust;			/* Current cluster of fpter (invalid when fptr is 0) */
-	DWORD	sect;			/* Sector number appearing in buf[] (0:invalid) */
+	LBA_t	sect;			/* Sector number appearing in buf[] (0:invalid) */
 #if !FF_FS_READONLY
-	DWORD	dir_sect;		/* Sector number containing the directory entry (not used at exFAT) */
+	LBA_t	dir_sect;		/* Sector number containing the directory entry (not used at exFAT) */
 	BYTE*	dir_ptr;		/* Pointer to the directory entry in the win[] (not used at exFAT) */
 #endif
 #if FF_USE_FASTSEEK
 	DWORD*	cltbl;			/* Pointer to the cluster link map table (nulled on open, set by application) */
 #endif
+#if FF_FS_EXTCACHE
+	UINT	ec_n;			/* Number of extents in the extent cache */
+	UINT	ec_last;		/* Index of the extent last found */
+	DWORD	ec_ofs[FF_FS_EXTCACHE];		/* Extent cache: cluster offset in the file (ascending) */
+	DWORD	ec_clst[FF_FS_EXTCACHE];	/* Extent cache: top cluster number */
+	DWORD	ec_len[FF_FS_EXTCACHE];		/* Extent cache: number of contiguous clusters */
+#endif
+#if FF_USE_PREAD
+	FSIZE_t	pos_fptr;		/* Positional cursor of f_pread()/f_pwrite(): file pointer */
+	DWORD	pos_clust;		/* Positional cursor of f_pread()/f_pwrite(): current cluster (invalid when pos_fptr is 0) */
+#endif
+#if FF_USE_EXTENT
+	WORD	pin;			/* Number of f_getextent() calls not yet released (file cannot be truncated) */
+#endif
 #if !FF_FS_TINY
+#if FF_SS_HEAP
+	BYTE*	buf;			/* File private data read/write window, allocated at open */
+#else
 	BYTE	buf[FF_MAX_SS];	/* File private data read/write window */
 #endif
+#endif
+#if FF_FS_READAHEAD
+	FSIZE_t	ra_fptr;		/* File pointer where the last read ended (sequential read detection) */
+	LBA_t	ra_sect;		/* Sector number appearing at top of ra_buf[] */
+	UINT	ra_cnt;			/* Number of sectors in ra_buf[] (0:invalid) */
+#if FF_SS_HEAP
+	BYTE*	ra_buf;			/* Read-ahead buffer (allocated following buf[] at open) */
+#else
+	BYTE	ra_buf[FF_FS_READAHEAD * FF_MAX_SS];	/* Read-ahead buffer */
+#endif
+#endif
+#if FF_FS_WRITEBEHIND
+	LBA_t	wb_sect;		/* Sector number appearing at top of wb_buf[] */
+	UINT	wb_cnt;			/* Number of sectors to be written in wb_buf[] (0:empty) */
+#if FF_SS_HEAP
+	BYTE*	wb_buf;			/* Write-behind buffer (allocated following ra_buf[] at open) */
+#else
+	BYTE	wb_buf[FF_FS_WRITEBEHIND * FF_MAX_SS];	/* Write-behind buffer */
+#endif
+#endif
+#if FF_FS_DELALLOC
+	UINT	da_cnt;			/* Number of bytes in da_buf[] waiting for the clusters (0:empty) */
+	BYTE	da_cut;			/* Data counted as written by f_write() was cut by disk full (reported by f_sync()) */
+#if FF_SS_HEAP
+	BYTE*	da_buf;			/* Delay buffer (allocated following wb_buf[] at open) */
+#else
+	BYTE	da_buf[FF_FS_DELALLOC * FF_MAX_SS];	/* Delay buffer */
+#endif
+#endif
 } FIL;
 
 
 
+/* File extent structure (FEXTENT) */
+
+typedef struct {
+	FSIZE_t	ofs;			/* File offset of the first sector */
+	LBA_t	sect;			/* First sector on the volume */
+	LBA_t	count;			/* Number of contiguous sectors */
+} FEXTENT;
+
+
+
 /* Directory object structure (DIR) */
 
 typedef struct {
 	FFOBJID	obj;			/* Object identifier */
 	DWORD	dptr;			/* Current read/write offset */
 	DWORD	clust;			/* Current cluster */
-	DWORD	sect;			/* Current sector (0:Read operation has terminated) */
+	LBA_t	sect;			/* Current sector (0:Read operation has terminated) */
 	BYTE*	dir;			/* Pointer to the directory item in the win[] */
 	BYTE	fn[12];			/* SFN (in/out) {body[8],ext[3],status[1]} */
 #if FF_USE_LFN
@@ -262,6 +418,8 @@ FRESULT f_close (FIL* fp);                      /* Close an open file object */
 FRESULT f_read (FIL* fp, void* buff, UINT btr, UINT* br);     /* Read data from the file */
 FRESULT f_write (FIL* fp, const void* buff, UINT btw, UINT* bw);  /* Write data to the file */
 FRESULT f_lseek (FIL* fp, FSIZE_t ofs);               /* Move file pointer of the file object */
+FRESULT f_pread (FIL* fp, void* buff, UINT btr, FSIZE_t ofs, UINT* br);  /* Read data from the file at a given offset */
+FRESULT f_pwrite (FIL* fp, const void* buff, UINT btw, FSIZE_t ofs, UINT* bw);  /* Write data to the file at a given offset */
 FRESULT f_truncate (FIL* fp);                   /* Truncate the file */
 FRESULT f_sync (FIL* fp);                     /* Flush cached data of the writing file */
 FRESULT f_opendir (FATFS *fs, FFDIR* dp, const TCHAR* path);						/* Open a directory */
@@ -280,9 +438,14 @@ FRESULT f_chdir (const TCHAR* path);                /* Change current directory
 FRESULT f_chdrive (const TCHAR* path);                /* Change current drive */
 FRESULT f_getcwd (TCHAR* buff, UINT len);             /* Get current directory */
 FRESULT f_getfree (FATFS *fs, DWORD* nclst); /* Get number of free clusters on the drive */
+FRESULT f_scanfree (FATFS *fs, UINT nsect, DWORD* nclst, BYTE* exact); /* Advance the free cluster scan */
 FRESULT f_getlabel (const TCHAR* path, TCHAR* label, DWORD* vsn); /* Get volume label */
 FRESULT f_setlabel (const TCHAR* label);              /* Set volume label */
 FRESULT f_forward (FIL* fp, UINT(*func)(const BYTE*,UINT), UINT btf, UINT* bf); /* Forward data to the stream */
+FRESULT f_stream (FIL* fp, UINT(*func)(void*,const BYTE*,UINT), void* arg, UINT btf, UINT* bf); /* Forward data to the stream with an argument */
+FRESULT f_getextent (FIL* fp, FSIZE_t ofs, FSIZE_t len, FEXTENT* ext, UINT n, UINT* ne); /* Get the sectors holding the file data and pin the file */
+FRESULT f_putextent (FIL* fp);                 /* Release the file pinned by f_getextent() */
+FRESULT f_getfrag (FIL* fp, DWORD* nfrag);     /* Get the number of fragments of the file */
 FRESULT f_expand (FIL* fp, FSIZE_t szf, BYTE opt);          /* Allocate a contiguous block to the file */
 FRESULT f_mount (PDRV pdrv, BYTE vol, FATFS* fs);     /* Mount a logical drive */
 FRESULT f_mkfs (PDRV pdrv, BYTE part, BYTE opt, DWORD au, void* work, UINT len);  /* Create a FAT volume */
@@ -294,6 +457,8 @@ FRESULT f_close (FIL* fp);                      /* Close an open file object */
 FRESULT f_read (FIL* fp, void* buff, UINT btr, UINT* br);     /* Read data from the file */
 FRESULT f_write (FIL* fp, const void* buff, UINT btw, UINT* bw);  /* Write data to the file */
 FRESULT f_lseek (FIL* fp, FSIZE_t ofs);               /* Move file pointer of the file object */
+FRESULT f_pread (FIL* fp, void* buff, UINT btr, FSIZE_t ofs, UINT* br);  /* Read data from the file at a given offset */
+FRESULT f_pwrite (FIL* fp, const void* buff, UINT btw, FSIZE_t ofs, UINT* bw);  /* Write data to the file at a given offset */
 FRESULT f_truncate (FIL* fp);                   /* Truncate the file */
 FRESULT f_sync (FIL* fp);                     /* Flush cached data of the writing file */
 FRESULT f_opendir (DIR* dp, const TCHAR* path);           /* Open a directory */
@@ -311,9 +476,14 @@ FRESULT f_chdir (const TCHAR* path);                /* Change current directory
 FRESULT f_chdrive (const TCHAR* path);                /* Change current drive */
 FRESULT f_getcwd (TCHAR* buff, UINT len);             /* Get current directory */
 FRESULT f_getfree (const TCHAR* path, DWORD* nclst, FATFS** fatfs); /* Get number of free clusters on the drive */
+FRESULT f_scanfree (const TCHAR* path, UINT nsect, DWORD* nclst, BYTE* exact); /* Advance the free cluster scan */
 FRESULT f_getlabel (const TCHAR* path, TCHAR* label, DWORD* vsn); /* Get volume label */
 FRESULT f_setlabel (const TCHAR* label);              /* Set volume label */
 FRESULT f_forward (FIL* fp, UINT(*func)(const BYTE*,UINT), UINT btf, UINT* bf); /* Forward data to the stream */
+FRESULT f_stream (FIL* fp, UINT(*func)(void*,const BYTE*,UINT), void* arg, UINT btf, UINT* bf); /* Forward data to the stream with an argument */
+FRESULT f_getextent (FIL* fp, FSIZE_t ofs, FSIZE_t len, FEXTENT* ext, UINT n, UINT* ne); /* Get the sectors holding the file data and pin the file */
+FRESULT f_putextent (FIL* fp);                 /* Release the file pinned by f_getextent() */
+FRESULT f_getfrag (FIL* fp, DWORD* nfrag);     /* Get the number of fragments of the file */
 FRESULT f_expand (FIL* fp, FSIZE_t szf, BYTE opt);          /* Allocate a contiguous block to the file */
 FRESULT f_mount (FATFS* fs, const TCHAR* path, BYTE opt);     /* Mount/Unmount a logical drive */
 FRESULT f_mkfs (const TCHAR* path, BYTE opt, DWORD au, void* work, UINT len); /* Create a FAT volume */
@@ -355,7 +525,7 @@ WCHAR ff_oem2uni (WCHAR oem, WORD cp);	/* OEM code to Unicode conversion */
 WCHAR ff_uni2oem (DWORD uni, WORD cp);	/* Unicode to OEM code conversion */
 DWORD ff_wtoupper (DWORD uni);			/* Unicode upper-case conversion */
 #endif
-#if FF_USE_LFN == 3						/* Dynamic memory allocation */
+#if FF_USE_LFN == 3 || FF_SS_HEAP		/* Dynamic memory allocation */
 void* ff_memalloc (UINT msize);			/* Allocate memory block */
 void ff_memfree (void* mblock);			/* Free memory block */
 #endif
@@ -57,8 +57,12 @@ typedef void* PDRV;
 /* This option switches fast seek function. (0:Disable or 1:Enable) */
 
 
-#define FF_USE_EXPAND	0
-/* This option switches f_expand function. (0:Disable or 1:Enable) */
+// OS_USE_MICRO_OS_PLUS
+// #define FF_USE_EXPAND	0
+#define FF_USE_EXPAND	1
+/* This option switches f_expand function. (0:Disable or 1:Enable)
+/  The POSIX layer uses it to preallocate a contiguous block to an empty file and
+/  to grow an empty file by ftruncate(). */
 
 // OS_USE_MICRO_OS_PLUS
 // #define FF_USE_CHMOD	0
@@ -72,8 +76,35 @@ typedef void* PDRV;
 /  (0:Disable or 1:Enable) */
 
 
-#define FF_USE_FORWARD	0
-/* This option switches f_forward() function. (0:Disable or 1:Enable) */
+// OS_USE_MICRO_OS_PLUS
+// #define FF_USE_FORWARD	0
+#define FF_USE_FORWARD	1
+/* This option switches f_forward() and f_stream() functions. (0:Disable or 1:Enable)
+/  The data is passed to the streaming function straight from the sector buffer of
+/  the file object, or from the read-ahead buffer several sectors at a time. */
+
+
+// OS_USE_MICRO_OS_PLUS
+#if !defined(FF_USE_PREAD)
+#define FF_USE_PREAD	1
+#endif
+/* This option switches f_pread() and f_pwrite() functions. (0:Disable or 1:Enable)
+/  They access the file at a given offset and leave the file pointer unchanged.
+/  Each file object keeps its own cursor on the cluster chain for them, so that a
+/  sequence of positional accesses does not follow the chain from the top of the
+/  file. FF_FS_MINIMIZE needs to be 2 or less to enable this option. */
+
+
+// OS_USE_MICRO_OS_PLUS
+#if !defined(FF_USE_EXTENT)
+#define FF_USE_EXTENT	0
+#endif
+/* This option switches f_getextent() and f_putextent() functions. (0:Disable or 1:Enable)
+/  f_getextent() returns the sector ranges holding a part of an open file, so that
+/  the data can be transferred by DMA or executed in place without going through
+/  f_read(), and pins the file against truncation until f_putextent() is called.
+/  f_getfrag(), which returns the number of fragments of an open file, is
+/  enabled by this option or by FF_FS_RESERVE. */
 
 
 /*---------------------------------------------------------------------------/
@@ -113,7 +144,7 @@ typedef void* PDRV;
 
 // OS_USE_MICRO_OS_PLUS
 // #define FF_USE_LFN		0
-#define FF_USE_LFN    1
+#define FF_USE_LFN    4
 #define FF_MAX_LFN		255
 /* The FF_USE_LFN switches the support for LFN (long file name).
 /
@@ -121,6 +152,9 @@ typedef void* PDRV;
 /   1: Enable LFN with static working buffer on the BSS. Always NOT thread-safe.
 /   2: Enable LFN with dynamic working buffer on the STACK.
 /   3: Enable LFN with dynamic working buffer on the HEAP.
+/   4: Enable LFN with working buffer in the filesystem object. Name lookups on
+/      different volumes can run in parallel, and the buffer is protected by the
+/      volume lock like the sector window.
 /
 /  To enable the LFN, ffunicode.c needs to be added to the project. The LFN function
 /  requiers certain internal working buffer occupies (FF_MAX_LFN + 1) * 2 bytes and
@@ -217,6 +251,42 @@ typedef void* PDRV;
 /  GET_SECTOR_SIZE command. */
 
 
+// OS_USE_MICRO_OS_PLUS
+#if !defined(FF_SS_HEAP)
+#define FF_SS_HEAP		0
+#endif
+/* This option switches where the sector buffers are placed. (0:In the objects or
+/  1:On the heap)
+/
+/   0: The sector window of the filesystem object, its cache lines and the sector
+/      buffers of the file object are arrays of FF_MAX_SS bytes each, whatever the
+/      sector size of the volume.
+/   1: The buffers are allocated in the sector size of the volume when the volume
+/      is mounted and when a file is opened, and freed when the volume is unmounted
+/      and when the file is closed, so that a volume with 512 byte sectors does not
+/      pay for FF_MAX_SS. FR_NOT_ENOUGH_CORE is returned if the allocation fails.
+/      The buffers of a file left open are freed when its volume is unmounted.
+/
+/  When use heap memory, memory management functions, ff_memalloc() and ff_memfree()
+/  in ffsystem.c, need to be added to the project. The filesystem object needs to
+/  be zeroed before it is mounted the first time, since a window left by a previous
+/  life is freed then. */
+
+
+// OS_USE_MICRO_OS_PLUS
+#if !defined(FF_LBA64)
+#define FF_LBA64		0
+#endif
+/* This option switches support for 64-bit LBA. (0:Disable or 1:Enable)
+/  With 32-bit LBA, media are addressable up to 2 TiB with 512 byte sectors. With
+/  64-bit LBA, the sector numbers passed to disk_read(), disk_write() and returned
+/  by GET_SECTOR_COUNT are LBA_t (QWORD), and exFAT volumes of any size can be
+/  mounted and created. FAT12/16/32 volumes still have to reside below 2^32 sectors.
+/  To enable the 64-bit LBA, also exFAT needs to be enabled. (FF_FS_EXFAT == 1)
+/  Partition tables are MBR only, so a volume over 2^32 sectors has to be created
+/  with FM_SFD. */
+
+
 #define FF_USE_TRIM		0
 /* This option switches support for ATA-TRIM. (0:Disable or 1:Enable)
 /  To enable Trim function, also CTRL_TRIM command should be implemented to the
@@ -235,6 +305,77 @@ typedef void* PDRV;
 */
 
 
+// OS_USE_MICRO_OS_PLUS
+#if !defined(FF_FS_FREEMAP)
+#define FF_FS_FREEMAP	0
+#endif
+/* The option FF_FS_FREEMAP switches the in-memory free cluster map of the FAT12/16/32
+/  volume. (0:Disable or size of the map in unit of byte, a multiple of 4)
+/  The map is built by a full FAT scan at the first cluster allocation (or at the
+/  first f_getfree() call) after the volume mount, and then it is kept up to date on
+/  each change of the FAT. create_chain() and f_expand() search it a word at a time
+/  instead of reading the FAT entry by entry.
+/  When the map can hold one bit per cluster, it is exact. When the volume has more
+/  clusters than bits in the map, it turns into a coarse summary where each bit
+/  covers a power of 2 clusters and tells whether the group can have a free cluster,
+/  so that a small map still lets the allocator skip full areas of the FAT.
+/  e.g. 4096 bytes is exact up to 32768 clusters. The exFAT volume has its own
+/  allocation bitmap on the volume and does not use this map. */
+
+
+// OS_USE_MICRO_OS_PLUS
+#if !defined(FF_FS_FREESCAN)
+#define FF_FS_FREESCAN	0
+#endif
+/* The option FF_FS_FREESCAN switches the incremental free cluster scan.
+/  (0:Disable or number of FAT sectors scanned per step)
+/  When the free cluster count is not known after the volume mount (FAT12/16, exFAT
+/  or untrusted FSINFO), f_getfree() blocks on a full FAT scan. With this option,
+/  f_scanfree() advances the scan by a bounded number of sectors per call, so that
+/  it can be run from an idle hook or a low priority thread, and returns the free
+/  clusters found so far as a lower bound until the scan is completed. The POSIX
+/  statvfs() scans this number of sectors per call and reports the lower bound as
+/  an approximate value. f_getfree() resumes the scan in progress. */
+
+
+// OS_USE_MICRO_OS_PLUS
+#if !defined(FF_FS_RESERVE)
+#define FF_FS_RESERVE	0
+#endif
+#if !defined(FF_FS_RESERVE_FILES)
+#define FF_FS_RESERVE_FILES	4
+#endif
+/* The option FF_FS_RESERVE switches the per-file allocation windows.
+/  (0:Disable or number of clusters in a window)
+/  create_chain() takes the new cluster next to the volume-wide last allocated one,
+/  so that files appended at a time get their clusters interleaved one by one.
+/  With this option, each file opened with write access gets a window of up to
+/  FF_FS_RESERVE free clusters, placed next to the end of the file, and its chain
+/  is stretched within the window. Other files skip the clusters in the window
+/  while a free cluster is found elsewhere. The window is kept in memory only and
+/  is released by f_close(). Up to FF_FS_RESERVE_FILES files hold a window at a
+/  time, and other files are allocated as usual. Each window takes 12 bytes in
+/  the filesystem object. f_getfrag() is enabled to check the fragments. */
+
+
+// OS_USE_MICRO_OS_PLUS
+#if !defined(FF_FS_FREEEXT)
+#define FF_FS_FREEEXT	0
+#endif
+/* The option FF_FS_FREEEXT switches the free extent table of the filesystem object.
+/  (0:Disable or number of free runs in the table)
+/  The cluster allocation is a next-fit scan from the last allocated cluster on
+/  both the FAT and the exFAT bitmap, so a large file is split over whatever free
+/  space follows. With this option, the longest runs of free clusters are kept in
+/  a table sorted by length, built by a full scan at the first use after the
+/  volume mount and kept up to date on each allocation and release. f_expand()
+/  takes the best-fit run for the file, and f_write() of two clusters or more
+/  continues at the best-fit run for the rest of the data when the chain cannot be
+/  stretched in a row. When the table is full, the shortest run is left out, and
+/  the table is built again for a request longer than the runs in it only once
+/  after some clusters got free. Each run takes 8 bytes in the filesystem object. */
+
+
 
 /*---------------------------------------------------------------------------/
 / System Configurations
@@ -247,6 +388,204 @@ typedef void* PDRV;
 /  buffer in the filesystem object (FATFS) is used for the file data transfer. */
 
 
+// OS_USE_MICRO_OS_PLUS
+#if !defined(FF_FS_WINCACHE)
+#define FF_FS_WINCACHE		0
+#endif
+#if !defined(FF_FS_WINCACHE_WAYS)
+#define FF_FS_WINCACHE_WAYS	FF_FS_WINCACHE
+#endif
+/* The option FF_FS_WINCACHE switches the sector cache behind the disk access window
+/  (win[]) of the filesystem object. (0:Disable or number of sectors to be cached)
+/  FAT, allocation bitmap and directory sectors which are moved out of the window are
+/  kept in the cache lines and written back to the volume only when a line is reused
+/  or at the volume sync, so that workloads that alternate between the FAT and the
+/  directory do not pay a device read and write at each switch.
+/  FF_FS_WINCACHE_WAYS defines the associativity of the cache, FF_FS_WINCACHE shall
+/  be a multiple of it. A line is selected by the sector number within its set and
+/  the least recently used line of the set is replaced. By default the cache is
+/  fully associative.
+/  Each cache line takes FF_MAX_SS bytes in the filesystem object. This option must
+/  be 0 at tiny configuration (FF_FS_TINY = 1). */
+
+
+// OS_USE_MICRO_OS_PLUS
+#if !defined(FF_FS_READAHEAD)
+#define FF_FS_READAHEAD	0
+#endif
+/* The option FF_FS_READAHEAD switches the read-ahead buffer of the file object.
+/  (0:Disable or maximum number of sectors to be read ahead)
+/  When f_read() reads less than a sector at a time, the data sectors are loaded
+/  into the file object one by one. With this option, a sector is loaded together
+/  with the following sectors up to the end of the cluster by a single disk_read()
+/  and the next sectors are taken from the read-ahead buffer. It works only while
+/  each read continues from where the previous one ended, so that random access
+/  does not pay for the sectors not needed.
+/  The buffer takes FF_FS_READAHEAD * FF_MAX_SS bytes in each file object. This
+/  option must be 0 at tiny configuration (FF_FS_TINY = 1). */
+
+
+// OS_USE_MICRO_OS_PLUS
+#if !defined(FF_FS_WRITEBEHIND)
+#define FF_FS_WRITEBEHIND	0
+#endif
+/* The option FF_FS_WRITEBEHIND switches the write-behind buffer of the file object.
+/  (0:Disable or maximum number of sectors to be combined)
+/  When f_write() writes less than a sector at a time, each data sector is written
+/  to the volume by a single disk_write() when the file pointer leaves it. With this
+/  option, the filled sectors are collected in the write-behind buffer while they
+/  are contiguous, and written by a single disk_write() when the buffer gets full,
+/  at the cluster boundary, or by f_sync(), f_close(), f_lseek() and f_read().
+/  The buffer takes FF_FS_WRITEBEHIND * FF_MAX_SS bytes in each file object. This
+/  option must be 0 at tiny configuration (FF_FS_TINY = 1). */
+
+
+// OS_USE_MICRO_OS_PLUS
+#if !defined(FF_FS_DELALLOC)
+#define FF_FS_DELALLOC	0
+#endif
+/* The option FF_FS_DELALLOC switches the delayed allocation of the file object.
+/  (0:Disable or number of sectors to be delayed)
+/  f_write() allocates a cluster as soon as the file pointer crosses a cluster
+/  boundary at end of the file, and the FAT is updated in the middle of the data.
+/  With this option, the data written past the end of the cluster chain is held in
+/  the delay buffer of the file object, and the clusters for it are allocated at a
+/  time when the buffer gets full, or by f_sync(), f_close() and f_lseek(). The
+/  clusters are taken as a contiguous run if possible and the data is written by
+/  a disk_write() per run. The clusters are counted against the free clusters at
+/  f_write() if the number of free clusters is known, and the other allocations,
+/  the directories, f_lseek(), f_expand() and the data written through, cannot
+/  take the clusters promised to the delayed data. If the clusters cannot be
+/  allocated at last, the file is cut at the end of its allocated clusters. When
+/  the data cut was counted as written, f_sync() or f_close() returns FR_DENIED
+/  once; f_close() closes the file anyway.
+/  The buffer takes FF_FS_DELALLOC * FF_MAX_SS bytes in each file object. This
+/  option must be 0 at tiny configuration (FF_FS_TINY = 1). */
+
+
+// OS_USE_MICRO_OS_PLUS
+#if !defined(FF_FS_EXTCACHE)
+#define FF_FS_EXTCACHE	0
+#endif
+/* The option FF_FS_EXTCACHE switches the extent cache of the file object.
+/  (0:Disable or number of extents to be cached)
+/  Without a cluster link map table of the fast seek function, f_lseek() to a
+/  backward cluster follows the cluster chain on the FAT from top of the file.
+/  With this option, the runs of contiguous clusters found while the chain is
+/  followed by f_read(), f_write() and f_lseek() are kept in the file object as
+/  (cluster offset, top cluster, length) in ascending order, and f_lseek() jumps
+/  to the nearest cached cluster found by a binary search. When the cache is full,
+/  the shortest extent is dropped. It needs no action of the application.
+/  Each extent takes 12 bytes in each file object. */
+
+
+// OS_USE_MICRO_OS_PLUS
+#if !defined(FF_FS_MAXXFER)
+#define FF_FS_MAXXFER	0
+#endif
+/* The option FF_FS_MAXXFER switches the multi-cluster transfer of f_read() and
+/  f_write(). (0:Disable or maximum number of sectors to be transferred at a time)
+/  When f_read() or f_write() transfers whole sectors, the data is transferred
+/  directly between the application buffer and the volume, but each transfer is
+/  clipped at the cluster boundary. With this option, the following clusters are
+/  checked on the cluster chain (or on the extent cache and the link map table if
+/  available) and the transfer is stretched over the clusters while they are
+/  contiguous, so that a large read or write of a contiguous file is issued as a
+/  single disk_read() or disk_write() up to this number of sectors. A contiguous
+/  file on the exFAT volume needs no access to the FAT. */
+
+
+// OS_USE_MICRO_OS_PLUS
+#if !defined(FF_FS_BULKBUF)
+#define FF_FS_BULKBUF	0
+#endif
+/* The option FF_FS_BULKBUF switches the bulk buffer of the filesystem object.
+/  (0:Disable or size of the buffer in unit of byte, a power of 2 above FF_MAX_SS)
+/  A new directory cluster is cleared and the FAT or the allocation bitmap is
+/  scanned for f_getfree() sector by sector through the window, unless a buffer
+/  of several sectors can be taken for them. With FF_USE_LFN == 3 or FF_SS_HEAP,
+/  the buffer is allocated on the heap for each operation and this option is not
+/  used. Otherwise, this option places a buffer of this size in the filesystem
+/  object, so that the operations are done by multi-sector transfers without
+/  heap memory. */
+
+
+// OS_USE_MICRO_OS_PLUS
+#if !defined(FF_FS_DCACHE)
+#define FF_FS_DCACHE	0
+#endif
+#if !defined(FF_FS_DCNAME)
+#define FF_FS_DCNAME	24
+#endif
+/* The option FF_FS_DCACHE switches the directory entry cache of the filesystem
+/  object. (0:Disable or number of names to be cached)
+/  Each path segment is looked up with a linear scan of the directory. With this
+/  option, the results of the lookups on the FAT/FAT32 volume are kept per volume
+/  as (parent directory, case-folded name) -> location of the entry, and also
+/  the names that were not found. A hit moves the window to the entry only, which
+/  is checked against the SFN checksum. The names in a directory are forgotten
+/  when an entry is created in or removed from it. LFN needs to be enabled.
+/  exFAT lookups are not cached, they already skip entries by the name hash.
+/  FF_FS_DCNAME is the longest name to be cached, in UTF-16 code units. Each
+/  entry takes FF_FS_DCNAME * 2 + 19 bytes in the filesystem object. */
+
+
+// OS_USE_MICRO_OS_PLUS
+#if !defined(FF_FS_NAMEINDEX)
+#define FF_FS_NAMEINDEX	0
+#endif
+#if !defined(FF_FS_NAMEINDEX_DIRS)
+#define FF_FS_NAMEINDEX_DIRS	4
+#endif
+/* The option FF_FS_NAMEINDEX switches the name index of the filesystem object.
+/  (0:Disable or number of hash slots shared by the indexed directories)
+/  On the FAT/FAT32 volume, a name not in the dentry cache is looked up by
+/  comparing it with every entry in the directory. With this option, the first
+/  lookup in a directory with 32 or more objects builds a hash table of its names
+/  (the case-folded LFN and the SFN of each object) pointing to their entries, so
+/  that a lookup reads only the entries with the same hash, and a name not in the
+/  table is known not to exist without reading the directory. The tables are
+/  kept up to date when an entry is created or removed. Up to FF_FS_NAMEINDEX_DIRS
+/  directories are indexed at a time; the least recently used table is dropped
+/  when a new one does not fit in the slots. A table has a power of 2 slots, at
+/  least 1.5 times the number of its keys, so a directory with more objects than
+/  about FF_FS_NAMEINDEX / 3 is not indexed. LFN needs to be enabled.
+/  Each slot takes 4 bytes in the filesystem object. */
+
+
+// OS_USE_MICRO_OS_PLUS
+#if !defined(FF_FS_DIRHINT)
+#define FF_FS_DIRHINT	0
+#endif
+/* The option FF_FS_DIRHINT switches the free entry hint of the filesystem object.
+/  (0:Disable or number of directories to be hinted)
+/  To create an object, the directory is scanned from the top for a run of blank
+/  entries long enough for it, which makes creating many files in a directory
+/  quadratic. With this option, the offset of the first entry that can be blank,
+/  the offset of the blank tail of the table and the longest run of blank entries
+/  before the tail are kept per directory, so that the scan starts at the first
+/  blank entry, or at the tail when no run before it is long enough. Removing an
+/  object moves the hint back. The least recently used hint is dropped when a new
+/  directory is hinted. Each hint takes 17 bytes in the filesystem object. */
+
+
+// OS_USE_MICRO_OS_PLUS
+#if !defined(FF_FS_NUMNAME)
+#define FF_FS_NUMNAME	0
+#endif
+/* The option FF_FS_NUMNAME switches the way to pick the numbered SFN of an
+/  object whose LFN does not fit in 8.3 format. (0:Disable or 1:Enable)
+/  Without this option, the numbers 1-99 are tried in turn (1-5 sequential, then
+/  hashed from the LFN) with a scan of the directory for each, which makes creating
+/  many files with a common long prefix in a directory quadratic, and fails with
+/  FR_DENIED when they are all taken. With this option, the numbers taken by the
+/  names made from the same SFN are collected in a single scan and the lowest free
+/  one is used, in sequence without a hash, or the one above all of them when the
+/  lowest 255 are taken. In a directory with a name index, the number above all
+/  the numbers in the directory is used without a scan. There is no limit on the
+/  number of colliding names. */
+
+
 // OS_USE_MICRO_OS_PLUS
 // #define FF_FS_EXFAT		0
 #define FF_FS_EXFAT   1
@@ -281,9 +620,13 @@ typedef void* PDRV;
 /      lock control is independent of re-entrancy. */
 
 
+// OS_USE_MICRO_OS_PLUS
+#if !defined(FF_FS_REENTRANT)
 #define FF_FS_REENTRANT	0
+#endif
 #define FF_FS_TIMEOUT	1000
-#define FF_SYNC_t		HANDLE
+// #define FF_SYNC_t		HANDLE
+#define FF_SYNC_t		struct ff_sync*
 /* The option FF_FS_REENTRANT switches the re-entrancy (thread safe) of the FatFs
 /  module itself. Note that regardless of this option, file access to different
 /  volume is always re-entrant and volume control functions, f_mount(), f_mkfs()
@@ -299,10 +642,34 @@ typedef void* PDRV;
 /  The FF_FS_TIMEOUT defines timeout period in unit of time tick.
 /  The FF_SYNC_t defines O/S dependent sync object type. e.g. HANDLE, ID, OS_EVENT*,
 /  SemaphoreHandle_t and etc. A header file for O/S definitions needs to be
-/  included somewhere in the scope of ff.h. */
+/  included somewhere in the scope of ff.h.
+/
+/  In src/posix-io/ffsystem.cpp the sync object is a µOS++ mutex, or a
+/  std::timed_mutex when OS_USE_CHAN_FATFS_STD_MUTEX is defined for host builds
+/  (FF_FS_TIMEOUT is then in milliseconds). OS_INCLUDE_CHAN_FATFS_SYNC_STATISTICS
+/  adds a short spin before blocking and counts the grants, the contended waits
+/  and the timeouts. */
 
 /* #include <windows.h>	// O/S definitions  */
 
 
+// OS_USE_MICRO_OS_PLUS
+#if !defined(FF_FS_REENTRANT_FILE)
+#define FF_FS_REENTRANT_FILE	0
+#endif
+/* The option FF_FS_REENTRANT_FILE switches the lock granularity of f_read().
+/  (0:Disable or 1:Enable)
+/  With FF_FS_REENTRANT only, f_read() holds the volume lock while the data is
+/  transferred, so reads of different files on the same volume are serialized.
+/  When enabled, f_read() releases the volume lock after the file object has been
+/  validated and takes it again only while the cluster chain is followed on the
+/  FAT. Reads served by the sector buffer or the read-ahead buffer of the file
+/  object and multi-sector direct reads do not take the volume lock. f_forward()
+/  and f_stream() do the same, so that a blocking streaming function does not hold
+/  up the volume. The file object must be locked by the caller instead, and the
+/  disk functions must be able to run concurrently on the same drive.
+/  FF_FS_REENTRANT must be 1 and FF_FS_TINY must be 0. */
+
+
 
 /*--- End of configuration options ---*/
@@ -31,6 +31,30 @@ extern "C"
   int
   fatfs_compute_errno (FRESULT res);
 
+#if FF_FS_REENTRANT
+
+  // Counters of the volume sync object (ffsystem.cpp).
+  typedef struct
+  {
+    // Grants obtained.
+    DWORD acquisitions;
+    // Grants that found the volume locked.
+    DWORD contentions;
+    // Grants that failed after FF_FS_TIMEOUT.
+    DWORD timeouts;
+    // Total and longest wait of the contended grants, in microseconds.
+    DWORD wait_us;
+    DWORD wait_max_us;
+  } fatfs_sync_statistics_t;
+
+  void
+  fatfs_sync_statistics (FF_SYNC_t sobj, fatfs_sync_statistics_t* stats);
+
+  void
+  fatfs_sync_statistics_clear (FF_SYNC_t sobj);
+
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -143,6 +143,113 @@ namespace os
       virtual int
       do_statvfs (struct statvfs* buf) override;
 
+      /**
+       * @}
+       */
+
+      // ----------------------------------------------------------------------
+      /**
+       * @name Sector Cache Statistics
+       * @{
+       */
+
+    public:
+
+      /**
+       * @brief Counters of the FAT/directory sector cache and of
+       * the directory entry cache.
+       * @details
+       * Counted since the volume was mounted; all zero when
+       * the cache is not enabled (`FF_FS_WINCACHE`, `FF_FS_DCACHE`
+       * is 0).
+       */
+      struct cache_statistics_t
+      {
+        // Window moves served from the cache.
+        DWORD hits;
+        // Window moves that had to read the device.
+        DWORD misses;
+        // Dirty sectors written back to the device.
+        DWORD writebacks;
+        // Name lookups served from the directory entry cache.
+        DWORD lookup_hits;
+        // Name lookups that scanned the directory.
+        DWORD lookup_misses;
+      };
+
+      cache_statistics_t
+      cache_statistics (void) const;
+
+      void
+      cache_statistics_clear (void);
+
+      /**
+       * @}
+       */
+
+      // ----------------------------------------------------------------------
+      /**
+       * @name Volume Lock Statistics
+       * @{
+       */
+
+    public:
+
+      /**
+       * @brief Counters of the FatFs volume lock.
+       * @details
+       * Counted since the volume was mounted; all zero when the
+       * volume is not mounted, when `FF_FS_REENTRANT` is 0, or
+       * without `OS_INCLUDE_CHAN_FATFS_SYNC_STATISTICS`.
+       */
+      struct lock_statistics_t
+      {
+        // Grants obtained.
+        DWORD acquisitions;
+        // Grants that found the volume locked.
+        DWORD contentions;
+        // Grants that failed after FF_FS_TIMEOUT.
+        DWORD timeouts;
+        // Total and longest wait of the contended grants, in microseconds.
+        DWORD wait_us;
+        DWORD wait_max_us;
+      };
+
+      lock_statistics_t
+      lock_statistics (void) const;
+
+      void
+      lock_statistics_clear (void);
+
+      /**
+       * @}
+       */
+
+      // ----------------------------------------------------------------------
+      /**
+       * @name Free Space Scan
+       * @{
+       */
+
+    public:
+
+      /**
+       * @brief Advance the free space scan.
+       * @param sectors Maximum number of FAT sectors to scan
+       *  (0 only to get the status).
+       * @retval 1 The free space count is exact.
+       * @retval 0 The scan is still in progress.
+       * @retval -1 Error, with `errno` set.
+       * @details
+       * Intended to be called from an idle hook or a low priority
+       * thread after mount, so that `statvfs()` does not have to wait
+       * for a full FAT scan. Until the scan is completed, the free
+       * block counts returned by `statvfs()` are a lower bound.
+       * Without `FF_FS_FREESCAN` it completes the scan in a single call.
+       */
+      virtual int
+      scan_free_space (std::size_t sectors);
+
       /**
        * @}
        */
@@ -160,7 +267,8 @@ namespace os
        */
 
       // Chan FatFS file system status.
-      // It includes a FF_MAX_SS bytes buffer.
+      // It includes a FF_MAX_SS bytes buffer, or with FF_SS_HEAP a
+      // sector size buffer allocated at mount.
       FATFS ff_fs_;
 
       /**
@@ -180,7 +288,9 @@ namespace os
 
         using lockable_type = L;
 
-        using file_type = file_lockable<chan_fatfs_file_impl, L>;
+        // With FF_FS_REENTRANT_FILE, the volume is locked by FatFs itself
+        // and each file has its own locker.
+        using file_type = chan_fatfs_file_lockable<L>;
         using directory_type = directory_lockable<chan_fatfs_directory_impl, L>;
 
         // ----------------------------------------------------------------------
@@ -237,6 +347,9 @@ namespace os
         virtual directory*
         do_opendir (/* class */ file_system& fs, const char* dirname) override;
 
+        virtual int
+        scan_free_space (std::size_t sectors) override;
+
         // ----------------------------------------------------------------------
 
         lockable_type&
@@ -345,6 +458,17 @@ namespace os
         return dir;
       }
 
+    template<typename L>
+      int
+      chan_fatfs_file_system_impl_lockable<L>::scan_free_space (
+          std::size_t sectors)
+      {
+        std::lock_guard<L> lock
+          { locker_ };
+
+        return chan_fatfs_file_system_impl::scan_free_space (sectors);
+      }
+
     template<typename L>
       inline typename chan_fatfs_file_system_impl_lockable<L>::lockable_type&
       chan_fatfs_file_system_impl_lockable<L>::locker (void)
@@ -19,6 +19,13 @@
 
 #include <cmsis-plus/posix-io/file.h>
 #include <chan-fatfs/ff.h>
+#include <chan-fatfs/utils.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <mutex>
+#include <type_traits>
+#include <utility>
 
 // ----------------------------------------------------------------------------
 
@@ -125,6 +132,232 @@ namespace os
        * @}
        */
 
+#if FF_USE_PREAD
+
+      // ----------------------------------------------------------------------
+      /**
+       * @name Positional Access
+       * @{
+       */
+
+    public:
+
+      /**
+       * @brief Read from the file at a given offset.
+       * @param buf Pointer to the buffer.
+       * @param nbyte Number of bytes to read.
+       * @param offset File offset to read from.
+       * @return The number of bytes read, or -1 with `errno` set.
+       * @details
+       * The file offset used by `read()`, `write()` and `lseek()`
+       * is not changed. The file keeps its own position on the
+       * cluster chain for the positional accesses, so a sequence of
+       * them does not follow the chain from the top of the file.
+       */
+      ssize_t
+      pread (void* buf, std::size_t nbyte, off_t offset);
+
+      /**
+       * @brief Write to the file at a given offset.
+       * @param buf Pointer to the data.
+       * @param nbyte Number of bytes to write.
+       * @param offset File offset to write at.
+       * @return The number of bytes written, or -1 with `errno` set.
+       * @details
+       * As `pread()`. The file is extended if the offset is beyond
+       * its end; the content of the gap is undefined, as with
+       * `lseek()` followed by `write()`.
+       */
+      ssize_t
+      pwrite (const void* buf, std::size_t nbyte, off_t offset);
+
+      /**
+       * @}
+       */
+
+#endif /* FF_USE_PREAD */
+
+#if FF_USE_EXPAND && !FF_FS_READONLY
+
+      // ----------------------------------------------------------------------
+      /**
+       * @name Preallocation
+       * @{
+       */
+
+    public:
+
+      /**
+       * @brief When the preallocated clusters are allocated.
+       */
+      enum class allocation : std::uint8_t
+      {
+        /**
+         * @brief Find the contiguous block and let the next writes
+         * allocate it; the file size is not changed.
+         */
+        lazily = 0,
+
+        /**
+         * @brief Allocate the contiguous block now; the file size
+         * is set to the preallocated length.
+         */
+        now = 1
+      };
+
+      /**
+       * @brief Preallocate a contiguous block of clusters to the file.
+       * @param length Number of bytes to preallocate.
+       * @param mode `allocation::now` or `allocation::lazily`.
+       * @retval 0 Success.
+       * @retval -1 Error, with `errno` set.
+       * @details
+       * The file needs to be open for writing and empty. On the exFAT
+       * volume, the file allocated now is flagged as contiguous
+       * (no FAT chain), so it is read and written without any FAT
+       * access. The content of the preallocated block is undefined.
+       *
+       * Allocating lazily reserves nothing: the block is only a hint
+       * for the next allocation, and other files can take it.
+       *
+       * It fails with `ENOSPC` if there is no contiguous free block
+       * large enough, with `EFBIG` if the length is over the FAT
+       * file size limit, and with `EINVAL` if the length is not
+       * positive or the file is not empty.
+       */
+      int
+      preallocate (off_t length, allocation mode = allocation::now);
+
+      /**
+       * @}
+       */
+
+#endif /* FF_USE_EXPAND && !FF_FS_READONLY */
+
+#if FF_USE_FORWARD
+
+      // ----------------------------------------------------------------------
+      /**
+       * @name Streaming
+       * @{
+       */
+
+    public:
+
+      /**
+       * @brief Pass the file data to a sink without copying it.
+       * @tparam F Type of the callable.
+       * @param sink Callable with the signature
+       *  `std::size_t (const std::uint8_t* data, std::size_t size)`.
+       * @param nbyte Maximum number of bytes to pass.
+       * @return The number of bytes passed, or -1 with `errno` set.
+       * @details
+       * The data is read from the current file position, and the
+       * sink is called with read-only spans pointing straight into
+       * the sector buffer of the file, or into the read-ahead buffer
+       * for several sectors at a time (`FF_FS_READAHEAD`). The
+       * spans are valid only during the call.
+       *
+       * The sink returns the number of bytes it took. When it takes
+       * less than offered (including none), the sink is busy and the
+       * streaming stops there; the file position is advanced by the
+       * bytes taken, so the next call continues from there.
+       */
+      template<typename F>
+        ssize_t
+        stream (F&& sink, std::size_t nbyte);
+
+      /**
+       * @}
+       */
+
+#endif /* FF_USE_FORWARD */
+
+#if FF_USE_EXTENT
+
+      // ----------------------------------------------------------------------
+      /**
+       * @name Extents
+       * @{
+       */
+
+    public:
+
+      /**
+       * @brief Range of contiguous sectors holding file data.
+       * @details
+       * `ofs` is the file offset of the first sector, `sect` the
+       * first sector on the block device and `count` the number
+       * of sectors.
+       */
+      using extent_t = FEXTENT;
+
+      /**
+       * @brief Get the sectors holding a part of the file.
+       * @param offset File offset of the first byte.
+       * @param nbyte Number of bytes.
+       * @param ext Pointer to the array of extents to fill.
+       * @param count Number of items in the array.
+       * @return The number of extents filled, or -1 with `errno` set.
+       * @details
+       * The byte range is clipped at the end of the file and rounded
+       * out to whole sectors; the tail of the last sector beyond the
+       * end of the file is undefined. If the array is too short,
+       * the extents of the beginning of the range are returned,
+       * and the call can be repeated from the end of the last one.
+       * A contiguous exFAT file always returns a single extent.
+       *
+       * The buffered data of the file is written to the device
+       * first. On success, the file is pinned: it cannot be
+       * truncated until `release_extents()` is called, or the file
+       * is closed. Data written to the sectors directly is not seen
+       * through the file buffer of a sector partially accessed
+       * before.
+       */
+      ssize_t
+      extents (off_t offset, std::size_t nbyte, extent_t* ext,
+               std::size_t count);
+
+      /**
+       * @brief Release the file pinned by `extents()`.
+       * @retval 0 Success.
+       * @retval -1 Error, with `errno` set.
+       */
+      int
+      release_extents (void);
+
+      /**
+       * @}
+       */
+
+#endif /* FF_USE_EXTENT */
+
+#if FF_FS_RESERVE || FF_USE_EXTENT
+
+      // ----------------------------------------------------------------------
+      /**
+       * @name Fragmentation
+       * @{
+       */
+
+      /**
+       * @brief Get the number of fragments of the file.
+       * @return The number of runs of contiguous clusters holding
+       * the file data (0 for an empty file), or -1 with `errno` set.
+       * @details
+       * It follows the whole cluster chain, so it is meant for
+       * diagnostics, e.g. to check the effect of the allocation
+       * windows (`FF_FS_RESERVE`) on files written at a time.
+       */
+      ssize_t
+      fragments (void);
+
+      /**
+       * @}
+       */
+
+#endif /* FF_FS_RESERVE || FF_USE_EXTENT */
+
       // ----------------------------------------------------------------------
     public:
 
@@ -140,6 +373,192 @@ namespace os
        */
     };
 
+    // ========================================================================
+
+#if FF_FS_REENTRANT_FILE
+
+    /**
+     * @cond ignore
+     */
+
+    // Constructed before file_lockable, which keeps a reference to it.
+    template<typename L>
+      class chan_fatfs_file_locker
+      {
+      protected:
+
+        L file_locker_;
+      };
+
+    /**
+     * @endcond
+     */
+
+#endif /* FF_FS_REENTRANT_FILE */
+
+    /**
+     * @brief Lockable file, with the FatFs extensions locked too.
+     * @details
+     * The extensions of `chan_fatfs_file_impl` are forwarded with
+     * the locker held, as the standard file operations are.
+     *
+     * With `FF_FS_REENTRANT_FILE`, the FatFs functions lock the volume
+     * by themselves, and `f_read()` only while it follows the cluster
+     * chain. The file operations are serialised by a locker owned by
+     * the file, so reads of different files run in parallel.
+     * The volume locker is accepted for compatibility with
+     * `file_system::allocate_file()`, but not used.
+     * Otherwise the file is locked by the volume locker.
+     */
+    template<typename L>
+      class chan_fatfs_file_lockable :
+#if FF_FS_REENTRANT_FILE
+          protected chan_fatfs_file_locker<L>,
+#endif
+          public file_lockable<chan_fatfs_file_impl, L>
+      {
+      public:
+
+        using lockable_type = L;
+
+        chan_fatfs_file_lockable (/* class */ file_system& fs,
+                                  lockable_type& locker);
+
+        /**
+         * @cond ignore
+         */
+
+        // The rule of five.
+        chan_fatfs_file_lockable (const chan_fatfs_file_lockable&) = delete;
+        chan_fatfs_file_lockable (chan_fatfs_file_lockable&&) = delete;
+        chan_fatfs_file_lockable&
+        operator= (const chan_fatfs_file_lockable&) = delete;
+        chan_fatfs_file_lockable&
+        operator= (chan_fatfs_file_lockable&&) = delete;
+
+        /**
+         * @endcond
+         */
+
+        virtual
+        ~chan_fatfs_file_lockable () override = default;
+
+        // --------------------------------------------------------------------
+        /**
+         * @name Public Member Functions
+         * @{
+         */
+
+      public:
+
+#if FF_USE_PREAD
+
+        /**
+         * @brief Read from the file at a given offset.
+         * @details
+         * As `chan_fatfs_file_impl::pread()`, with the locker held.
+         */
+        ssize_t
+        pread (void* buf, std::size_t nbyte, off_t offset);
+
+        /**
+         * @brief Write to the file at a given offset.
+         * @details
+         * As `chan_fatfs_file_impl::pwrite()`, with the locker held.
+         */
+        ssize_t
+        pwrite (const void* buf, std::size_t nbyte, off_t offset);
+
+#endif /* FF_USE_PREAD */
+
+#if FF_USE_EXPAND && !FF_FS_READONLY
+
+        using allocation = chan_fatfs_file_impl::allocation;
+
+        /**
+         * @brief Preallocate a contiguous block of clusters to the file.
+         * @details
+         * As `chan_fatfs_file_impl::preallocate()`, with the locker held.
+         */
+        int
+        preallocate (off_t length, allocation mode = allocation::now);
+
+#endif /* FF_USE_EXPAND && !FF_FS_READONLY */
+
+#if FF_USE_FORWARD
+
+        /**
+         * @brief Pass the file data to a sink without copying it.
+         * @details
+         * As `chan_fatfs_file_impl::stream()`, with the locker held;
+         * the sink is called with the locker held too.
+         */
+        template<typename F>
+          ssize_t
+          stream (F&& sink, std::size_t nbyte);
+
+#endif /* FF_USE_FORWARD */
+
+#if FF_USE_EXTENT
+
+        using extent_t = chan_fatfs_file_impl::extent_t;
+
+        /**
+         * @brief Get the sectors holding a part of the file.
+         * @details
+         * As `chan_fatfs_file_impl::extents()`, with the locker held.
+         */
+        ssize_t
+        extents (off_t offset, std::size_t nbyte, extent_t* ext,
+                 std::size_t count);
+
+        /**
+         * @brief Release the file pinned by `extents()`.
+         * @details
+         * As `chan_fatfs_file_impl::release_extents()`, with the locker
+         * held.
+         */
+        int
+        release_extents (void);
+
+#endif /* FF_USE_EXTENT */
+
+#if FF_FS_RESERVE || FF_USE_EXTENT
+
+        /**
+         * @brief Get the number of fragments of the file.
+         * @details
+         * As `chan_fatfs_file_impl::fragments()`, with the locker held.
+         */
+        ssize_t
+        fragments (void);
+
+#endif /* FF_FS_RESERVE || FF_USE_EXTENT */
+
+        lockable_type&
+        locker (void);
+
+        /**
+         * @}
+         */
+
+#if !FF_FS_REENTRANT_FILE
+
+      protected:
+
+        /**
+         * @cond ignore
+         */
+
+        lockable_type& volume_locker_;
+
+        /**
+         * @endcond
+         */
+
+#endif /* !FF_FS_REENTRANT_FILE */
+      };
+
   // ==========================================================================
   } /* namespace posix */
 } /* namespace os */
@@ -158,6 +577,166 @@ namespace os
       return &ff_fil_;
     }
 
+#if FF_USE_FORWARD
+
+    template<typename F>
+      ssize_t
+      chan_fatfs_file_impl::stream (F&& sink, std::size_t nbyte)
+      {
+        using sink_type = typename std::remove_reference<F>::type;
+
+        // Captureless, the sink is passed as the argument.
+        auto call = [](void* arg, const BYTE* data, UINT size) -> UINT
+          {
+            return static_cast<UINT> ((*static_cast<sink_type*> (arg)) (
+                static_cast<const std::uint8_t*> (data),
+                static_cast<std::size_t> (size)));
+          };
+
+        UINT bf;
+        FRESULT res = f_stream (
+            &ff_fil_, call,
+            const_cast<void*> (static_cast<const void*> (&sink)),
+            static_cast<UINT> (nbyte), &bf);
+        if (res != FR_OK)
+          {
+            errno = fatfs_compute_errno (res);
+            return -1;
+          }
+        return static_cast<ssize_t> (bf);
+      }
+
+#endif /* FF_USE_FORWARD */
+
+    // ========================================================================
+
+    template<typename L>
+      chan_fatfs_file_lockable<L>::chan_fatfs_file_lockable (
+          /* class */ file_system& fs,
+#if FF_FS_REENTRANT_FILE
+          lockable_type& locker __attribute__((unused))) :
+          file_lockable<chan_fatfs_file_impl, L>
+            { fs, this->file_locker_ }
+#else
+          lockable_type& locker) :
+          file_lockable<chan_fatfs_file_impl, L>
+            { fs, locker }, //
+          volume_locker_ (locker)
+#endif
+      {
+      }
+
+#if FF_USE_PREAD
+
+    template<typename L>
+      ssize_t
+      chan_fatfs_file_lockable<L>::pread (void* buf, std::size_t nbyte,
+                                          off_t offset)
+      {
+        std::lock_guard<L> lock
+          { locker () };
+
+        return static_cast<chan_fatfs_file_impl&> (this->impl ()).pread (
+            buf, nbyte, offset);
+      }
+
+    template<typename L>
+      ssize_t
+      chan_fatfs_file_lockable<L>::pwrite (const void* buf, std::size_t nbyte,
+                                           off_t offset)
+      {
+        std::lock_guard<L> lock
+          { locker () };
+
+        return static_cast<chan_fatfs_file_impl&> (this->impl ()).pwrite (
+            buf, nbyte, offset);
+      }
+
+#endif /* FF_USE_PREAD */
+
+#if FF_USE_EXPAND && !FF_FS_READONLY
+
+    template<typename L>
+      int
+      chan_fatfs_file_lockable<L>::preallocate (off_t length, allocation mode)
+      {
+        std::lock_guard<L> lock
+          { locker () };
+
+        return static_cast<chan_fatfs_file_impl&> (this->impl ()).preallocate (
+            length, mode);
+      }
+
+#endif /* FF_USE_EXPAND && !FF_FS_READONLY */
+
+#if FF_USE_FORWARD
+
+    template<typename L>
+      template<typename F>
+        ssize_t
+        chan_fatfs_file_lockable<L>::stream (F&& sink, std::size_t nbyte)
+        {
+          std::lock_guard<L> lock
+            { locker () };
+
+          return static_cast<chan_fatfs_file_impl&> (this->impl ()).stream (
+              std::forward<F> (sink), nbyte);
+        }
+
+#endif /* FF_USE_FORWARD */
+
+#if FF_USE_EXTENT
+
+    template<typename L>
+      ssize_t
+      chan_fatfs_file_lockable<L>::extents (off_t offset, std::size_t nbyte,
+                                            extent_t* ext, std::size_t count)
+      {
+        std::lock_guard<L> lock
+          { locker () };
+
+        return static_cast<chan_fatfs_file_impl&> (this->impl ()).extents (
+            offset, nbyte, ext, count);
+      }
+
+    template<typename L>
+      int
+      chan_fatfs_file_lockable<L>::release_extents (void)
+      {
+        std::lock_guard<L> lock
+          { locker () };
+
+        return static_cast<chan_fatfs_file_impl&> (
+            this->impl ()).release_extents ();
+      }
+
+#endif /* FF_USE_EXTENT */
+
+#if FF_FS_RESERVE || FF_USE_EXTENT
+
+    template<typename L>
+      ssize_t
+      chan_fatfs_file_lockable<L>::fragments (void)
+      {
+        std::lock_guard<L> lock
+          { locker () };
+
+        return static_cast<chan_fatfs_file_impl&> (this->impl ()).fragments ();
+      }
+
+#endif /* FF_FS_RESERVE || FF_USE_EXTENT */
+
+    template<typename L>
+      inline typename chan_fatfs_file_lockable<L>::lockable_type&
+      chan_fatfs_file_lockable<L>::locker (void)
+      {
+#if FF_FS_REENTRANT_FILE
+        return this->file_locker_;
+#else
+        return volume_locker_;
+#endif
+      }
+
   // ==========================================================================
   } /* namespace posix */
 } /* namespace os */
@@ -240,6 +240,20 @@
 #else
 #define LEAVE_FF(fs, res)	return res
 #endif
+#if FF_FS_REENTRANT && defined(FF_FS_POSIX_INTEGRATION) // OS_USE_MICRO_OS_PLUS
+#define ENTER_FF(fs)		{ if (!lock_fs(fs)) return FR_TIMEOUT; }	/* The volume is given by the caller, not found by the path */
+#else
+#define ENTER_FF(fs)
+#endif
+#if FF_FS_REENTRANT_FILE
+#if !FF_FS_REENTRANT || FF_FS_TINY
+#error FF_FS_REENTRANT_FILE needs FF_FS_REENTRANT and a sector buffer in the file object
+#endif
+#define LEAVE_RD(fs, res)	return res		/* f_read() does not hold the volume lock while transferring the data */
+#else
+#define LEAVE_RD(fs, res)	LEAVE_FF(fs, res)
+#endif
+#define ABORT_RD(fs, res)	{ fp->err = (BYTE)(res); LEAVE_RD(fs, res); }
 
 
 /* Definitions of volume - physical location conversion */
@@ -263,6 +277,45 @@
 #endif
 
 
+/* Sector cache behind the window */
+#if FF_FS_WINCACHE
+#if FF_FS_TINY
+#error FF_FS_WINCACHE must be 0 at tiny configuration
+#endif
+#if FF_FS_WINCACHE_WAYS < 1 || FF_FS_WINCACHE % FF_FS_WINCACHE_WAYS
+#error Wrong setting of FF_FS_WINCACHE_WAYS
+#endif
+#define WC_SETS	(FF_FS_WINCACHE / FF_FS_WINCACHE_WAYS)	/* Number of cache sets */
+#endif
+
+
+/* Read-ahead and write-behind buffers of the file object */
+#if FF_FS_READAHEAD && FF_FS_TINY
+#error FF_FS_READAHEAD must be 0 at tiny configuration
+#endif
+#if FF_FS_WRITEBEHIND && (FF_FS_TINY || FF_FS_READONLY)
+#error FF_FS_WRITEBEHIND must be 0 at tiny or read-only configuration
+#endif
+#if FF_FS_DELALLOC && (FF_FS_TINY || FF_FS_READONLY)
+#error FF_FS_DELALLOC must be 0 at tiny or read-only configuration
+#endif
+
+
+/* Temporary buffer of the multi-sector table clear and scan */
+#if FF_USE_LFN == 3 || FF_SS_HEAP	/* Taken from the heap */
+#define BULK_MAX	0x8000
+#define BULK_ALLOC(fs, sz)	ff_memalloc(sz)
+#define BULK_FREE(buf)	ff_memfree(buf)
+#elif FF_FS_BULKBUF				/* Taken from the filesystem object */
+#if FF_FS_BULKBUF & (FF_FS_BULKBUF - 1) || FF_FS_BULKBUF <= FF_MAX_SS
+#error Wrong setting of FF_FS_BULKBUF
+#endif
+#define BULK_MAX	FF_FS_BULKBUF
+#define BULK_ALLOC(fs, sz)	((fs)->bulkbuf)
+#define BULK_FREE(buf)
+#endif
+
+
 /* Timestamp */
 #if FF_FS_NORTC == 1
 #if FF_NORTC_YEAR < 1980 || FF_NORTC_YEAR > 2107 || FF_NORTC_MON < 1 || FF_NORTC_MON > 12 || FF_NORTC_MDAY < 1 || FF_NORTC_MDAY > 31
@@ -534,6 +587,12 @@ static WCHAR LfnBuf[FF_MAX_LFN + 1];		/* LFN working buffer */
 #define LEAVE_MKFS(res)	{ if (!work) ff_memfree(buf); return res; }
 #define MAX_MALLOC	0x8000
 
+#elif FF_USE_LFN == 4	/* LFN enabled with working buffer in the filesystem object */ // OS_USE_MICRO_OS_PLUS
+#define DEF_NAMBUF
+#define INIT_NAMBUF(fs)
+#define FREE_NAMBUF()
+#define LEAVE_MKFS(res)	return res
+
 #else
 #error Wrong setting of FF_USE_LFN
 
@@ -1069,6 +1128,24 @@ void clear_lock (	/* Clear lock entries of the volume */
 /* Move/Flush disk access window in the filesystem object                */
 /*-----------------------------------------------------------------------*/
 #if !FF_FS_READONLY
+static
+FRESULT write_sector (	/* Returns FR_OK or FR_DISK_ERR */
+	FATFS* fs,			/* Filesystem object */
+	const BYTE* buff,	/* Sector data to be written back */
+	LBA_t sector		/* Sector number */
+)
+{
+	if (disk_write(fs->pdrv, buff, sector, 1) != RES_OK) return FR_DISK_ERR;
+	if (sector - fs->fatbase < fs->fsize) {	/* Is it in the 1st FAT? */
+		if (fs->n_fats == 2) disk_write(fs->pdrv, buff, sector + fs->fsize, 1);	/* Reflect it to 2nd FAT if needed */
+	}
+#if FF_FS_WINCACHE
+	fs->wc_wback++;
+#endif
+	return FR_OK;
+}
+
+
 static
 FRESULT sync_window (	/* Returns FR_OK or FR_DISK_ERR */
 	FATFS* fs			/* Filesystem object */
@@ -1078,40 +1155,163 @@ FRESULT sync_window (	/* Returns FR_OK or FR_DISK_ERR */
 
 
 	if (fs->wflag) {	/* Is the disk access window dirty */
-		if (disk_write(fs->pdrv, fs->win, fs->winsect, 1) == RES_OK) {	/* Write back the window */
-			fs->wflag = 0;	/* Clear window dirty flag */
-			if (fs->winsect - fs->fatbase < fs->fsize) {	/* Is it in the 1st FAT? */
-				if (fs->n_fats == 2) disk_write(fs->pdrv, fs->win, fs->winsect + fs->fsize, 1);	/* Reflect it to 2nd FAT if needed */
+		res = write_sector(fs, fs->win, fs->winsect);	/* Write back the window */
+		if (res == FR_OK) fs->wflag = 0;	/* Clear window dirty flag */
+	}
+	return res;
+}
+#endif
+
+
+#if FF_FS_WINCACHE
+/*-----------------------------------------------------------------------*/
+/* Sector cache behind the window                                        */
+/*-----------------------------------------------------------------------*/
+/* A sector is held either in the win[] or in a cache line, never in both.
+/  The win[] stays at a fixed address because the directory and file objects
+/  keep pointers into it, so the sector data is copied between the window
+/  and the cache lines. */
+
+#if !FF_FS_READONLY
+static
+void wc_discard (
+	FATFS* fs,		/* Filesystem object */
+	LBA_t sect,		/* Top of the sector range to drop from the cache */
+	DWORD count		/* Number of sectors */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < FF_FS_WINCACHE; i++) {
+		if (fs->wc_sect[i] - sect < count) {	/* Drop the line without writing it back */
+			fs->wc_sect[i] = (LBA_t)0 - 1;
+			fs->wc_flag[i] = 0;
+		}
+	}
+}
+
+
+static
+void wc_discard_free (
+	FATFS* fs,		/* Filesystem object with a FAT16/32 sector in the win[] */
+	UINT epc		/* Number of FAT entries in a sector */
+)
+{
+	UINT i;
+	DWORD clst, top = (DWORD)(fs->winsect - fs->fatbase) * epc;
+
+
+	for (i = 0; i < FF_FS_WINCACHE; i++) {
+		if (fs->wc_sect[i] - fs->database < (LBA_t)(fs->n_fatent - 2) * fs->csize) {	/* Is it a line in the data area? */
+			clst = (DWORD)((fs->wc_sect[i] - fs->database) / fs->csize) + 2;
+			if (clst - top < epc && ((fs->fs_type == FS_FAT16) ? ld_word(fs->win + clst * 2 % SS(fs)) : ld_dword(fs->win + clst * 4 % SS(fs)) & 0x0FFFFFFF) == 0) {	/* Is its cluster free in this FAT sector? */
+				fs->wc_sect[i] = (LBA_t)0 - 1;	/* Drop the line without writing it back */
+				fs->wc_flag[i] = 0;
 			}
-		} else {
-			res = FR_DISK_ERR;
 		}
 	}
-	return res;
 }
+
+
+static
+FRESULT wc_sync (	/* Returns FR_OK or FR_DISK_ERR */
+	FATFS* fs		/* Filesystem object */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < FF_FS_WINCACHE; i++) {
+		if (fs->wc_flag[i] & 1) {	/* Write back the dirty line */
+			if (write_sector(fs, fs->wc_buf[i], fs->wc_sect[i]) != FR_OK) return FR_DISK_ERR;
+			fs->wc_flag[i] = 0;
+		}
+	}
+	return FR_OK;
+}
+#endif
+
+
+static
+FRESULT wc_move (	/* Returns FR_OK or FR_DISK_ERR */
+	FATFS* fs,		/* Filesystem object */
+	LBA_t sector	/* Sector number to make appearance in the fs->win[] */
+)
+{
+	UINT i, n, v, hit, ln;
+	BYTE *p, *q, b;
+
+
+	ln = (UINT)(sector % WC_SETS) * FF_FS_WINCACHE_WAYS;	/* Find the sector in its set */
+	for (n = FF_FS_WINCACHE_WAYS; n && fs->wc_sect[ln] != sector; n--, ln++) ;
+	hit = (n != 0);
+	fs->wc_clock++;
+
+	if (fs->winsect != (LBA_t)0 - 1) {	/* Push out the current window into the cache */
+		i = (UINT)(fs->winsect % WC_SETS) * FF_FS_WINCACHE_WAYS;
+		if (hit && ln - i < FF_FS_WINCACHE_WAYS) {	/* Same set as the requested sector? */
+			p = fs->win; q = fs->wc_buf[ln];		/* Exchange the window and the line */
+			for (n = SS(fs); n; n--) { b = *p; *p++ = *q; *q++ = b; }
+			b = fs->wc_flag[ln]; fs->wc_flag[ln] = fs->wflag; fs->wflag = b;
+			fs->wc_sect[ln] = fs->winsect; fs->wc_stamp[ln] = fs->wc_clock;
+			fs->winsect = sector;
+			fs->wc_hit++;
+			return FR_OK;
+		}
+		v = i;	/* Select an empty or the least recently used line in the set */
+		for (n = 1; n < FF_FS_WINCACHE_WAYS && fs->wc_sect[v] != (LBA_t)0 - 1; n++) {
+			if (fs->wc_sect[i + n] == (LBA_t)0 - 1 || fs->wc_clock - fs->wc_stamp[i + n] > fs->wc_clock - fs->wc_stamp[v]) v = i + n;
+		}
+#if !FF_FS_READONLY
+		if (fs->wc_flag[v] & 1) {	/* Write back the victim line if dirty */
+			if (write_sector(fs, fs->wc_buf[v], fs->wc_sect[v]) != FR_OK) return FR_DISK_ERR;
+		}
 #endif
+		mem_cpy(fs->wc_buf[v], fs->win, SS(fs));
+		fs->wc_sect[v] = fs->winsect; fs->wc_flag[v] = fs->wflag; fs->wc_stamp[v] = fs->wc_clock;
+		fs->winsect = (LBA_t)0 - 1; fs->wflag = 0;
+	}
+
+	if (hit) {	/* Take the sector out of the cache */
+		mem_cpy(fs->win, fs->wc_buf[ln], SS(fs));
+		fs->wflag = fs->wc_flag[ln];
+		fs->wc_sect[ln] = (LBA_t)0 - 1; fs->wc_flag[ln] = 0;
+		fs->wc_hit++;
+	} else {	/* Fill sector window with new data */
+		fs->wc_miss++;
+		if (disk_read(fs->pdrv, fs->win, sector, 1) != RES_OK) return FR_DISK_ERR;	/* Window is left invalid if read data is not valid */
+	}
+	fs->winsect = sector;
+	return FR_OK;
+}
+#endif	/* FF_FS_WINCACHE */
 
 
 static
 FRESULT move_window (	/* Returns FR_OK or FR_DISK_ERR */
 	FATFS* fs,			/* Filesystem object */
-	DWORD sector		/* Sector number to make appearance in the fs->win[] */
+	LBA_t sector		/* Sector number to make appearance in the fs->win[] */
 )
 {
 	FRESULT res = FR_OK;
 
 
 	if (sector != fs->winsect) {	/* Window offset changed? */
+#if FF_FS_WINCACHE
+		res = wc_move(fs, sector);	/* Exchange the window with the cache */
+#else
 #if !FF_FS_READONLY
 		res = sync_window(fs);		/* Write-back changes */
 #endif
 		if (res == FR_OK) {			/* Fill sector window with new data */
 			if (disk_read(fs->pdrv, fs->win, sector, 1) != RES_OK) {
-				sector = 0xFFFFFFFF;	/* Invalidate window if read data is not valid */
+				sector = (LBA_t)0 - 1;	/* Invalidate window if read data is not valid */
 				res = FR_DISK_ERR;
 			}
 			fs->winsect = sector;
 		}
+#endif
 	}
 	return res;
 }
@@ -1133,8 +1333,14 @@ FRESULT sync_fs (	/* Returns FR_OK or FR_DISK_ERR */
 
 
 	res = sync_window(fs);
+#if FF_FS_WINCACHE
+	if (res == FR_OK) res = wc_sync(fs);	/* Write back the dirty cache lines */
+#endif
 	if (res == FR_OK) {
 		if (fs->fs_type == FS_FAT32 && fs->fsi_flag == 1) {	/* FAT32: Update FSInfo sector if needed */
+#if FF_FS_WINCACHE
+			wc_discard(fs, fs->volbase + 1, 1);	/* FSInfo sector is overwritten below */
+#endif
 			/* Create FSInfo structure */
 			mem_set(fs->win, 0, SS(fs));
 			st_word(fs->win + BS_55AA, 0xAA55);
@@ -1159,7 +1365,11 @@ FRESULT fs_sync ( /* Returns FR_OK or FR_DISK_ERR */
   FATFS* fs   /* Filesystem object */
 )
 {
-  return sync_fs(fs);
+  FRESULT res;
+
+  ENTER_FF(fs);
+  res = sync_fs(fs);
+  LEAVE_FF(fs, res);
 }
 #endif
 
@@ -1172,14 +1382,14 @@ FRESULT fs_sync ( /* Returns FR_OK or FR_DISK_ERR */
 /*-----------------------------------------------------------------------*/
 
 static
-DWORD clst2sect (	/* !=0:Sector number, 0:Failed (invalid cluster#) */
+LBA_t clst2sect (	/* !=0:Sector number, 0:Failed (invalid cluster#) */
 	FATFS* fs,		/* Filesystem object */
 	DWORD clst		/* Cluster# to be converted */
 )
 {
 	clst -= 2;		/* Cluster number is origin from 2 */
 	if (clst >= fs->n_fatent - 2) return 0;		/* Is it invalid cluster number? */
-	return fs->database + fs->csize * clst;		/* Start sector number of the cluster */
+	return fs->database + (LBA_t)fs->csize * clst;	/* Start sector number of the cluster */
 }
 
 
@@ -1229,7 +1439,7 @@ DWORD get_fat (		/* 0xFFFFFFFF:Disk error, 1:Internal error, 2..0x7FFFFFFF:Clust
 		case FS_EXFAT :
 			if (obj->objsize != 0) {
 				DWORD cofs = clst - obj->sclust;	/* Offset from start cluster */
-				DWORD clen = (DWORD)((obj->objsize - 1) / SS(fs)) / fs->csize;	/* Number of clusters - 1 */
+				DWORD clen = (DWORD)((obj->objsize - 1) / SS(fs) / fs->csize);	/* Number of clusters - 1 */
 
 				if (obj->stat == 2 && cofs <= clen) {	/* Is it a contiguous chain? */
 					val = (cofs == clen) ? 0x7FFFFFFF : clst + 1;	/* No data on the FAT, generate the value */
@@ -1262,6 +1472,333 @@ DWORD get_fat (		/* 0xFFFFFFFF:Disk error, 1:Internal error, 2..0x7FFFFFFF:Clust
 
 
 
+#if !FF_FS_READONLY && FF_FS_FREEMAP
+/*-----------------------------------------------------------------------*/
+/* Free cluster map - In-memory summary of free clusters (FAT12/16/32)   */
+/*-----------------------------------------------------------------------*/
+/* Each bit of fs->fm_map[] covers 2^fs->fm_shift clusters. A cleared bit
+/  means that all clusters in the group are in use. At fm_shift == 0 the map
+/  is exact and a set bit means the cluster is free. */
+
+static
+void fm_mark (
+	FATFS* fs,		/* Filesystem object */
+	DWORD clst,		/* Cluster number changed on the FAT */
+	DWORD val		/* New value of the FAT entry */
+)
+{
+	DWORD b;
+
+
+	if (fs->fm_shift == 0xFF) return;	/* Map is not built yet */
+	b = clst >> fs->fm_shift;
+	if (val == 0) {						/* The cluster has got free */
+		fs->fm_map[b / 32] |= (DWORD)1 << (b % 32);
+	} else {
+		if (fs->fm_shift == 0) fs->fm_map[b / 32] &= ~((DWORD)1 << (b % 32));	/* The cluster has got in use (exact map only) */
+	}
+}
+
+
+static
+DWORD fm_next (	/* Cluster number to be tested next (n_fatent:No free cluster at or after clst) */
+	FATFS* fs,		/* Filesystem object */
+	DWORD clst		/* Cluster number to start to find */
+)
+{
+	DWORD b, nb, bm;
+
+
+	b = clst >> fs->fm_shift;
+	nb = ((fs->n_fatent - 1) >> fs->fm_shift) + 1;	/* Number of valid bits */
+	while (b < nb) {
+		bm = fs->fm_map[b / 32] >> (b % 32);
+		if (bm) {		/* Is there any candidate in this word? */
+			while (!(bm & 1)) { bm >>= 1; b++; }
+			break;
+		}
+		b = (b | 31) + 1;	/* Skip to the next word */
+	}
+	if (b >= nb) return fs->n_fatent;
+	return (b == clst >> fs->fm_shift) ? clst : b << fs->fm_shift;
+}
+
+
+static
+FRESULT fm_build (	/* FR_OK(0):succeeded, !=0:error */
+	FATFS* fs		/* Filesystem object */
+)
+{
+	DWORD clst, nfree, stat, b;
+	LBA_t sect;
+	BYTE sh;
+	UINT i;
+	FFOBJID obj;
+
+
+	for (sh = 0; ((fs->n_fatent - 1) >> sh) >= (DWORD)FF_FS_FREEMAP * 8; sh++) ;	/* Get clusters per bit to fit the map */
+	mem_set(fs->fm_map, 0, sizeof fs->fm_map);
+	nfree = 0;
+	if (fs->fs_type == FS_FAT12) {	/* FAT12: Scan bit field FAT entries */
+		mem_set(&obj, 0, sizeof obj);
+		obj.fs = fs;
+		for (clst = 2; clst < fs->n_fatent; clst++) {
+			stat = get_fat(&obj, clst);
+			if (stat == 0xFFFFFFFF) return FR_DISK_ERR;
+			if (stat == 1) return FR_INT_ERR;
+			if (stat == 0) {
+				b = clst >> sh;
+				fs->fm_map[b / 32] |= (DWORD)1 << (b % 32);
+				nfree++;
+			}
+		}
+	} else {						/* FAT16/32: Scan WORD/DWORD FAT entries */
+		sect = fs->fatbase;
+		i = 0;
+		for (clst = 0; clst < fs->n_fatent; clst++) {
+			if (i == 0 && move_window(fs, sect++) != FR_OK) return FR_DISK_ERR;
+			if (fs->fs_type == FS_FAT16) {
+				stat = ld_word(fs->win + i);
+				i += 2;
+			} else {
+				stat = ld_dword(fs->win + i) & 0x0FFFFFFF;
+				i += 4;
+			}
+			i %= SS(fs);
+			if (stat == 0 && clst >= 2) {
+				b = clst >> sh;
+				fs->fm_map[b / 32] |= (DWORD)1 << (b % 32);
+				nfree++;
+			}
+		}
+	}
+	fs->fm_shift = sh;
+	if (fs->free_clst != nfree) {	/* Correct the free cluster count as well */
+		fs->free_clst = nfree;
+		fs->fsi_flag |= 1;
+	}
+#if FF_FS_FREESCAN
+	fs->fsc_clst = fs->fsc_free = 0;	/* Free cluster scan in progress is no longer needed */
+#endif
+	return FR_OK;
+}
+
+
+static
+DWORD fm_find (		/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:Free cluster# */
+	FFOBJID* obj,	/* Corresponding object */
+	DWORD scl		/* Cluster to start to find after */
+)
+{
+	FATFS *fs = obj->fs;
+	DWORD clst, ecl, cs, b;
+	BYTE wrap = 0;
+
+
+	if (fs->fm_shift == 0xFF) {		/* Build the map at first allocation */
+		switch (fm_build(fs)) {
+		case FR_OK: break;
+		case FR_INT_ERR: return 1;
+		default: return 0xFFFFFFFF;
+		}
+	}
+	clst = scl + 1;
+	for (;;) {
+		if (clst < fs->n_fatent) clst = fm_next(fs, clst);	/* Skip the full area */
+		if (clst >= fs->n_fatent) {	/* Check wrap-around */
+			if (wrap) return 0;		/* No free cluster found */
+			wrap = 1; clst = 2;
+			continue;
+		}
+		if (fs->fm_shift == 0) return clst;	/* Exact map: it is a free cluster */
+		b = clst >> fs->fm_shift;
+		clst = b << fs->fm_shift;			/* Scan the group from its top */
+		if (clst < 2) clst = 2;
+		ecl = (b + 1) << fs->fm_shift;
+		if (ecl > fs->n_fatent) ecl = fs->n_fatent;
+		for ( ; clst < ecl; clst++) {
+			cs = get_fat(obj, clst);
+			if (cs == 0) return clst;		/* Found a free cluster? */
+			if (cs == 1 || cs == 0xFFFFFFFF) return cs;	/* Test for error */
+		}
+		fs->fm_map[b / 32] &= ~((DWORD)1 << (b % 32));	/* The group is full */
+	}
+}
+
+#endif	/* !FF_FS_READONLY && FF_FS_FREEMAP */
+
+
+
+
+#if !FF_FS_READONLY && FF_FS_FREEEXT
+/*-----------------------------------------------------------------------*/
+/* Free extent table - The longest runs of free clusters                 */
+/*-----------------------------------------------------------------------*/
+/* The table holds up to FF_FS_FREEEXT disjoint runs of free clusters in order
+/  of the length, so that the best-fit run for a request is the first one long
+/  enough. It is built by a full scan of the FAT or allocation bitmap at the first
+/  request, and then it is kept up to date on each change of the FAT/bitmap: the
+/  clusters got in use are cut out of the runs and the clusters got free are
+/  merged to the adjacent runs. When the table is full, the shortest run is
+/  dropped, and the table is built again when a request does not fit it. */
+
+static
+int fx_add (		/* 0:Added, 1:A run was dropped */
+	FATFS* fs,		/* Filesystem object */
+	DWORD clst,		/* Top cluster of the free run */
+	DWORD len		/* Number of clusters in the run */
+)
+{
+	UINT i, n = fs->fx_n;
+	int drop = 0;
+
+
+	if (n == FF_FS_FREEEXT) {		/* Table is full? */
+		if (len <= fs->fx_len[0]) return 1;	/* Drop the new run if it is the shortest */
+		for (i = 1; i < n; i++) {	/* Drop the shortest run */
+			fs->fx_clst[i - 1] = fs->fx_clst[i]; fs->fx_len[i - 1] = fs->fx_len[i];
+		}
+		n--; drop = 1;
+	}
+	for (i = n; i > 0 && fs->fx_len[i - 1] > len; i--) {	/* Insert the run in order of the length */
+		fs->fx_clst[i] = fs->fx_clst[i - 1]; fs->fx_len[i] = fs->fx_len[i - 1];
+	}
+	fs->fx_clst[i] = clst; fs->fx_len[i] = len;
+	fs->fx_n = n + 1;
+	return drop;
+}
+
+
+static
+void fx_del (
+	FATFS* fs,		/* Filesystem object */
+	UINT i			/* Index of the run to be removed */
+)
+{
+	for (fs->fx_n--; i < fs->fx_n; i++) {
+		fs->fx_clst[i] = fs->fx_clst[i + 1]; fs->fx_len[i] = fs->fx_len[i + 1];
+	}
+}
+
+
+static
+void fx_mark (
+	FATFS* fs,		/* Filesystem object */
+	DWORD clst,		/* Top cluster changed */
+	DWORD ncl,		/* Number of clusters changed */
+	int used		/* 1:Got in use, 0:Got free */
+)
+{
+	UINT i;
+	DWORD s, e;
+	int drop = 0;
+
+
+	if (fs->fx_stat == 0) return;	/* Table is not built yet */
+	if (!used && fs->fx_stat == 2) fs->fx_stat = 3;	/* A run out of the table can get longer than the runs in it */
+	i = 0;
+	if (used) {		/* Cut the clusters out of the runs */
+		while (i < fs->fx_n) {
+			s = fs->fx_clst[i]; e = s + fs->fx_len[i];
+			if (clst < e && clst + ncl > s) {	/* Overlapped? */
+				fx_del(fs, i);
+				if (s < clst) drop |= fx_add(fs, s, clst - s);		/* Leave the head */
+				if (clst + ncl < e) drop |= fx_add(fs, clst + ncl, e - clst - ncl);	/* Leave the tail */
+				i = 0;		/* The order has changed */
+			} else {
+				i++;
+			}
+		}
+	} else {		/* Merge the clusters with the adjacent runs */
+		while (i < fs->fx_n) {
+			s = fs->fx_clst[i]; e = s + fs->fx_len[i];
+			if (e == clst || s == clst + ncl) {	/* Adjacent? */
+				if (s < clst) clst = s;
+				ncl += fs->fx_len[i];
+				fx_del(fs, i);
+			} else {
+				i++;
+			}
+		}
+		drop = fx_add(fs, clst, ncl);
+	}
+	if (drop && fs->fx_stat == 1) fs->fx_stat = 2;	/* A free run is not in the table */
+}
+
+
+static
+FRESULT fx_build (	/* FR_OK(0):succeeded, !=0:error */
+	FATFS* fs		/* Filesystem object */
+)
+{
+	DWORD clst, scl, stat, nfree;
+	FFOBJID obj;
+
+
+	mem_set(&obj, 0, sizeof obj);
+	obj.fs = fs;
+	fs->fx_n = 0;
+	nfree = scl = 0;
+	for (clst = 2; clst < fs->n_fatent; clst++) {
+#if FF_FS_EXFAT
+		if (fs->fs_type == FS_EXFAT) {	/* exFAT: Test the bit in the allocation bitmap */
+			if (move_window(fs, fs->database + (clst - 2) / 8 / SS(fs)) != FR_OK) return FR_DISK_ERR;
+			stat = fs->win[(clst - 2) / 8 % SS(fs)] >> ((clst - 2) % 8) & 1;
+		} else
+#endif
+		{								/* FAT12/16/32: Test the FAT entry */
+			stat = get_fat(&obj, clst);
+			if (stat == 0xFFFFFFFF) return FR_DISK_ERR;
+			if (stat == 1) return FR_INT_ERR;
+		}
+		if (stat == 0) {	/* A free cluster */
+			if (scl == 0) scl = clst;
+			nfree++;
+		} else {
+			if (scl != 0) fx_add(fs, scl, clst - scl);	/* End of the free run */
+			scl = 0;
+		}
+	}
+	if (scl != 0) fx_add(fs, scl, clst - scl);
+	fs->fx_stat = 1;
+	if (fs->free_clst != nfree) {	/* Correct the free cluster count as well */
+		fs->free_clst = nfree;
+		fs->fsi_flag |= 1;
+	}
+#if FF_FS_FREESCAN
+	fs->fsc_clst = fs->fsc_free = 0;	/* Free cluster scan in progress is no longer needed */
+#endif
+	return FR_OK;
+}
+
+
+static
+DWORD fx_find (		/* 0:No free run, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:Top cluster of the run */
+	FATFS* fs,		/* Filesystem object */
+	DWORD ncl,		/* Number of contiguous clusters wanted */
+	int part		/* 0:The run needs to be long enough, 1:Or the longest run */
+)
+{
+	UINT i;
+	FRESULT res;
+
+
+	if (fs->fx_stat == 0 || (fs->fx_stat == 3 && (fs->fx_n == 0 || fs->fx_len[fs->fx_n - 1] < ncl))) {	/* Build the table if not yet or a longer run can be out of the table */
+		res = fx_build(fs);
+		if (res == FR_INT_ERR) return 1;
+		if (res != FR_OK) return 0xFFFFFFFF;
+	}
+	if (fs->fx_n == 0) return 0;
+	for (i = 0; i < fs->fx_n - 1 && fs->fx_len[i] < ncl; i++) ;	/* Best-fit run, or the longest one */
+	if (fs->fx_len[i] < ncl && !part) return 0;
+	return fs->fx_clst[i];
+}
+
+#endif	/* !FF_FS_READONLY && FF_FS_FREEEXT */
+
+
+
+
 #if !FF_FS_READONLY
 /*-----------------------------------------------------------------------*/
 /* FAT access - Change value of a FAT entry                              */
@@ -1315,6 +1852,12 @@ FRESULT put_fat (	/* FR_OK(0):succeeded, !=0:error */
 			fs->wflag = 1;
 			break;
 		}
+#if FF_FS_FREEMAP
+		if (res == FR_OK) fm_mark(fs, clst, val);	/* Reflect it to the free cluster map */
+#endif
+#if FF_FS_FREEEXT
+		if (res == FR_OK && fs->fs_type != FS_EXFAT) fx_mark(fs, clst, 1, val != 0);	/* Reflect it to the free extent table */
+#endif
 	}
 	return res;
 }
@@ -1384,9 +1927,12 @@ FRESULT change_bitmap (
 {
 	BYTE bm;
 	UINT i;
-	DWORD sect;
+	LBA_t sect;
 
 
+#if FF_FS_FREEEXT
+	fx_mark(fs, clst, ncl, bv);	/* Reflect it to the free extent table (the bitmap is verified on the allocation) */
+#endif
 	clst -= 2;	/* The first bit corresponds to cluster #2 */
 	sect = fs->database + clst / 8 / SS(fs);	/* Sector address (assuming bitmap is located top of the cluster heap) */
 	i = clst / 8 % SS(fs);						/* Byte offset in the sector */
@@ -1469,13 +2015,15 @@ FRESULT remove_chain (	/* FR_OK(0):succeeded, !=0:error */
 )
 {
 	FRESULT res = FR_OK;
-	DWORD nxt;
+	DWORD nxt, n, nfree = 0;
+	UINT epc, i;
+	BYTE *p;
 	FATFS *fs = obj->fs;
-#if FF_FS_EXFAT || FF_USE_TRIM
+#if FF_FS_EXFAT || FF_USE_TRIM || FF_FS_WINCACHE
 	DWORD scl = clst, ecl = clst;
 #endif
 #if FF_USE_TRIM
-	DWORD rt[2];
+	LBA_t rt[2];
 #endif
 
 	if (clst < 2 || clst >= fs->n_fatent) return FR_INT_ERR;	/* Check if in valid range */
@@ -1487,39 +2035,106 @@ FRESULT remove_chain (	/* FR_OK(0):succeeded, !=0:error */
 	}
 
 	/* Remove the chain */
-	do {
-		nxt = get_fat(obj, clst);			/* Get cluster status */
-		if (nxt == 0) break;				/* Empty cluster? */
-		if (nxt == 1) return FR_INT_ERR;	/* Internal error? */
-		if (nxt == 0xFFFFFFFF) return FR_DISK_ERR;	/* Disk error? */
-		if (!FF_FS_EXFAT || fs->fs_type != FS_EXFAT) {
-			res = put_fat(fs, clst, 0);		/* Mark the cluster 'free' on the FAT */
-			if (res != FR_OK) return res;
-		}
-		if (fs->free_clst < fs->n_fatent - 2) {	/* Update FSINFO */
-			fs->free_clst++;
-			fs->fsi_flag |= 1;
-		}
-#if FF_FS_EXFAT || FF_USE_TRIM
-		if (ecl + 1 == nxt) {	/* Is next cluster contiguous? */
-			ecl = nxt;
-		} else {				/* End of contiguous cluster block */
-#if FF_FS_EXFAT
-			if (fs->fs_type == FS_EXFAT) {
-				res = change_bitmap(fs, scl, ecl - scl + 1, 0);	/* Mark the cluster block 'free' on the bitmap */
-				if (res != FR_OK) return res;
+	if (fs->fs_type == FS_FAT16 || fs->fs_type == FS_FAT32) {	/* FAT16/32: free the links in each FAT sector at a time */
+		epc = SS(fs) / ((fs->fs_type == FS_FAT16) ? 2 : 4);	/* Number of FAT entries in a sector */
+		do {
+			res = move_window(fs, fs->fatbase + clst / epc);	/* Load the FAT sector of the cluster */
+			if (res != FR_OK) break;
+			do {
+				for (n = 0; ; ) {	/* Get the run of contiguous clusters in this FAT sector */
+					nxt = (fs->fs_type == FS_FAT16) ? ld_word(fs->win + (clst + n) * 2 % SS(fs)) : ld_dword(fs->win + (clst + n) * 4 % SS(fs)) & 0x0FFFFFFF;
+					if (nxt < 2) break;	/* Empty cluster or insanity */
+					n++;
+					if (nxt != clst + n || (clst + n) % epc == 0) break;	/* Not contiguous or on the next FAT sector */
+				}
+				if (n > 0) {	/* Mark the run 'free' on the FAT */
+					p = fs->win + clst * (SS(fs) / epc) % SS(fs);
+					if (fs->fs_type == FS_FAT16) {
+						mem_set(p, 0, (UINT)n * 2);
+					} else {
+						for (i = 0; i < n; i++, p += 4) st_dword(p, ld_dword(p) & 0xF0000000);	/* Preserve upper 4 bits */
+					}
+					fs->wflag = 1;
+					nfree += n;
+#if FF_FS_FREEMAP
+					for (i = 0; i < n; i++) fm_mark(fs, clst + i, 0);	/* Reflect it to the free cluster map */
+#endif
+#if FF_FS_FREEEXT
+					fx_mark(fs, clst, n, 0);	/* Reflect it to the free extent table */
+#endif
+#if FF_FS_FREESCAN
+					if (clst < fs->fsc_clst) fs->fsc_free += (fs->fsc_clst - clst < n) ? fs->fsc_clst - clst : n;	/* Update the free cluster scan in progress */
+#endif
+#if FF_USE_TRIM
+					ecl = clst + n - 1;
+					if (ecl + 1 != nxt) {	/* End of contiguous cluster block */
+						rt[0] = clst2sect(fs, scl);					/* Start of data area freed */
+						rt[1] = clst2sect(fs, ecl) + fs->csize - 1;	/* End of data area freed */
+						disk_ioctl(fs->pdrv, CTRL_TRIM, rt);		/* Inform device the data in the block is no longer needed */
+						scl = ecl = nxt;
+					}
+#endif
+				}
+				if (nxt == 1) res = FR_INT_ERR;	/* Internal error? */
+				if (n == 0 || nxt >= fs->n_fatent) nxt = 0;	/* Empty cluster or the last link */
+				clst = nxt;		/* Next cluster */
+			} while (res == FR_OK && clst != 0 && clst / epc == fs->winsect - fs->fatbase);	/* Repeat while in this FAT sector */
+#if FF_FS_WINCACHE
+			wc_discard_free(fs, epc);	/* Cached directory sectors of the clusters freed in this FAT sector are no longer valid */
+#endif
+		} while (res == FR_OK && clst != 0);
+	} else {	/* FAT12/exFAT: follow the chain cluster by cluster */
+		do {
+			nxt = get_fat(obj, clst);			/* Get cluster status */
+			if (nxt == 0) break;				/* Empty cluster? */
+			if (nxt == 1) {						/* Internal error? */
+				res = FR_INT_ERR; break;
+			}
+			if (nxt == 0xFFFFFFFF) {			/* Disk error? */
+				res = FR_DISK_ERR; break;
 			}
+			if (!FF_FS_EXFAT || fs->fs_type != FS_EXFAT) {
+				res = put_fat(fs, clst, 0);		/* Mark the cluster 'free' on the FAT */
+				if (res != FR_OK) break;
+			}
+			nfree++;
+#if FF_FS_FREESCAN
+			if (clst < fs->fsc_clst) fs->fsc_free++;	/* Update the free cluster scan in progress */
+#endif
+#if FF_FS_EXFAT || FF_USE_TRIM || FF_FS_WINCACHE
+			if (ecl + 1 == nxt) {	/* Is next cluster contiguous? */
+				ecl = nxt;
+			} else {				/* End of contiguous cluster block */
+#if FF_FS_EXFAT
+				if (fs->fs_type == FS_EXFAT) {
+					res = change_bitmap(fs, scl, ecl - scl + 1, 0);	/* Mark the cluster block 'free' on the bitmap */
+					if (res != FR_OK) break;
+				}
+#endif
+#if FF_FS_WINCACHE
+				wc_discard(fs, clst2sect(fs, scl), (DWORD)fs->csize * (ecl - scl + 1));	/* Cached directory sectors of the block are no longer valid */
 #endif
 #if FF_USE_TRIM
-			rt[0] = clst2sect(fs, scl);					/* Start of data area freed */
-			rt[1] = clst2sect(fs, ecl) + fs->csize - 1;	/* End of data area freed */
-			disk_ioctl(fs->pdrv, CTRL_TRIM, rt);		/* Inform device the data in the block is no longer needed */
+				rt[0] = clst2sect(fs, scl);					/* Start of data area freed */
+				rt[1] = clst2sect(fs, ecl) + fs->csize - 1;	/* End of data area freed */
+				disk_ioctl(fs->pdrv, CTRL_TRIM, rt);		/* Inform device the data in the block is no longer needed */
+#endif
+				scl = ecl = nxt;
+			}
 #endif
-			scl = ecl = nxt;
+			clst = nxt;					/* Next cluster */
+		} while (clst < fs->n_fatent);	/* Repeat while not the last link */
+#if FF_FS_WINCACHE
+		if (clst > scl && (!FF_FS_EXFAT || fs->fs_type != FS_EXFAT)) {	/* FAT12: Broken in a block, the clusters before clst have been freed */
+			wc_discard(fs, clst2sect(fs, scl), (DWORD)fs->csize * (clst - scl));
 		}
 #endif
-		clst = nxt;					/* Next cluster */
-	} while (clst < fs->n_fatent);	/* Repeat while not the last link */
+	}
+	if (nfree > 0 && fs->free_clst <= fs->n_fatent - 2) {	/* Update FSINFO at a time */
+		fs->free_clst = (fs->n_fatent - 2 - fs->free_clst > nfree) ? fs->free_clst + nfree : fs->n_fatent - 2;
+		fs->fsi_flag |= 1;
+	}
+	if (res != FR_OK) return res;
 
 #if FF_FS_EXFAT
 	/* Some post processes for chain status */
@@ -1553,6 +2168,144 @@ FRESULT remove_chain (	/* FR_OK(0):succeeded, !=0:error */
 
 
 
+#if !FF_FS_READONLY && (FF_FS_RESERVE || FF_FS_FREEEXT)
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Test a cluster on the FAT or allocation bitmap         */
+/*-----------------------------------------------------------------------*/
+
+static
+DWORD test_clst (	/* 0:Free, 2:In use, 1:Internal error, 0xFFFFFFFF:Disk error */
+	FFOBJID* obj,	/* Object to allocate the cluster */
+	DWORD clst		/* Cluster# to be tested */
+)
+{
+#if FF_FS_EXFAT
+	FATFS *fs = obj->fs;
+
+
+	if (fs->fs_type == FS_EXFAT) {	/* Test the bit in the allocation bitmap */
+		clst -= 2;
+		if (move_window(fs, fs->database + clst / 8 / SS(fs)) != FR_OK) return 0xFFFFFFFF;
+		return (fs->win[clst / 8 % SS(fs)] & (1 << (clst % 8))) ? 2 : 0;
+	}
+#endif
+	clst = get_fat(obj, clst);		/* Test the FAT entry */
+	return (clst < 2 || clst == 0xFFFFFFFF) ? clst : 2;
+}
+
+#endif
+
+
+
+
+#if !FF_FS_READONLY && FF_FS_RESERVE
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Per-file allocation windows                            */
+/*-----------------------------------------------------------------------*/
+
+static
+void rsv_reg (
+	FFOBJID* obj,	/* Object to get or release the allocation window */
+	int on			/* 1:Get a slot, 0:Release the slot */
+)
+{
+	FATFS *fs = obj->fs;
+	UINT i;
+
+
+	for (i = 0; i < FF_FS_RESERVE_FILES && fs->rsv_obj[i] != obj; i++) ;	/* Find the slot of the object */
+	if (i == FF_FS_RESERVE_FILES && on) {
+		for (i = 0; i < FF_FS_RESERVE_FILES && fs->rsv_obj[i] != 0; i++) ;	/* or a free slot */
+	}
+	if (i < FF_FS_RESERVE_FILES) {
+		fs->rsv_obj[i] = on ? obj : 0;
+		fs->rsv_clst[i] = fs->rsv_end[i] = 0;	/* No window yet */
+	}
+}
+
+
+static
+DWORD rsv_skip (	/* 0:Not in the window of other object, >=2:End of the window */
+	FFOBJID* obj,	/* Object to allocate the cluster */
+	DWORD clst		/* Free cluster found */
+)
+{
+	FATFS *fs = obj->fs;
+	UINT i;
+
+
+	for (i = 0; i < FF_FS_RESERVE_FILES; i++) {
+		if (fs->rsv_obj[i] != 0 && fs->rsv_obj[i] != obj && clst >= fs->rsv_clst[i] && clst < fs->rsv_end[i]) {
+			return fs->rsv_end[i];
+		}
+	}
+	return 0;
+}
+
+
+static
+DWORD rsv_take (	/* 0:No window, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:Cluster to be allocated */
+	FFOBJID* obj,	/* Object to allocate the cluster */
+	DWORD clst		/* Cluster# to stretch, 0:Create a new chain */
+)
+{
+	FATFS *fs = obj->fs;
+	DWORD cl, cs, n, bn, bcl, nb;
+	UINT i, j;
+
+
+	for (i = 0; i < FF_FS_RESERVE_FILES && fs->rsv_obj[i] != obj; i++) ;
+	if (i == FF_FS_RESERVE_FILES) return 0;		/* The object does not hold a slot */
+
+	if (clst != 0 && clst + 1 != fs->rsv_clst[i]) fs->rsv_clst[i] = fs->rsv_end[i];	/* Drop the window not next to the end of the chain */
+	if (fs->rsv_clst[i] < fs->rsv_end[i]) {		/* Take the next cluster in the window if it is still free */
+		cs = test_clst(obj, fs->rsv_clst[i]);
+		if (cs == 0) return fs->rsv_clst[i]++;
+		if (cs != 2) return cs;
+	}
+
+	cl = clst + 1;		/* Reserve a new window next to the end of the chain */
+	if (clst == 0) {	/* or next to the windows of other objects for a new chain */
+		cl = fs->last_clst + 1;
+		for (j = 0; j < FF_FS_RESERVE_FILES; j++) {
+			if (fs->rsv_obj[j] != 0 && fs->rsv_obj[j] != obj && fs->rsv_end[j] > cl) cl = fs->rsv_end[j];
+		}
+	}
+	n = bn = bcl = 0;
+	for (nb = (DWORD)FF_FS_RESERVE * 8; nb > 0; nb--, cl++) {	/* Find the longest free run within the scan limit */
+		if (cl < 2 || cl >= fs->n_fatent) {		/* Wrap-around */
+			cl = 2; n = 0;
+		}
+		cs = rsv_skip(obj, cl);
+		if (cs != 0) {		/* Skip the window of other object */
+			cl = cs - 1; n = 0;
+			continue;
+		}
+		cs = test_clst(obj, cl);
+		if (cs == 1 || cs == 0xFFFFFFFF) return cs;
+		if (cs != 0) {
+			n = 0;
+			continue;
+		}
+		if (++n > bn) {
+			bn = n; bcl = cl + 1 - n;
+		}
+		if (n == FF_FS_RESERVE) break;
+	}
+	if (bn == 0) {		/* No free cluster around, it is allocated as usual */
+		fs->rsv_clst[i] = fs->rsv_end[i] = 0;
+		return 0;
+	}
+	fs->rsv_clst[i] = bcl + 1;
+	fs->rsv_end[i] = bcl + bn;
+	return bcl;
+}
+
+#endif	/* !FF_FS_READONLY && FF_FS_RESERVE */
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* FAT handling - Stretch a chain or Create a new chain                  */
 /*-----------------------------------------------------------------------*/
@@ -1565,6 +2318,9 @@ DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk err
 	DWORD cs, ncl, scl;
 	FRESULT res;
 	FATFS *fs = obj->fs;
+#if FF_FS_RESERVE
+	UINT i = 0;
+#endif
 
 
 	if (clst == 0) {	/* Create a new chain */
@@ -1579,11 +2335,41 @@ DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk err
 		scl = clst;							/* Cluster to start to find */
 	}
 	if (fs->free_clst == 0) return 0;		/* No free cluster */
+#if FF_FS_DELALLOC
+	if (!fs->da_run && fs->free_clst <= fs->n_fatent - 2 && fs->free_clst <= fs->da_clst) return 0;	/* The free clusters are promised to the delayed data */
+#endif
+#if FF_FS_RESERVE
+	ncl = rsv_take(obj, clst);				/* Take a cluster in the allocation window of the object */
+	if (ncl == 1 || ncl == 0xFFFFFFFF) return ncl;
+#else
+	ncl = 0;
+#endif
+#if FF_FS_FREEEXT
+	if (ncl == 0 && obj == fs->fx_obj && fs->fx_want >= 2) {	/* A large write: unless the chain can be stretched in a row, */
+		cs = 2;
+		if (clst != 0 && clst + 1 < fs->n_fatent) cs = test_clst(obj, clst + 1);
+		if (cs == 1 || cs == 0xFFFFFFFF) return cs;
+		if (cs != 0) {
+			ncl = fx_find(fs, fs->fx_want, 1);	/* continue at the best-fit free run */
+			if (ncl == 1 || ncl == 0xFFFFFFFF) return ncl;
+#if FF_FS_RESERVE
+			if (ncl != 0 && rsv_skip(obj, ncl) != 0) ncl = 0;	/* It is in the window of other object */
+#endif
+		}
+	}
+#endif
 
 #if FF_FS_EXFAT
 	if (fs->fs_type == FS_EXFAT) {	/* On the exFAT volume */
-		ncl = find_bitmap(fs, scl, 1);				/* Find a free cluster */
-		if (ncl == 0 || ncl == 0xFFFFFFFF) return ncl;	/* No free cluster or hard error? */
+		if (ncl == 0) {
+			ncl = find_bitmap(fs, scl, 1);			/* Find a free cluster */
+#if FF_FS_RESERVE
+			for ( ; i < FF_FS_RESERVE_FILES && ncl >= 2 && ncl != 0xFFFFFFFF && (cs = rsv_skip(obj, ncl)) != 0; i++) {
+				ncl = find_bitmap(fs, cs, 1);		/* Skip the window of other object */
+			}
+#endif
+			if (ncl == 0 || ncl == 0xFFFFFFFF) return ncl;	/* No free cluster or hard error? */
+		}
 		res = change_bitmap(fs, ncl, 1, 1);			/* Mark the cluster 'in use' */
 		if (res == FR_INT_ERR) return 1;
 		if (res == FR_DISK_ERR) return 0xFFFFFFFF;
@@ -1607,18 +2393,31 @@ DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk err
 	} else
 #endif
 	{	/* On the FAT/FAT32 volume */
-		ncl = 0;
-		if (scl == clst) {						/* Stretching an existing chain? */
+		if (ncl == 0 && scl == clst) {			/* Stretching an existing chain? */
 			ncl = scl + 1;						/* Test if next cluster is free */
 			if (ncl >= fs->n_fatent) ncl = 2;
 			cs = get_fat(obj, ncl);				/* Get next cluster status */
 			if (cs == 1 || cs == 0xFFFFFFFF) return cs;	/* Test for error */
+#if FF_FS_RESERVE
+			if (cs == 0 && rsv_skip(obj, ncl) != 0) cs = 2;	/* It is in the window of other object */
+#endif
 			if (cs != 0) {						/* Not free? */
 				cs = fs->last_clst;				/* Start at suggested cluster if it is valid */
 				if (cs >= 2 && cs < fs->n_fatent) scl = cs;
 				ncl = 0;
 			}
 		}
+#if FF_FS_FREEMAP
+		if (ncl == 0) {	/* The new cluster cannot be contiguous and find another fragment */
+			ncl = fm_find(obj, scl);			/* Find a free cluster on the free cluster map */
+#if FF_FS_RESERVE
+			for ( ; i < FF_FS_RESERVE_FILES && ncl >= 2 && ncl != 0xFFFFFFFF && (cs = rsv_skip(obj, ncl)) != 0; i++) {
+				ncl = fm_find(obj, cs - 1);		/* Skip the window of other object */
+			}
+#endif
+			if (ncl < 2 || ncl == 0xFFFFFFFF) return ncl;	/* No free cluster or error? */
+		}
+#else
 		if (ncl == 0) {	/* The new cluster cannot be contiguous and find another fragment */
 			ncl = scl;	/* Start cluster */
 			for (;;) {
@@ -1628,11 +2427,20 @@ DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk err
 					if (ncl > scl) return 0;	/* No free cluster found? */
 				}
 				cs = get_fat(obj, ncl);			/* Get the cluster status */
-				if (cs == 0) break;				/* Found a free cluster? */
+				if (cs == 0) {					/* Found a free cluster? */
+#if FF_FS_RESERVE
+					if (i < FF_FS_RESERVE_FILES && (cs = rsv_skip(obj, ncl)) != 0) {	/* Skip the window of other object */
+						ncl = cs - 1; i++;
+						continue;
+					}
+#endif
+					break;
+				}
 				if (cs == 1 || cs == 0xFFFFFFFF) return cs;	/* Test for error */
 				if (ncl == scl) return 0;		/* No free cluster found? */
 			}
 		}
+#endif
 		res = put_fat(fs, ncl, 0xFFFFFFFF);		/* Mark the new cluster 'EOC' */
 		if (res == FR_OK && clst != 0) {
 			res = put_fat(fs, clst, ncl);		/* Link it from the previous one if needed */
@@ -1642,6 +2450,12 @@ DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk err
 	if (res == FR_OK) {			/* Update FSINFO if function succeeded. */
 		fs->last_clst = ncl;
 		if (fs->free_clst <= fs->n_fatent - 2) fs->free_clst--;
+#if FF_FS_FREEEXT
+		if (obj == fs->fx_obj && fs->fx_want > 0) fs->fx_want--;
+#endif
+#if FF_FS_FREESCAN
+		if (ncl < fs->fsc_clst) fs->fsc_free--;	/* Update the free cluster scan in progress */
+#endif
 		fs->fsi_flag |= 1;
 	} else {
 		ncl = (res == FR_DISK_ERR) ? 0xFFFFFFFF : 1;	/* Failed. Generate error status */
@@ -1686,6 +2500,376 @@ DWORD clmt_clust (	/* <2:Error, >=2:Cluster number */
 
 
 
+#if FF_FS_EXTCACHE
+/*-----------------------------------------------------------------------*/
+/* File handling - Extent cache of the cluster chain                     */
+/*-----------------------------------------------------------------------*/
+
+static
+UINT ec_search (	/* Number of extents which start at or before the cluster offset */
+	FIL* fp,		/* Pointer to the file object */
+	DWORD ci		/* Cluster offset in the file */
+)
+{
+	UINT lo = 0, hi = fp->ec_n, m;
+
+
+	m = fp->ec_last;	/* Try the last found extent first (sequential walk of the chain) */
+	if (m < hi && fp->ec_ofs[m] <= ci && (m + 1 == hi || fp->ec_ofs[m + 1] > ci)) return m + 1;
+	while (lo < hi) {	/* Binary search */
+		m = (lo + hi) / 2;
+		if (fp->ec_ofs[m] <= ci) {
+			lo = m + 1;
+		} else {
+			hi = m;
+		}
+	}
+	if (lo > 0) fp->ec_last = lo - 1;
+	return lo;
+}
+
+
+static
+DWORD ec_find (		/* 0:Not found, >=2:Cluster number */
+	FIL* fp,		/* Pointer to the file object */
+	DWORD* ci		/* Cluster offset to find (in), nearest cached one at or before it (out) */
+)
+{
+	UINT i;
+	DWORD d;
+
+
+	i = ec_search(fp, *ci);
+	if (i == 0) return 0;		/* No extent before it */
+	i--;
+	d = *ci - fp->ec_ofs[i];
+	if (d >= fp->ec_len[i]) {	/* Not in the extent, take its last cluster */
+		d = fp->ec_len[i] - 1;
+		*ci = fp->ec_ofs[i] + d;
+	}
+	return fp->ec_clst[i] + d;
+}
+
+
+static
+void ec_add (
+	FIL* fp,		/* Pointer to the file object */
+	DWORD ci,		/* Cluster offset in the file */
+	DWORD clst		/* Cluster number at the offset */
+)
+{
+	UINT i, j, n = fp->ec_n;
+
+
+	i = ec_search(fp, ci);
+	if (i > 0 && ci - fp->ec_ofs[i - 1] < fp->ec_len[i - 1]) return;	/* Already in the cache */
+	if (i > 0 && ci == fp->ec_ofs[i - 1] + fp->ec_len[i - 1] && clst == fp->ec_clst[i - 1] + fp->ec_len[i - 1]) {
+		fp->ec_len[i - 1]++;	/* Stretch the previous extent */
+		if (i < n && fp->ec_ofs[i] == ci + 1 && fp->ec_clst[i] == clst + 1) {	/* Merge the next extent into it */
+			fp->ec_len[i - 1] += fp->ec_len[i];
+			for (j = i + 1; j < n; j++) {
+				fp->ec_ofs[j - 1] = fp->ec_ofs[j]; fp->ec_clst[j - 1] = fp->ec_clst[j]; fp->ec_len[j - 1] = fp->ec_len[j];
+			}
+			fp->ec_n = n - 1;
+		}
+		return;
+	}
+	if (i < n && fp->ec_ofs[i] == ci + 1 && fp->ec_clst[i] == clst + 1) {	/* Stretch the next extent backward */
+		fp->ec_ofs[i]--; fp->ec_clst[i]--; fp->ec_len[i]++;
+		return;
+	}
+	if (n == FF_FS_EXTCACHE) {	/* Drop the shortest extent if the cache is full */
+		for (j = 0, n = 1; n < FF_FS_EXTCACHE; n++) {
+			if (fp->ec_len[n] < fp->ec_len[j]) j = n;
+		}
+		for (n = FF_FS_EXTCACHE - 1; j < n; j++) {
+			fp->ec_ofs[j] = fp->ec_ofs[j + 1]; fp->ec_clst[j] = fp->ec_clst[j + 1]; fp->ec_len[j] = fp->ec_len[j + 1];
+		}
+		fp->ec_n = n;			/* n is FF_FS_EXTCACHE - 1 here */
+		i = ec_search(fp, ci);
+	}
+	for (j = n; j > i; j--) {	/* Insert a new extent */
+		fp->ec_ofs[j] = fp->ec_ofs[j - 1]; fp->ec_clst[j] = fp->ec_clst[j - 1]; fp->ec_len[j] = fp->ec_len[j - 1];
+	}
+	fp->ec_ofs[i] = ci; fp->ec_clst[i] = clst; fp->ec_len[i] = 1;
+	fp->ec_n = n + 1;
+}
+
+
+static
+DWORD ec_next (		/* 0:No free cluster to stretch, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:Cluster number */
+	FIL* fp,		/* Pointer to the file object */
+	DWORD clst,		/* Current cluster */
+	DWORD ci,		/* Cluster offset of the next cluster in the file */
+	UINT stretch	/* 0:Follow the chain, 1:Stretch the chain if needed */
+)
+{
+	DWORD c = ci, ncl;
+
+
+	ncl = ec_find(fp, &c);
+	if (ncl != 0 && c == ci) return ncl;	/* Found in the cache */
+#if !FF_FS_READONLY
+	if (stretch) {
+		ncl = create_chain(&fp->obj, clst);	/* Follow or stretch the chain */
+	} else
+#else
+	(void)stretch;
+#endif
+	{
+		ncl = get_fat(&fp->obj, clst);		/* Follow the chain */
+	}
+	if (ncl >= 2 && ncl < fp->obj.fs->n_fatent) ec_add(fp, ci, ncl);
+	return ncl;
+}
+
+#endif	/* FF_FS_EXTCACHE */
+
+
+
+
+#if FF_FS_MAXXFER
+/*-----------------------------------------------------------------------*/
+/* File handling - Stretch a direct transfer over contiguous clusters    */
+/*-----------------------------------------------------------------------*/
+
+static
+UINT xfer_run (		/* Number of sectors to be transferred at a time */
+	FIL* fp,		/* Pointer to the file object (fp->clust is moved to the last cluster of the run) */
+	UINT cc,		/* Number of sectors up to the end of current cluster */
+	UINT nsect,		/* Number of sectors to be transferred (> cc) */
+	UINT stretch	/* 0:Follow the chain, 1:Stretch the chain if needed */
+)
+{
+	FATFS *fs = fp->obj.fs;
+	DWORD ncl, ci;
+	UINT n = cc;
+#if FF_FS_EXFAT
+	FSIZE_t ofs, fsz = fp->obj.objsize;
+#endif
+
+
+	if (nsect > FF_FS_MAXXFER) nsect = FF_FS_MAXXFER;
+	ci = (DWORD)(fp->fptr / SS(fs) / fs->csize);	/* Cluster offset of current cluster */
+#if FF_FS_EXFAT
+	if (fs->fs_type == FS_EXFAT && fp->obj.stat == 2 && fp->fptr < fp->obj.objsize && n < nsect) {	/* Contiguous file: the clusters up to the last one follow in a row */
+		ncl = (DWORD)((fp->obj.objsize - 1) / SS(fs) / fs->csize) - ci;	/* Number of clusters following current one */
+		if (ncl > (nsect - n + fs->csize - 1) / fs->csize) ncl = (nsect - n + fs->csize - 1) / fs->csize;	/* Clip it by the clusters needed */
+		fp->clust += ncl; ci += ncl;
+		n += ncl * fs->csize;
+	}
+#endif
+#if FF_FS_READONLY
+	(void)stretch;
+#endif
+	while (n < nsect) {
+		ci++;
+#if FF_FS_EXFAT
+		ofs = (FSIZE_t)ci * fs->csize * SS(fs);
+		if (stretch && fp->obj.objsize < ofs) fp->obj.objsize = ofs;	/* Current cluster is going to be filled, get_fat() needs it in the file size on the exFAT volume */
+#endif
+#if FF_USE_FASTSEEK
+		if (fp->cltbl) {
+			ncl = clmt_clust(fp, (FSIZE_t)ci * fs->csize * SS(fs));	/* Get cluster# from the CLMT */
+		} else
+#endif
+		{
+#if FF_FS_EXTCACHE
+			ncl = ec_next(fp, fp->clust, ci, stretch);	/* Follow or stretch cluster chain via the extent cache */
+#else
+#if !FF_FS_READONLY
+			if (stretch) {
+				ncl = create_chain(&fp->obj, fp->clust);	/* Follow or stretch cluster chain on the FAT */
+			} else
+#endif
+			{
+				ncl = get_fat(&fp->obj, fp->clust);		/* Follow cluster chain on the FAT */
+			}
+#endif
+		}
+		if (ncl != fp->clust + 1) {	/* End of the run (an error is caught at the next cluster boundary) */
+#if FF_FS_EXFAT && !FF_FS_READONLY
+			if (stretch && fs->fs_type == FS_EXFAT && fp->obj.n_frag && ncl >= 2 && ncl < fs->n_fatent) {
+				fill_last_frag(&fp->obj, ncl, 0xFFFFFFFF);	/* Put the stretched cluster on the FAT, get_fat() cannot follow the growing edge from current one */
+			}
+#endif
+			break;
+		}
+		fp->clust = ncl;
+		n += fs->csize;
+	}
+#if FF_FS_EXFAT
+	fp->obj.objsize = fsz;	/* The file size is updated by the caller as the data is transferred */
+#endif
+	return (n > cc && n > nsect) ? nsect : n;	/* Clip the stretched run at the maximum */
+}
+
+#endif	/* FF_FS_MAXXFER */
+
+
+
+
+#if FF_FS_WRITEBEHIND
+/*-----------------------------------------------------------------------*/
+/* File handling - Write-behind buffer                                   */
+/*-----------------------------------------------------------------------*/
+
+static
+FRESULT wb_flush (	/* Returns FR_OK or FR_DISK_ERR */
+	FIL* fp			/* Pointer to the file object */
+)
+{
+	if (fp->wb_cnt) {	/* Write the collected sectors at a time */
+		if (disk_write(fp->obj.fs->pdrv, fp->wb_buf, fp->wb_sect, fp->wb_cnt) != RES_OK) return FR_DISK_ERR;
+		fp->wb_cnt = 0;
+	}
+	return FR_OK;
+}
+
+
+static
+FRESULT wb_put (	/* Returns FR_OK or FR_DISK_ERR */
+	FIL* fp,			/* Pointer to the file object */
+	const BYTE* buff,	/* Data to be written */
+	LBA_t sect,			/* Sector number to write */
+	UINT cc,			/* Number of sectors to write */
+	UINT flush			/* Flush the buffer after the data is put (cluster boundary) */
+)
+{
+	if (fp->wb_cnt && (sect != fp->wb_sect + fp->wb_cnt || fp->wb_cnt + cc > FF_FS_WRITEBEHIND)) {	/* Flush the buffer if the data does not follow or fit it */
+		if (wb_flush(fp) != FR_OK) return FR_DISK_ERR;
+	}
+	if (cc > FF_FS_WRITEBEHIND) {	/* Write large data directly */
+		return (disk_write(fp->obj.fs->pdrv, buff, sect, cc) == RES_OK) ? FR_OK : FR_DISK_ERR;
+	}
+	if (fp->wb_cnt == 0) fp->wb_sect = sect;
+	mem_cpy(fp->wb_buf + fp->wb_cnt * SS(fp->obj.fs), buff, SS(fp->obj.fs) * cc);
+	fp->wb_cnt += cc;
+	if (flush || fp->wb_cnt == FF_FS_WRITEBEHIND) return wb_flush(fp);
+	return FR_OK;
+}
+
+#endif	/* FF_FS_WRITEBEHIND */
+
+
+
+
+#if FF_FS_DELALLOC
+/*-----------------------------------------------------------------------*/
+/* File handling - Delayed allocation                                    */
+/*-----------------------------------------------------------------------*/
+
+static
+UINT da_room (	/* Returns number of bytes to be put into the delay buffer (0:write it through) */
+	FIL* fp,	/* Pointer to the file object */
+	UINT btw	/* Number of bytes to be written */
+)
+{
+	FATFS *fs = fp->obj.fs;
+	DWORD bcs, ncl, nxt;
+	UINT n;
+
+
+#if FF_USE_FASTSEEK
+	if (fp->cltbl) return 0;	/* The chain is followed on the CLMT */
+#endif
+	n = FF_FS_DELALLOC * SS(fs) - fp->da_cnt;	/* Free space in the buffer */
+	if (n == 0) return 0;
+	bcs = (DWORD)fs->csize * SS(fs);	/* Cluster size [byte] */
+	if (fp->da_cnt == 0) {	/* Start to delay only at the cluster boundary on the end of the chain */
+		if (btw >= n) return 0;	/* Large data is written directly */
+		if (fp->fptr != fp->obj.objsize || fp->fptr % bcs != 0) return 0;
+		if (fp->fptr == 0) {
+			if (fp->obj.sclust != 0) return 0;
+		} else {
+			nxt = get_fat(&fp->obj, fp->clust);
+			if (nxt == 0xFFFFFFFF || nxt < fs->n_fatent) return 0;	/* Not the last cluster or error (reported by the following path) */
+		}
+	}
+	if (n > btw) n = btw;
+	ncl = (fp->da_cnt + bcs - 1) / bcs;		/* Clusters promised so far */
+	if (fs->free_clst <= fs->n_fatent - 2) {	/* Do not promise more than the free clusters if it is known */
+		nxt = (fs->free_clst > fs->da_clst) ? fs->free_clst - fs->da_clst : 0;
+		if ((fp->da_cnt + n + bcs - 1) / bcs - ncl > nxt) n = (UINT)((ncl + nxt) * bcs - fp->da_cnt);
+	}
+	fs->da_clst += (fp->da_cnt + n + bcs - 1) / bcs - ncl;
+	return n;
+}
+
+
+static
+FRESULT da_flush (	/* FR_OK, FR_DENIED:Disk full (the file is cut), FR_INT_ERR or FR_DISK_ERR */
+	FIL* fp			/* Pointer to the file object */
+)
+{
+	FATFS *fs = fp->obj.fs;
+	DWORD bcs, ncl, n = 0, k, rk, clst, rcl;
+	UINT ns;
+	LBA_t sect;
+	FSIZE_t fsz;
+	FRESULT res = FR_OK;
+
+
+	if (fp->da_cnt == 0) return FR_OK;
+	bcs = (DWORD)fs->csize * SS(fs);
+	ncl = (fp->da_cnt + bcs - 1) / bcs;		/* Number of clusters to be allocated */
+	fs->da_clst = (fs->da_clst > ncl) ? fs->da_clst - ncl : 0;	/* Release the promise */
+#if FF_FS_FREEEXT
+	fs->fx_obj = &fp->obj; fs->fx_want = ncl;	/* Ask the allocator for a run of the whole size */
+#endif
+	clst = (fp->fptr == fp->da_cnt) ? 0 : fp->clust;	/* Stretch the chain or create a new one */
+	fsz = fp->obj.objsize;
+	rcl = 0;
+	fs->da_run = 1;		/* The clusters are taken from the promise */
+	for (k = rk = 0; ; k++) {
+		if (k < ncl) {
+			fp->obj.objsize = fp->fptr - fp->da_cnt + k * bcs;	/* The chain ends at the allocated clusters (exFAT contiguous file) */
+			n = create_chain(&fp->obj, clst);	/* Allocate a cluster */
+			if (n == 0) res = FR_DENIED;
+			if (n == 1) res = FR_INT_ERR;
+			if (n == 0xFFFFFFFF) res = FR_DISK_ERR;
+			if (res == FR_OK && fp->obj.sclust == 0) fp->obj.sclust = n;	/* Set start cluster if the first write */
+		}
+		if (k > rk && (k == ncl || res != FR_OK || n != clst + 1)) {	/* Write the full sectors in the run of contiguous clusters */
+			ns = (UINT)(((k * bcs < fp->da_cnt) ? k * bcs : fp->da_cnt) / SS(fs) - rk * fs->csize);
+			sect = clst2sect(fs, rcl);
+			if (sect == 0) {
+				res = FR_INT_ERR; break;
+			}
+			if (ns > 0 && disk_write(fs->pdrv, fp->da_buf + rk * bcs, sect, ns) != RES_OK) {
+				res = FR_DISK_ERR; break;
+			}
+			rk = k;
+		}
+		if (k == ncl || res != FR_OK) break;
+		if (k == rk) rcl = n;	/* Top of the run */
+		clst = n;
+	}
+	fs->da_run = 0;
+	fp->obj.objsize = fsz;
+	if (res == FR_INT_ERR || res == FR_DISK_ERR) return res;
+	if (k > 0) fp->clust = clst;	/* Last cluster of the chain */
+	fp->sect = 0;
+	if (res == FR_DENIED) {	/* Cut the file at the end of the allocated clusters */
+		fp->fptr = fp->obj.objsize = fp->fptr - fp->da_cnt + k * bcs;
+	} else {
+		n = fp->da_cnt % SS(fs);
+		if (n > 0) {	/* Put the partial sector into the sector cache */
+			ns = fp->da_cnt / SS(fs);
+			mem_cpy(fp->buf, fp->da_buf + ns * SS(fs), n);
+			fp->sect = clst2sect(fs, clst) + ns % fs->csize;
+			fp->flag |= FA_DIRTY;
+		}
+	}
+	fp->da_cnt = 0;
+	return res;
+}
+
+#endif	/* FF_FS_DELALLOC */
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Directory handling - Fill a cluster with zeros                        */
 /*-----------------------------------------------------------------------*/
@@ -1697,23 +2881,26 @@ FRESULT dir_clear (	/* Returns FR_OK or FR_DISK_ERR */
 	DWORD clst		/* Directory table to clear */
 )
 {
-	DWORD sect;
+	LBA_t sect;
 	UINT n, szb;
-	BYTE *ibuf;
+	BYTE *ibuf = 0;
 
 
 	if (sync_window(fs) != FR_OK) return FR_DISK_ERR;	/* Flush disk access window */
 	sect = clst2sect(fs, clst);		/* Top of the cluster */
+#if FF_FS_WINCACHE
+	wc_discard(fs, sect, fs->csize);	/* Drop stale copies of the cluster */
+#endif
 	fs->winsect = sect;				/* Set window to top of the cluster */
 	mem_set(fs->win, 0, SS(fs));	/* Clear window buffer */
-#if FF_USE_LFN == 3		/* Quick table clear by using multi-sector write */
+#if defined(BULK_MAX)	/* Quick table clear by using multi-sector write */
 	/* Allocate a temporary buffer */
-	for (szb = ((DWORD)fs->csize * SS(fs) >= MAX_MALLOC) ? MAX_MALLOC : fs->csize * SS(fs); szb > SS(fs) && !(ibuf = ff_memalloc(szb)); szb /= 2) ;
+	for (szb = ((DWORD)fs->csize * SS(fs) >= BULK_MAX) ? BULK_MAX : fs->csize * SS(fs); szb > SS(fs) && !(ibuf = BULK_ALLOC(fs, szb)); szb /= 2) ;
 	if (szb > SS(fs)) {		/* Buffer allocated? */
 		mem_set(ibuf, 0, szb);
 		szb /= SS(fs);		/* Bytes -> Sectors */
 		for (n = 0; n < fs->csize && disk_write(fs->pdrv, ibuf, sect + n, szb) == RES_OK; n += szb) ;	/* Fill the cluster with 0 */
-		ff_memfree(ibuf);
+		BULK_FREE(ibuf);
 	} else
 #endif
 	{
@@ -1751,7 +2938,7 @@ FRESULT dir_sdi (	/* FR_OK(0):succeeded, !=0:error */
 	dp->dptr = ofs;				/* Set current offset */
 	clst = dp->obj.sclust;		/* Table start cluster (0:root) */
 	if (clst == 0 && fs->fs_type >= FS_FAT32) {	/* Replace cluster# 0 with root cluster# */
-		clst = fs->dirbase;
+		clst = (DWORD)fs->dirbase;
 		if (FF_FS_EXFAT) dp->obj.stat = 0;	/* exFAT: Root dir has an FAT chain */
 	}
 
@@ -1845,6 +3032,77 @@ FRESULT dir_next (	/* FR_OK(0):succeeded, FR_NO_FILE:End of table, FR_DENIED:Cou
 
 
 #if !FF_FS_READONLY
+#if FF_FS_DIRHINT
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Free entry hint                                  */
+/*-----------------------------------------------------------------------*/
+/* For each directory hinted, all entries before dh_free are in use, all
+/  entries from dh_end are the blank tail of the table, and no run of blank
+/  entries in between is longer than dh_run. */
+
+static
+UINT dh_get (		/* Returns index of the hint of the directory */
+	FATFS* fs,		/* Filesystem object */
+	DWORD dir		/* Start cluster of the directory (0:root) */
+)
+{
+	UINT i, v;
+
+
+	if (++fs->dh_clock == 0) fs->dh_clock = 1;	/* 0 means not in use */
+	for (i = 0; i < FF_FS_DIRHINT && !(fs->dh_stamp[i] && fs->dh_dir[i] == dir); i++) ;
+	if (i == FF_FS_DIRHINT) {	/* Not hinted yet, take an unused or the least recently used hint */
+		for (i = 0, v = 1; v < FF_FS_DIRHINT; v++) {
+			if (fs->dh_stamp[i] == 0) break;
+			if (fs->dh_stamp[v] == 0 || fs->dh_clock - fs->dh_stamp[v] > fs->dh_clock - fs->dh_stamp[i]) i = v;
+		}
+		fs->dh_dir[i] = dir;
+		fs->dh_free[i] = 0;				/* Nothing is known about the table */
+		fs->dh_end[i] = 0xFFFFFFFF;
+		fs->dh_run[i] = 0xFF;
+	}
+	fs->dh_stamp[i] = fs->dh_clock;
+	return i;
+}
+
+
+static
+void dh_release (
+	FATFS* fs,		/* Filesystem object */
+	DWORD dir,		/* Start cluster of the directory (0:root) */
+	DWORD ofs		/* Offset of the top entry of the block removed */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < FF_FS_DIRHINT; i++) {
+		if (fs->dh_stamp[i] && fs->dh_dir[i] == dir) {
+			if (ofs < fs->dh_free[i]) fs->dh_free[i] = ofs;
+			fs->dh_run[i] = 0xFF;	/* The block may have joined the blank entries around it */
+		}
+	}
+}
+
+
+static
+void dh_drop (
+	FATFS* fs,		/* Filesystem object */
+	DWORD dir		/* Start cluster of the directory to be forgotten */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < FF_FS_DIRHINT; i++) {
+		if (fs->dh_dir[i] == dir) fs->dh_stamp[i] = 0;
+	}
+}
+
+#endif	/* FF_FS_DIRHINT */
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Directory handling - Reserve a block of directory entries             */
 /*-----------------------------------------------------------------------*/
@@ -1862,9 +3120,18 @@ FRESULT dir_alloc (	/* FR_OK(0):succeeded, !=0:error */
 	FRESULT res;
 	UINT n;
 	FATFS *fs = dp->obj.fs;
+#if FF_FS_DIRHINT
+	UINT i, run = 0;
+	DWORD ofs, top = 0xFFFFFFFF, end = 0xFFFFFFFF;
 
 
+	i = dh_get(fs, dp->obj.sclust);
+	ofs = (nent > fs->dh_run[i]) ? fs->dh_end[i] : fs->dh_free[i];	/* Skip to the tail if no run in between is long enough */
+	res = dir_sdi(dp, ofs ? ofs - SZDIRE : 0);	/* The hint can be at end of the table */
+	if (res == FR_OK && ofs) res = dir_next(dp, 1);
+#else
 	res = dir_sdi(dp, 0);
+#endif
 	if (res == FR_OK) {
 		n = 0;
 		do {
@@ -1874,15 +3141,33 @@ FRESULT dir_alloc (	/* FR_OK(0):succeeded, !=0:error */
 			if ((fs->fs_type == FS_EXFAT) ? (int)((dp->dir[XDIR_Type] & 0x80) == 0) : (int)(dp->dir[DIR_Name] == DDEM || dp->dir[DIR_Name] == 0)) {
 #else
 			if (dp->dir[DIR_Name] == DDEM || dp->dir[DIR_Name] == 0) {
+#endif
+#if FF_FS_DIRHINT
+				if (top == 0xFFFFFFFF) top = dp->dptr;	/* First blank entry */
+				if (end == 0xFFFFFFFF && dp->dir[DIR_Name] == 0) end = dp->dptr;	/* Reached the blank tail (XDIR_Type is at the same offset) */
 #endif
 				if (++n == nent) break;	/* A block of contiguous free entries is found */
 			} else {
+#if FF_FS_DIRHINT
+				if (n > run) run = n;	/* Longest run passed over */
+#endif
 				n = 0;					/* Not a blank entry. Restart to search */
 			}
 			res = dir_next(dp, 1);
 		} while (res == FR_OK);	/* Next entry with table stretch enabled */
 	}
 
+#if FF_FS_DIRHINT
+	if (res == FR_OK) {		/* Update the hint past the block allocated */
+		if (end != 0xFFFFFFFF || (fs->dh_end[i] != 0xFFFFFFFF && dp->dptr >= fs->dh_end[i])) {	/* Taken from the tail? */
+			if (ofs == fs->dh_free[i]) fs->dh_run[i] = (BYTE)run;	/* All runs before the tail have been seen */
+			fs->dh_end[i] = dp->dptr + SZDIRE;
+		}
+		if (ofs == fs->dh_free[i]) {
+			fs->dh_free[i] = (top < dp->dptr - (nent - 1) * SZDIRE) ? top : dp->dptr + SZDIRE;
+		}
+	}
+#endif
 	if (res == FR_NO_FILE) res = FR_DENIED;	/* No directory entry to allocate */
 	return res;
 }
@@ -2098,6 +3383,35 @@ void gen_numname (
 		dst[j++] = (i < 8) ? ns[i++] : ' ';
 	} while (j < 8);
 }
+
+
+#if FF_FS_NUMNAME
+static
+DWORD numname_tail (	/* Returns the number after the last '~', 0xFFFFFFFF:none */
+	const BYTE* sfn		/* Pointer to the SFN */
+)
+{
+	UINT i;
+	DWORD v = 0;
+	BYTE c;
+
+
+	for (i = 8; i > 0 && sfn[i - 1] != '~'; i--) ;	/* Find the last '~' in the body */
+	if (i == 0 || i == 8) return 0xFFFFFFFF;
+	for ( ; i < 8 && sfn[i] != ' '; i++) {
+		c = sfn[i];
+		if (c >= '0' && c <= '9') {
+			v = v * 16 + c - '0';
+		} else if (c >= 'A' && c <= 'F') {
+			v = v * 16 + c - 'A' + 10;
+		} else {
+			return 0xFFFFFFFF;
+		}
+	}
+	return v;
+}
+#endif
+
 #endif	/* FF_USE_LFN && !FF_FS_READONLY */
 
 
@@ -2424,84 +3738,607 @@ void create_xdir (
 #define dir_read_file(dp) dir_read(dp, 0)
 #define dir_read_label(dp) dir_read(dp, 1)
 
-#pragma GCC diagnostic pop
+#pragma GCC diagnostic pop
+
+static
+FRESULT dir_read (
+#if defined(FF_FS_POSIX_INTEGRATION) // OS_USE_MICRO_OS_PLUS
+  FFDIR* dp,    /* Pointer to the directory object */
+#else
+	DIR* dp,		/* Pointer to the directory object */
+#endif
+	int vol			/* Filtered by 0:file/directory or 1:volume label */
+)
+{
+	FRESULT res = FR_NO_FILE;
+	FATFS *fs = dp->obj.fs;
+	BYTE a, c;
+#if FF_USE_LFN
+	BYTE ord = 0xFF, sum = 0xFF;
+#endif
+
+	while (dp->sect) {
+		res = move_window(fs, dp->sect);
+		if (res != FR_OK) break;
+		c = dp->dir[DIR_Name];	/* Test for the entry type */
+		if (c == 0) {
+			res = FR_NO_FILE; break; /* Reached to end of the directory */
+		}
+#if FF_FS_EXFAT
+		if (fs->fs_type == FS_EXFAT) {	/* On the exFAT volume */
+			if (FF_USE_LABEL && vol) {
+				if (c == 0x83) break;	/* Volume label entry? */
+			} else {
+				if (c == 0x85) {		/* Start of the file entry block? */
+					dp->blk_ofs = dp->dptr;	/* Get location of the block */
+					res = load_xdir(dp);	/* Load the entry block */
+					if (res == FR_OK) {
+						dp->obj.attr = fs->dirbuf[XDIR_Attr] & AM_MASK;	/* Get attribute */
+					}
+					break;
+				}
+			}
+		} else
+#endif
+		{	/* On the FAT/FAT32 volume */
+			dp->obj.attr = a = dp->dir[DIR_Attr] & AM_MASK;	/* Get attribute */
+#if FF_USE_LFN		/* LFN configuration */
+			if (c == DDEM || c == '.' || (int)((a & ~AM_ARC) == AM_VOL) != vol) {	/* An entry without valid data */
+				ord = 0xFF;
+			} else {
+				if (a == AM_LFN) {			/* An LFN entry is found */
+					if (c & LLEF) {			/* Is it start of an LFN sequence? */
+						sum = dp->dir[LDIR_Chksum];
+						c &= (BYTE)~LLEF; ord = c;
+						dp->blk_ofs = dp->dptr;
+					}
+					/* Check LFN validity and capture it */
+					ord = (c == ord && sum == dp->dir[LDIR_Chksum] && pick_lfn(fs->lfnbuf, dp->dir)) ? ord - 1 : 0xFF;
+				} else {					/* An SFN entry is found */
+					if (ord != 0 || sum != sum_sfn(dp->dir)) {	/* Is there a valid LFN? */
+						dp->blk_ofs = 0xFFFFFFFF;			/* It has no LFN. */
+					}
+					break;
+				}
+			}
+#else		/* Non LFN configuration */
+			if (c != DDEM && c != '.' && a != AM_LFN && (int)((a & ~AM_ARC) == AM_VOL) == vol) {	/* Is it a valid entry? */
+				break;
+			}
+#endif
+		}
+		res = dir_next(dp, 0);		/* Next entry */
+		if (res != FR_OK) break;
+	}
+
+	if (res != FR_OK) dp->sect = 0;		/* Terminate the read operation on error or EOT */
+	return res;
+}
+
+#endif	/* FF_FS_MINIMIZE <= 1 || FF_USE_LABEL || FF_FS_RPATH >= 2 */
+
+
+
+#if FF_FS_DCACHE
+#if !FF_USE_LFN
+#error FF_FS_DCACHE needs LFN to be enabled
+#endif
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Directory entry cache                            */
+/*-----------------------------------------------------------------------*/
+/* Results of dir_find() on the FAT/FAT32 volume, keyed by the parent    */
+/* directory and the case-folded name. Names not found are also kept.    */
+
+static
+UINT dc_key (		/* Returns length of the name, 0:not to be cached */
+	const WCHAR* lfn,	/* Name to be looked up */
+	WORD* hash			/* Pointer to return the hash of the case-folded name */
+)
+{
+	UINT n;
+	WORD h = 0;
+
+
+	for (n = 0; lfn[n]; n++) {
+		if (n >= FF_FS_DCNAME) return 0;	/* Too long to be cached */
+		h = (WORD)(h * 31 + ff_wtoupper(lfn[n]));
+	}
+	*hash = h;
+	return n;
+}
+
+
+static
+UINT dc_search (	/* Returns index of the entry, FF_FS_DCACHE:not found */
+	FATFS* fs,			/* Filesystem object */
+	DWORD dir,			/* Start cluster of the parent directory */
+	WORD hash,			/* Hash of the case-folded name */
+	UINT len,			/* Length of the name */
+	const WCHAR* lfn	/* Name to be looked up */
+)
+{
+	UINT i, n;
+
+
+	for (i = 0; i < FF_FS_DCACHE; i++) {
+		if (fs->dc_stamp[i] == 0 || fs->dc_dir[i] != dir || fs->dc_hash[i] != hash) continue;
+		for (n = 0; n < len && fs->dc_name[i][n] == (WCHAR)ff_wtoupper(lfn[n]); n++) ;
+		if (n == len && (len == FF_FS_DCNAME || fs->dc_name[i][len] == 0)) break;	/* Name matched? */
+	}
+	return i;
+}
+
+
+static
+void dc_store (
+	FATFS* fs,			/* Filesystem object */
+	DWORD dir,			/* Start cluster of the parent directory */
+	WORD hash,			/* Hash of the case-folded name */
+	UINT len,			/* Length of the name */
+	const WCHAR* lfn,	/* Name looked up */
+	DWORD ofs,			/* Offset of the SFN entry (0xFFFFFFFF:not found) */
+	DWORD blk,			/* Offset of the LFN entry block (0xFFFFFFFF:no LFN) */
+	BYTE sum			/* Checksum of the SFN entry */
+)
+{
+	UINT i, n, v = 0;
+
+
+	for (i = 1; i < FF_FS_DCACHE; i++) {	/* Replace an empty or the least recently used entry */
+		if (fs->dc_stamp[v] == 0) break;
+		if (fs->dc_stamp[i] == 0 || fs->dc_clock - fs->dc_stamp[i] > fs->dc_clock - fs->dc_stamp[v]) v = i;
+	}
+	fs->dc_dir[v] = dir; fs->dc_hash[v] = hash;
+	fs->dc_ofs[v] = ofs; fs->dc_blk[v] = blk; fs->dc_sum[v] = sum;
+	for (n = 0; n < FF_FS_DCNAME; n++) {
+		fs->dc_name[v][n] = (n < len) ? (WCHAR)ff_wtoupper(lfn[n]) : 0;
+	}
+	if (++fs->dc_clock == 0) fs->dc_clock = 1;	/* 0 means empty */
+	fs->dc_stamp[v] = fs->dc_clock;
+}
+
+
+#if !FF_FS_READONLY
+static
+void dc_purge (
+	FATFS* fs,		/* Filesystem object */
+	DWORD dir		/* Start cluster of the directory to be forgotten */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < FF_FS_DCACHE; i++) {
+		if (fs->dc_dir[i] == dir) fs->dc_stamp[i] = 0;
+	}
+}
+#endif
+
+#endif	/* FF_FS_DCACHE */
+
+
+
+#if FF_FS_NAMEINDEX
+#if !FF_USE_LFN
+#error FF_FS_NAMEINDEX needs LFN to be enabled
+#endif
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Name index                                       */
+/*-----------------------------------------------------------------------*/
+/* Hash tables of the names in the FAT/FAT32 directories. Each object    */
+/* has a key of its SFN and, if it has a valid LFN, a key of the         */
+/* case-folded LFN; both point to the top entry of its entry block. The  */
+/* tables are open addressed and share the FF_FS_NAMEINDEX slots.        */
+
+#define NI_MIN	32	/* Directories with less keys than this are not indexed */
+#define NI_SEEN	((UINT)-1)	/* ni_used[] of a directory looked up once and not counted yet */
+
+static
+WORD ni_mix (	/* Returns the hash of a character at a position */
+	DWORD c,	/* Character */
+	UINT i		/* Position in the name (SFN: 0x100 + position) */
+)
+{
+	c = (c + ((DWORD)i << 16)) * 0x9E3779B1;
+	return (WORD)((c >> 16) ^ c);
+}
+
+
+static
+WORD ni_lfn (		/* Returns the key of the LFN */
+	const WCHAR* lfn	/* Pointer to the LFN */
+)
+{
+	UINT i;
+	WORD h = 0;
+
+
+	for (i = 0; lfn[i]; i++) h += ni_mix(ff_wtoupper(lfn[i]), i);
+	return h ? h : 1;	/* 0 means empty slot */
+}
+
+
+static
+WORD ni_lfn_part (	/* Returns the sum of the characters in an LFN entry */
+	const BYTE* dir		/* Pointer to the LFN entry */
+)
+{
+	UINT i, s;
+	WCHAR wc;
+	WORD h = 0;
+
+
+	i = ((dir[LDIR_Ord] & ~LLEF) - 1) * 13;	/* Offset in the LFN */
+	for (s = 0; s < 13; s++, i++) {
+		wc = ld_word(dir + LfnOfs[s]);
+		if (wc == 0) break;		/* End of the name */
+		h += ni_mix(ff_wtoupper(wc), i);
+	}
+	return h;
+}
+
+
+static
+WORD ni_sfn (		/* Returns the key of the SFN */
+	const BYTE* sfn		/* Pointer to the SFN */
+)
+{
+	UINT i;
+	WORD h = 0;
+
+
+	for (i = 0; i < 11; i++) h += ni_mix(sfn[i], 0x100 + i);
+	return h ? h : 1;	/* 0 means empty slot */
+}
+
+
+static
+UINT ni_search (	/* Returns index of the name index, FF_FS_NAMEINDEX_DIRS:not found */
+	FATFS* fs,			/* Filesystem object */
+	DWORD dir			/* Start cluster of the directory */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < FF_FS_NAMEINDEX_DIRS && !(fs->ni_stamp[i] && fs->ni_dir[i] == dir); i++) ;
+	return i;
+}
+
+
+static
+void ni_put (
+	FATFS* fs,		/* Filesystem object */
+	UINT d,			/* Index of the name index */
+	WORD hash,		/* Key */
+	WORD ent		/* Index of the top entry of the entry block */
+)
+{
+	UINT b = fs->ni_base[d], m = fs->ni_size[d] - 1, i;
+
+
+	for (i = hash & m; fs->ni_hash[b + i]; i = (i + 1) & m) ;	/* Find an empty slot */
+	fs->ni_hash[b + i] = hash; fs->ni_ent[b + i] = ent;
+	fs->ni_used[d]++;
+}
+
+
+#if !FF_FS_READONLY
+static
+void ni_drop (
+	FATFS* fs,		/* Filesystem object */
+	DWORD dir		/* Start cluster of the directory to be forgotten */
+)
+{
+	UINT d = ni_search(fs, dir);
+
+
+	if (d < FF_FS_NAMEINDEX_DIRS) fs->ni_stamp[d] = 0;
+}
+
+
+static
+void ni_add (
+#if defined(FF_FS_POSIX_INTEGRATION) // OS_USE_MICRO_OS_PLUS
+	FFDIR* dp,		/* Directory object pointing the registered SFN entry */
+#else
+	DIR* dp,		/* Directory object pointing the registered SFN entry */
+#endif
+	UINT nlfn		/* Number of the LFN entries */
+)
+{
+	FATFS *fs = dp->obj.fs;
+	UINT d = ni_search(fs, dp->obj.sclust);
+	WORD ent;
+#if FF_FS_NUMNAME
+	DWORD tail;
+#endif
+
+
+	if (d == FF_FS_NAMEINDEX_DIRS) return;
+	if (fs->ni_size[d] == 0) {	/* Not indexed directory */
+		if (fs->ni_used[d] == NI_SEEN) return;	/* Not counted yet */
+		if (fs->ni_used[d] < NI_MIN && fs->ni_used[d] + (nlfn ? 2 : 1) >= NI_MIN) {
+			fs->ni_stamp[d] = 0;	/* Drop it to be indexed at next lookup */
+		} else {
+			fs->ni_used[d] += nlfn ? 2 : 1;
+		}
+		return;
+	}
+#if FF_FS_NUMNAME
+	tail = numname_tail(dp->fn);
+	if (tail != 0xFFFFFFFF && tail > fs->ni_tail[d]) fs->ni_tail[d] = tail;	/* Largest number of the numbered SFNs */
+#endif
+	if ((fs->ni_used[d] + 2) * 4 > fs->ni_size[d] * 3) {	/* Too full? */
+		fs->ni_stamp[d] = 0;	/* Drop it to be rebuilt in larger size at next lookup */
+		return;
+	}
+	ent = (WORD)(dp->dptr / SZDIRE - nlfn);
+	if (nlfn) ni_put(fs, d, ni_lfn(fs->lfnbuf), ent);
+	ni_put(fs, d, ni_sfn(dp->fn), ent);
+}
+
+
+static
+void ni_del (
+	FATFS* fs,		/* Filesystem object */
+	DWORD dir,		/* Start cluster of the directory */
+	WORD hash,		/* Key */
+	WORD ent		/* Index of the top entry of the entry block */
+)
+{
+	UINT d = ni_search(fs, dir), b, m, i, j, k;
+
+
+	if (d == FF_FS_NAMEINDEX_DIRS || fs->ni_size[d] == 0) return;
+	b = fs->ni_base[d]; m = fs->ni_size[d] - 1;
+	for (i = hash & m; fs->ni_hash[b + i]; i = (i + 1) & m) {
+		if (fs->ni_hash[b + i] != hash || fs->ni_ent[b + i] != ent) continue;
+		for (j = i; ; ) {	/* Fill the hole with the following keys that can be moved to it */
+			j = (j + 1) & m;
+			if (!fs->ni_hash[b + j]) break;
+			k = fs->ni_hash[b + j] & m;		/* Home slot of the key */
+			if (((j - k) & m) >= ((j - i) & m)) {
+				fs->ni_hash[b + i] = fs->ni_hash[b + j]; fs->ni_ent[b + i] = fs->ni_ent[b + j];
+				i = j;
+			}
+		}
+		fs->ni_hash[b + i] = 0;
+		fs->ni_used[d]--;
+		break;
+	}
+}
+#endif
+
+
+static
+UINT ni_alloc (		/* Returns the first slot of the table */
+	FATFS* fs,		/* Filesystem object */
+	UINT size		/* Number of slots */
+)
+{
+	UINT i, v, n;
+
+
+	for (;;) {	/* Drop the least recently used tables until the table fits in */
+		for (n = i = 0; i < FF_FS_NAMEINDEX_DIRS; i++) {
+			if (fs->ni_stamp[i]) n += fs->ni_size[i];
+		}
+		if (FF_FS_NAMEINDEX - n >= size) break;
+		for (v = FF_FS_NAMEINDEX_DIRS, i = 0; i < FF_FS_NAMEINDEX_DIRS; i++) {
+			if (fs->ni_stamp[i] && fs->ni_size[i] && (v == FF_FS_NAMEINDEX_DIRS || fs->ni_clock - fs->ni_stamp[i] > fs->ni_clock - fs->ni_stamp[v])) v = i;
+		}
+		fs->ni_stamp[v] = 0;
+	}
+	for (n = 0; ; n += fs->ni_size[v]) {	/* Pack the tables in order of the location */
+		for (v = FF_FS_NAMEINDEX_DIRS, i = 0; i < FF_FS_NAMEINDEX_DIRS; i++) {
+			if (fs->ni_stamp[i] && fs->ni_size[i] && fs->ni_base[i] >= n && (v == FF_FS_NAMEINDEX_DIRS || fs->ni_base[i] < fs->ni_base[v])) v = i;
+		}
+		if (v == FF_FS_NAMEINDEX_DIRS) break;
+		if (fs->ni_base[v] != n) {
+			mem_cpy(fs->ni_hash + n, fs->ni_hash + fs->ni_base[v], fs->ni_size[v] * sizeof (WORD));
+			mem_cpy(fs->ni_ent + n, fs->ni_ent + fs->ni_base[v], fs->ni_size[v] * sizeof (WORD));
+			fs->ni_base[v] = n;
+		}
+	}
+	return n;
+}
+
 
 static
-FRESULT dir_read (
+FRESULT ni_scan (	/* FR_OK(0):succeeded, !=0:error */
 #if defined(FF_FS_POSIX_INTEGRATION) // OS_USE_MICRO_OS_PLUS
-  FFDIR* dp,    /* Pointer to the directory object */
+	FFDIR* dp,		/* Directory object */
 #else
-	DIR* dp,		/* Pointer to the directory object */
+	DIR* dp,		/* Directory object */
 #endif
-	int vol			/* Filtered by 0:file/directory or 1:volume label */
+	UINT d,			/* Index of the name index to put the keys in, FF_FS_NAMEINDEX_DIRS:count only */
+	UINT* nk		/* Pointer to return the number of keys (count only: stops when they cannot be indexed) */
 )
 {
-	FRESULT res = FR_NO_FILE;
+	FRESULT res;
 	FATFS *fs = dp->obj.fs;
-	BYTE a, c;
-#if FF_USE_LFN
-	BYTE ord = 0xFF, sum = 0xFF;
+	BYTE c, a, ord = 0xFF, sum = 0xFF;
+	DWORD blk = 0xFFFFFFFF;
+	WORD h = 0, ent;
+#if !FF_FS_READONLY && FF_FS_NUMNAME
+	DWORD tail;
 #endif
 
-	while (dp->sect) {
+
+	*nk = 0;
+	res = dir_sdi(dp, 0);
+	while (res == FR_OK) {	/* Follow the LFN sequences the same way as dir_find() */
 		res = move_window(fs, dp->sect);
 		if (res != FR_OK) break;
-		c = dp->dir[DIR_Name];	/* Test for the entry type */
-		if (c == 0) {
-			res = FR_NO_FILE; break; /* Reached to end of the directory */
-		}
-#if FF_FS_EXFAT
-		if (fs->fs_type == FS_EXFAT) {	/* On the exFAT volume */
-			if (FF_USE_LABEL && vol) {
-				if (c == 0x83) break;	/* Volume label entry? */
-			} else {
-				if (c == 0x85) {		/* Start of the file entry block? */
-					dp->blk_ofs = dp->dptr;	/* Get location of the block */
-					res = load_xdir(dp);	/* Load the entry block */
-					if (res == FR_OK) {
-						dp->obj.attr = fs->dirbuf[XDIR_Attr] & AM_MASK;	/* Get attribute */
-					}
-					break;
-				}
+		c = dp->dir[DIR_Name];
+		if (c == 0) break;	/* Reached to end of table */
+		a = dp->dir[DIR_Attr] & AM_MASK;
+		if (c == DDEM || ((a & AM_VOL) && a != AM_LFN)) {	/* An entry without valid data */
+			ord = 0xFF; blk = 0xFFFFFFFF;
+		} else if (a == AM_LFN) {	/* An LFN entry */
+			if (c & LLEF) {		/* Start of LFN sequence */
+				sum = dp->dir[LDIR_Chksum];
+				c &= (BYTE)~LLEF; ord = c;
+				blk = dp->dptr; h = 0;
 			}
-		} else
-#endif
-		{	/* On the FAT/FAT32 volume */
-			dp->obj.attr = a = dp->dir[DIR_Attr] & AM_MASK;	/* Get attribute */
-#if FF_USE_LFN		/* LFN configuration */
-			if (c == DDEM || c == '.' || (int)((a & ~AM_ARC) == AM_VOL) != vol) {	/* An entry without valid data */
-				ord = 0xFF;
+			if (c == ord && sum == dp->dir[LDIR_Chksum] && ld_word(dp->dir + LDIR_FstClusLO) == 0) {
+				h += ni_lfn_part(dp->dir); ord--;
 			} else {
-				if (a == AM_LFN) {			/* An LFN entry is found */
-					if (c & LLEF) {			/* Is it start of an LFN sequence? */
-						sum = dp->dir[LDIR_Chksum];
-						c &= (BYTE)~LLEF; ord = c;
-						dp->blk_ofs = dp->dptr;
-					}
-					/* Check LFN validity and capture it */
-					ord = (c == ord && sum == dp->dir[LDIR_Chksum] && pick_lfn(fs->lfnbuf, dp->dir)) ? ord - 1 : 0xFF;
-				} else {					/* An SFN entry is found */
-					if (ord != 0 || sum != sum_sfn(dp->dir)) {	/* Is there a valid LFN? */
-						dp->blk_ofs = 0xFFFFFFFF;			/* It has no LFN. */
-					}
-					break;
-				}
+				ord = 0xFF;
 			}
-#else		/* Non LFN configuration */
-			if (c != DDEM && c != '.' && a != AM_LFN && (int)((a & ~AM_ARC) == AM_VOL) == vol) {	/* Is it a valid entry? */
-				break;
+		} else {				/* An SFN entry */
+			ent = (WORD)(((blk != 0xFFFFFFFF) ? blk : dp->dptr) / SZDIRE);
+			if (ord == 0 && sum == sum_sfn(dp->dir)) {	/* Valid LFN? */
+				if (d < FF_FS_NAMEINDEX_DIRS) ni_put(fs, d, h ? h : 1, ent);
+				(*nk)++;
 			}
+			if (d < FF_FS_NAMEINDEX_DIRS) {
+				ni_put(fs, d, ni_sfn(dp->dir), ent);
+#if !FF_FS_READONLY && FF_FS_NUMNAME
+				tail = numname_tail(dp->dir);
+				if (tail != 0xFFFFFFFF && tail > fs->ni_tail[d]) fs->ni_tail[d] = tail;	/* Largest number of the numbered SFNs */
 #endif
+			}
+			(*nk)++;
+			if (d == FF_FS_NAMEINDEX_DIRS && *nk + *nk / 2 > FF_FS_NAMEINDEX) break;	/* Too many keys to be indexed */
+			ord = 0xFF; blk = 0xFFFFFFFF;
 		}
-		res = dir_next(dp, 0);		/* Next entry */
-		if (res != FR_OK) break;
+		res = dir_next(dp, 0);
 	}
+	return (res == FR_NO_FILE) ? FR_OK : res;
+}
 
-	if (res != FR_OK) dp->sect = 0;		/* Terminate the read operation on error or EOT */
+
+static
+FRESULT ni_open (	/* FR_OK(0):succeeded, !=0:error */
+#if defined(FF_FS_POSIX_INTEGRATION) // OS_USE_MICRO_OS_PLUS
+	FFDIR* dp,		/* Directory object */
+#else
+	DIR* dp,		/* Directory object */
+#endif
+	UINT* di		/* Pointer to return index of the name index, FF_FS_NAMEINDEX_DIRS:not indexed */
+)
+{
+	FRESULT res;
+	FATFS *fs = dp->obj.fs;
+	UINT d, i, n, size;
+
+
+	if (++fs->ni_clock == 0) fs->ni_clock = 1;	/* 0 means not in use */
+	*di = FF_FS_NAMEINDEX_DIRS;
+	d = ni_search(fs, dp->obj.sclust);
+	if (d == FF_FS_NAMEINDEX_DIRS) {	/* New directory: record it, to be counted if it is looked up again */
+		for (d = 0, i = 1; i < FF_FS_NAMEINDEX_DIRS; i++) {	/* Take an unused or the least recently used index */
+			if (fs->ni_stamp[d] == 0) break;
+			if (fs->ni_stamp[i] == 0 || fs->ni_clock - fs->ni_stamp[i] > fs->ni_clock - fs->ni_stamp[d]) d = i;
+		}
+		fs->ni_dir[d] = dp->obj.sclust;
+		fs->ni_size[d] = 0;
+		fs->ni_used[d] = NI_SEEN;
+		fs->ni_stamp[d] = fs->ni_clock;
+		return FR_OK;
+	}
+	fs->ni_stamp[d] = fs->ni_clock;
+	if (fs->ni_size[d] || fs->ni_used[d] != NI_SEEN) {	/* Already known directory */
+		if (fs->ni_size[d]) *di = d;
+		return FR_OK;
+	}
+
+	res = ni_scan(dp, FF_FS_NAMEINDEX_DIRS, &n);	/* Count the keys */
+	if (res != FR_OK) return res;
+	for (size = 16; size < n + n / 2; size <<= 1) ;
+	fs->ni_used[d] = n;		/* Too small or too large to be indexed: number of keys in it */
+	if (n < NI_MIN || size > FF_FS_NAMEINDEX) return FR_OK;
+	fs->ni_base[d] = ni_alloc(fs, size);
+	fs->ni_size[d] = size;
+	fs->ni_used[d] = 0;
+	mem_set(fs->ni_hash + fs->ni_base[d], 0, size * sizeof (WORD));
+#if !FF_FS_READONLY && FF_FS_NUMNAME
+	fs->ni_tail[d] = 0;
+#endif
+
+	res = ni_scan(dp, d, &n);	/* Put the keys */
+	if (res != FR_OK) {
+		fs->ni_stamp[d] = 0;
+	} else {
+		*di = d;
+	}
 	return res;
 }
 
-#endif	/* FF_FS_MINIMIZE <= 1 || FF_USE_LABEL || FF_FS_RPATH >= 2 */
+
+static
+FRESULT ni_check (	/* FR_OK:the entry block has the name, FR_NO_FILE:not, others:error */
+#if defined(FF_FS_POSIX_INTEGRATION) // OS_USE_MICRO_OS_PLUS
+	FFDIR* dp		/* Directory object pointing the top entry of the entry block */
+#else
+	DIR* dp			/* Directory object pointing the top entry of the entry block */
+#endif
+)
+{
+	FRESULT res;
+	FATFS *fs = dp->obj.fs;
+	BYTE c, a, ord = 0xFF, sum = 0xFF;
+
+
+	dp->blk_ofs = 0xFFFFFFFF;
+	for (;;) {
+		res = move_window(fs, dp->sect);
+		if (res != FR_OK) return res;
+		c = dp->dir[DIR_Name];
+		dp->obj.attr = a = dp->dir[DIR_Attr] & AM_MASK;
+		if (c == 0 || c == DDEM || ((a & AM_VOL) && a != AM_LFN)) return FR_NO_FILE;	/* Not an object */
+		if (a != AM_LFN) break;		/* Reached to the SFN entry */
+		if (!(dp->fn[NSFLAG] & NS_NOLFN)) {
+			if (c & LLEF) {		/* Start of LFN sequence */
+				sum = dp->dir[LDIR_Chksum];
+				c &= (BYTE)~LLEF; ord = c;
+				dp->blk_ofs = dp->dptr;
+			}
+			ord = (c == ord && sum == dp->dir[LDIR_Chksum] && cmp_lfn(fs->lfnbuf, dp->dir)) ? ord - 1 : 0xFF;
+		}
+		res = dir_next(dp, 0);
+		if (res != FR_OK) return res;
+	}
+	if (ord == 0 && sum == sum_sfn(dp->dir)) return FR_OK;	/* LFN matched? */
+	if (!(dp->fn[NSFLAG] & NS_LOSS) && !mem_cmp(dp->dir, dp->fn, 11)) return FR_OK;	/* SFN matched? */
+	return FR_NO_FILE;
+}
+
+
+static
+FRESULT ni_find (	/* FR_OK(0):succeeded, !=0:error */
+#if defined(FF_FS_POSIX_INTEGRATION) // OS_USE_MICRO_OS_PLUS
+	FFDIR* dp,		/* Directory object with the file name */
+#else
+	DIR* dp,		/* Directory object with the file name */
+#endif
+	UINT d			/* Index of the name index of the directory */
+)
+{
+	FRESULT res;
+	FATFS *fs = dp->obj.fs;
+	UINT b = fs->ni_base[d], m = fs->ni_size[d] - 1, i, k;
+	WORD h[2];
+
+
+	h[0] = (dp->fn[NSFLAG] & NS_NOLFN) ? 0 : ni_lfn(fs->lfnbuf);	/* Can match an LFN? */
+	h[1] = (dp->fn[NSFLAG] & NS_LOSS) ? 0 : ni_sfn(dp->fn);	/* Can match an SFN? */
+	for (k = 0; k < 2; k++) {
+		if (!h[k]) continue;
+		for (i = h[k] & m; fs->ni_hash[b + i]; i = (i + 1) & m) {	/* Check the entries with the key */
+			if (fs->ni_hash[b + i] != h[k]) continue;
+			res = dir_sdi(dp, (DWORD)fs->ni_ent[b + i] * SZDIRE);
+			if (res == FR_OK) res = ni_check(dp);
+			if (res != FR_NO_FILE) return res;
+		}
+	}
+	return FR_NO_FILE;	/* Not in the directory */
+}
+
+#endif	/* FF_FS_NAMEINDEX */
+
 
 
 
@@ -2524,6 +4361,13 @@ FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 #if FF_USE_LFN
 	BYTE a, ord, sum;
 #endif
+#if FF_FS_DCACHE
+	UINT i, len;
+	WORD hash = 0;
+#endif
+#if FF_FS_NAMEINDEX
+	UINT ni = FF_FS_NAMEINDEX_DIRS;
+#endif
 
 	res = dir_sdi(dp, 0);			/* Rewind directory object */
 	if (res != FR_OK) return res;
@@ -2548,8 +4392,47 @@ FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 	}
 #endif
 	/* On the FAT/FAT32 volume */
+#if FF_FS_DCACHE
+	len = (dp->fn[NSFLAG] & NS_NOLFN) ? 0 : dc_key(fs->lfnbuf, &hash);	/* SFN collision checks are not cached */
+	if (len) {
+		i = dc_search(fs, dp->obj.sclust, hash, len, fs->lfnbuf);
+		if (i < FF_FS_DCACHE) {
+			if (fs->dc_ofs[i] == 0xFFFFFFFF) {	/* Known not to exist */
+				fs->dc_hit++;
+				if (++fs->dc_clock == 0) fs->dc_clock = 1;
+				fs->dc_stamp[i] = fs->dc_clock;
+				return FR_NO_FILE;
+			}
+			res = dir_sdi(dp, fs->dc_ofs[i]);	/* Go to the cached entry */
+			if (res == FR_OK) res = move_window(fs, dp->sect);
+			if (res != FR_OK) return res;
+			c = dp->dir[DIR_Name]; a = dp->dir[DIR_Attr] & AM_MASK;
+			if (c != 0 && c != DDEM && a != AM_LFN && !(a & AM_VOL) && sum_sfn(dp->dir) == fs->dc_sum[i]) {	/* Is it still the entry? */
+				dp->obj.attr = a;
+				dp->blk_ofs = fs->dc_blk[i];
+				fs->dc_hit++;
+				if (++fs->dc_clock == 0) fs->dc_clock = 1;
+				fs->dc_stamp[i] = fs->dc_clock;
+				return FR_OK;
+			}
+			fs->dc_stamp[i] = 0;	/* Stale, drop it and scan the directory */
+			res = dir_sdi(dp, 0);
+			if (res != FR_OK) return res;
+		}
+		fs->dc_miss++;
+	}
+#endif
 #if FF_USE_LFN
 	ord = sum = 0xFF; dp->blk_ofs = 0xFFFFFFFF;	/* Reset LFN sequence */
+#endif
+#if FF_FS_NAMEINDEX
+	if (!(dp->fn[NSFLAG] & NS_NOLFN)) {	/* SFN collision checks are not indexed */
+		res = ni_open(dp, &ni);		/* Get the name index of the directory */
+		if (res == FR_OK) res = (ni < FF_FS_NAMEINDEX_DIRS) ? ni_find(dp, ni) : dir_sdi(dp, 0);
+	}
+#endif
+#if FF_FS_NAMEINDEX
+	if (ni == FF_FS_NAMEINDEX_DIRS && res == FR_OK)	/* Scan the directory if it is not indexed */
 #endif
 	do {
 		res = move_window(fs, dp->sect);
@@ -2584,12 +4467,96 @@ FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 		res = dir_next(dp, 0);	/* Next entry */
 	} while (res == FR_OK);
 
+#if FF_FS_DCACHE
+	if (len && res == FR_OK) dc_store(fs, dp->obj.sclust, hash, len, fs->lfnbuf, dp->dptr, dp->blk_ofs, sum_sfn(dp->dir));
+	if (len && res == FR_NO_FILE) dc_store(fs, dp->obj.sclust, hash, len, fs->lfnbuf, 0xFFFFFFFF, 0xFFFFFFFF, 0);
+#endif
 	return res;
 }
 
 
 
 
+#if !FF_FS_READONLY && FF_USE_LFN && FF_FS_NUMNAME
+/*-----------------------------------------------------------------------*/
+/* Pick a numbered SFN not in the directory                              */
+/*-----------------------------------------------------------------------*/
+/* The numbers of the names made from the same SFN are collected in a   */
+/* single scan of the directory, and the lowest free one is taken. In an */
+/* indexed directory, the number above all the numbers is taken instead. */
+
+
+
+static
+FRESULT dir_numname (	/* FR_OK:succeeded, FR_DISK_ERR:disk error */
+#if defined(FF_FS_POSIX_INTEGRATION) // OS_USE_MICRO_OS_PLUS
+	FFDIR* dp,			/* Directory object, the numbered name is returned in dp->fn */
+#else
+	DIR* dp,			/* Directory object, the numbered name is returned in dp->fn */
+#endif
+	const BYTE* sn		/* SFN made from the LFN */
+)
+{
+	static const WCHAR nolfn[1] = {0};	/* gen_numname() takes the number as it is with an empty LFN */
+	FRESULT res;
+	FATFS *fs = dp->obj.fs;
+	BYTE used[32], c;
+	DWORD v, vmax, base;
+	UINT n;
+#if FF_FS_NAMEINDEX
+	UINT d;
+#endif
+
+
+#if FF_FS_NAMEINDEX
+	d = ni_search(fs, dp->obj.sclust);
+	if (d < FF_FS_NAMEINDEX_DIRS && fs->ni_size[d] && fs->ni_tail[d] < 0xFFFFFFF) {	/* Indexed directory? */
+		gen_numname(dp->fn, sn, nolfn, fs->ni_tail[d] + 1);	/* Take the number above all the numbers in the directory */
+		return FR_OK;
+	}
+#endif
+	for (base = 0; ; base += sizeof used * 8) {	/* One pass, more only when the largest number is taken by a name made by hand */
+		mem_set(used, 0, sizeof used);
+		vmax = 0;
+		res = dir_sdi(dp, 0);
+		while (res == FR_OK) {	/* Collect the numbers taken by the names made from the same SFN */
+			res = move_window(fs, dp->sect);
+			if (res != FR_OK) break;
+			c = dp->dir[DIR_Name];
+			if (c == 0) break;	/* Reached to end of table */
+			if (c != DDEM && !(dp->dir[DIR_Attr] & AM_VOL) && !mem_cmp(dp->dir + 8, sn + 8, 3)) {	/* An SFN entry with the same extension */
+				v = numname_tail(dp->dir);
+				if (v != 0 && v != 0xFFFFFFFF) {
+					gen_numname(dp->fn, sn, nolfn, v);
+					if (!mem_cmp(dp->dir, dp->fn, 11)) {	/* Is it the name with the number? */
+						if (v - base < sizeof used * 8) used[(v - base) / 8] |= 1 << ((v - base) % 8);
+						if (v > vmax) vmax = v;
+					}
+				}
+			}
+			res = dir_next(dp, 0);
+		}
+		if (res == FR_NO_FILE) res = FR_OK;	/* Reached to end of the directory */
+		if (res != FR_OK) return res;
+
+		for (n = base ? 0 : 1; n < sizeof used * 8 && (used[n / 8] & (1 << (n % 8))); n++) ;	/* Take the lowest free number in the window */
+		if (n < sizeof used * 8) {
+			v = base + n;
+			break;
+		}
+		if (vmax < 0xFFFFFFF) {	/* or the number above the numbers taken */
+			v = vmax + 1;
+			break;
+		}
+	}
+	gen_numname(dp->fn, sn, nolfn, v);
+	return FR_OK;
+}
+
+#endif
+
+
+
 #if !FF_FS_READONLY
 /*-----------------------------------------------------------------------*/
 /* Register an object to the directory                                   */
@@ -2607,12 +4574,18 @@ FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too many S
 	FRESULT res = FR_INVALID_OBJECT;
 	FATFS *fs = dp->obj.fs;
 #if FF_USE_LFN		/* LFN configuration */
-	UINT n, nlen, nent;
+	UINT nlen, nent;
 	BYTE sn[12], sum;
+#if !FF_FS_NUMNAME
+	UINT n;
+#endif
 
 
 	if (dp->fn[NSFLAG] & (NS_DOT | NS_NONAME)) return FR_INVALID_NAME;	/* Check name validity */
 	for (nlen = 0; fs->lfnbuf[nlen]; nlen++) ;	/* Get lfn length */
+#if FF_FS_DCACHE
+	dc_purge(fs, dp->obj.sclust);	/* Names not found in the directory may be found after this */
+#endif
 
 #if FF_FS_EXFAT
 	if (fs->fs_type == FS_EXFAT) {	/* On the exFAT volume */
@@ -2653,6 +4626,10 @@ FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too many S
 	mem_cpy(sn, dp->fn, 12);
 	if (sn[NSFLAG] & NS_LOSS) {			/* When LFN is out of 8.3 format, generate a numbered name */
 		dp->fn[NSFLAG] = NS_NOLFN;		/* Find only SFN */
+#if FF_FS_NUMNAME
+		res = dir_numname(dp, sn);		/* Pick the first numbered name not in the directory */
+		if (res != FR_OK) return res;
+#else
 		for (n = 1; n < 100; n++) {
 			gen_numname(dp->fn, sn, fs->lfnbuf, n);	/* Generate a numbered name */
 			res = dir_find(dp);				/* Check if the name collides with existing SFN */
@@ -2660,6 +4637,7 @@ FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too many S
 		}
 		if (n == 100) return FR_DENIED;		/* Abort if too many collisions */
 		if (res != FR_NO_FILE) return res;	/* Abort if the result is other than 'not collided' */
+#endif
 		dp->fn[NSFLAG] = sn[NSFLAG];
 	}
 
@@ -2697,6 +4675,16 @@ FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too many S
 			fs->wflag = 1;
 		}
 	}
+#if FF_FS_NAMEINDEX
+	if (res == FR_OK) {
+		ni_add(dp, (sn[NSFLAG] & NS_LFN) ? (nlen + 12) / 13 : 0);	/* Put the keys of the object */
+	} else {
+		ni_drop(fs, dp->obj.sclust);	/* The directory may have been partially updated */
+	}
+#endif
+#if FF_FS_DIRHINT
+	if (res != FR_OK) dh_drop(fs, dp->obj.sclust);	/* The entries allocated may be left blank */
+#endif
 
 	return res;
 }
@@ -2723,7 +4711,17 @@ FRESULT dir_remove (	/* FR_OK:Succeeded, FR_DISK_ERR:A disk error */
 	FATFS *fs = dp->obj.fs;
 #if FF_USE_LFN		/* LFN configuration */
 	DWORD last = dp->dptr;
+#if FF_FS_NAMEINDEX
+	WORD ent = (WORD)(((dp->blk_ofs == 0xFFFFFFFF) ? dp->dptr : dp->blk_ofs) / SZDIRE);
+	WORD h = 0, hs = 0;
+#endif
+#if FF_FS_DIRHINT
+	dh_release(fs, dp->obj.sclust, (dp->blk_ofs == 0xFFFFFFFF) ? dp->dptr : dp->blk_ofs);	/* The entries can be reused */
+#endif
 
+#if FF_FS_DCACHE
+	dc_purge(fs, dp->obj.sclust);	/* Forget the entry locations in the directory */
+#endif
 	res = (dp->blk_ofs == 0xFFFFFFFF) ? FR_OK : dir_sdi(dp, dp->blk_ofs);	/* Goto top of the entry block if LFN is exist */
 	if (res == FR_OK) {
 		do {
@@ -2732,6 +4730,13 @@ FRESULT dir_remove (	/* FR_OK:Succeeded, FR_DISK_ERR:A disk error */
 			if (FF_FS_EXFAT && fs->fs_type == FS_EXFAT) {	/* On the exFAT volume */
 				dp->dir[XDIR_Type] &= 0x7F;	/* Clear the entry InUse flag. */
 			} else {									/* On the FAT/FAT32 volume */
+#if FF_FS_NAMEINDEX
+				if ((dp->dir[DIR_Attr] & AM_MASK) == AM_LFN) {	/* Get the keys of the object */
+					h += ni_lfn_part(dp->dir);
+				} else {
+					hs = ni_sfn(dp->dir);
+				}
+#endif
 				dp->dir[DIR_Name] = DDEM;	/* Mark the entry 'deleted'. */
 			}
 			fs->wflag = 1;
@@ -2740,8 +4745,19 @@ FRESULT dir_remove (	/* FR_OK:Succeeded, FR_DISK_ERR:A disk error */
 		} while (res == FR_OK);
 		if (res == FR_NO_FILE) res = FR_INT_ERR;
 	}
+#if FF_FS_NAMEINDEX
+	if (res != FR_OK) {
+		ni_drop(fs, dp->obj.sclust);	/* The directory may have been partially updated */
+	} else if (hs) {
+		ni_del(fs, dp->obj.sclust, h ? h : 1, ent);	/* Remove the keys of the object */
+		ni_del(fs, dp->obj.sclust, hs, ent);
+	}
+#endif
 #else			/* Non LFN configuration */
 
+#if FF_FS_DIRHINT
+	dh_release(fs, dp->obj.sclust, dp->dptr);	/* The entry can be reused */
+#endif
 	res = move_window(fs, dp->sect);
 	if (res == FR_OK) {
 		dp->dir[DIR_Name] = DDEM;	/* Mark the entry 'deleted'.*/
@@ -3314,10 +5330,10 @@ int get_ldnumber (		/* Returns logical drive number (-1:invalid drive) */
 static
 BYTE check_fs (	/* 0:FAT, 1:exFAT, 2:Valid BS but not FAT, 3:Not a BS, 4:Disk error */
 	FATFS* fs,	/* Filesystem object */
-	DWORD sect	/* Sector# (lba) to load and check if it is an FAT-VBR or not */
+	LBA_t sect	/* Sector# (lba) to load and check if it is an FAT-VBR or not */
 )
 {
-	fs->wflag = 0; fs->winsect = 0xFFFFFFFF;		/* Invalidate window */
+	fs->wflag = 0; fs->winsect = (LBA_t)0 - 1;		/* Invalidate window */
 	if (move_window(fs, sect) != FR_OK) return 4;	/* Load boot record */
 
 	if (ld_word(fs->win + BS_55AA) != 0xAA55) return 3;	/* Check boot record signature (always placed here even if the sector size is >512) */
@@ -3357,7 +5373,8 @@ FRESULT find_volume (	/* FR_OK(0): successful, !=0: any error occurred */
 	int vol;
 #endif
 	DSTATUS stat;
-	DWORD bsect, fasize, tsect, sysect, nclst, szbfat, br[4];
+	DWORD fasize, tsect, sysect, nclst, szbfat, br[4];
+	LBA_t bsect;
 	WORD nrsv;
 #if !defined(FF_FS_POSIX_INTEGRATION) // OS_USE_MICRO_OS_PLUS
 	FATFS *fs;
@@ -3367,6 +5384,7 @@ FRESULT find_volume (	/* FR_OK(0): successful, !=0: any error occurred */
 
 #if defined(FF_FS_POSIX_INTEGRATION) // OS_USE_MICRO_OS_PLUS
   if (vol < 0) return FR_INVALID_DRIVE;
+	ENTER_FF(fs);						/* Lock the volume */
 #else
 	/* Get logical drive number */
 	*rfs = 0;
@@ -3413,6 +5431,21 @@ FRESULT find_volume (	/* FR_OK(0): successful, !=0: any error occurred */
 	if (disk_ioctl(fs->pdrv, GET_SECTOR_SIZE, &SS(fs)) != RES_OK) return FR_DISK_ERR;
 	if (SS(fs) > FF_MAX_SS || SS(fs) < FF_MIN_SS || (SS(fs) & (SS(fs) - 1))) return FR_DISK_ERR;
 #endif
+#if FF_SS_HEAP
+	ff_memfree(fs->win);				/* Allocate the sector window and the cache lines in the sector size of the medium */
+	fs->win = ff_memalloc(SS(fs) * (1 + FF_FS_WINCACHE));
+	if (!fs->win) return FR_NOT_ENOUGH_CORE;
+#if FF_FS_WINCACHE
+	for (i = 0; i < FF_FS_WINCACHE; i++) fs->wc_buf[i] = fs->win + SS(fs) * (i + 1);
+#endif
+#endif
+
+#if FF_FS_WINCACHE
+	for (i = 0; i < FF_FS_WINCACHE; i++) {	/* Invalidate the sector cache */
+		fs->wc_sect[i] = (LBA_t)0 - 1; fs->wc_flag[i] = 0;
+	}
+	fs->wc_clock = fs->wc_hit = fs->wc_miss = fs->wc_wback = 0;
+#endif
 
 	/* Find an FAT partition on the drive. Supports only generic partitioning rules, FDISK and SFD. */
 	bsect = 0;
@@ -3448,7 +5481,9 @@ FRESULT find_volume (	/* FR_OK(0): successful, !=0: any error occurred */
 		}
 
 		maxlba = ld_qword(fs->win + BPB_TotSecEx) + bsect;	/* Last LBA + 1 of the volume */
+#if !FF_LBA64
 		if (maxlba >= 0x100000000) return FR_NO_FILESYSTEM;	/* (It cannot be handled in 32-bit LBA) */
+#endif
 
 		fs->fsize = ld_dword(fs->win + BPB_FatSzEx);	/* Number of sectors per FAT */
 
@@ -3466,11 +5501,11 @@ FRESULT find_volume (	/* FR_OK(0): successful, !=0: any error occurred */
 		fs->volbase = bsect;
 		fs->database = bsect + ld_dword(fs->win + BPB_DataOfsEx);
 		fs->fatbase = bsect + ld_dword(fs->win + BPB_FatOfsEx);
-		if (maxlba < (QWORD)fs->database + nclst * fs->csize) return FR_NO_FILESYSTEM;	/* (Volume size must not be smaller than the size required) */
+		if (maxlba < (QWORD)fs->database + (QWORD)nclst * fs->csize) return FR_NO_FILESYSTEM;	/* (Volume size must not be smaller than the size required) */
 		fs->dirbase = ld_dword(fs->win + BPB_RootClusEx);
 
 		/* Check if bitmap location is in assumption (at the first cluster) */
-		if (move_window(fs, clst2sect(fs, fs->dirbase)) != FR_OK) return FR_DISK_ERR;
+		if (move_window(fs, clst2sect(fs, (DWORD)fs->dirbase)) != FR_OK) return FR_DISK_ERR;
 		for (i = 0; i < SS(fs); i += SZDIRE) {
 			if (fs->win[i] == 0x81 && ld_dword(fs->win + i + 20) == 2) break;	/* 81 entry with cluster #2? */
 		}
@@ -3561,11 +5596,45 @@ FRESULT find_volume (	/* FR_OK(0): successful, !=0: any error occurred */
 
 	fs->fs_type = fmt;		/* FAT sub-type */
 	fs->id = ++Fsid;		/* Volume mount ID */
+#if !FF_FS_READONLY && FF_FS_FREEMAP
+	fs->fm_shift = 0xFF;	/* Free cluster map is built on demand */
+#endif
+#if !FF_FS_READONLY && FF_FS_FREESCAN
+	fs->fsc_clst = fs->fsc_free = 0;	/* No free cluster scan in progress */
+#endif
+#if !FF_FS_READONLY && FF_FS_RESERVE
+	mem_set(fs->rsv_obj, 0, sizeof fs->rsv_obj);	/* No allocation window */
+#endif
+#if !FF_FS_READONLY && FF_FS_FREEEXT
+	fs->fx_stat = 0;		/* Free extent table is built on demand */
+	fs->fx_obj = 0;
+#endif
+#if !FF_FS_READONLY && FF_FS_DELALLOC
+	fs->da_clst = 0;		/* No cluster is promised to the delayed data */
+	fs->da_run = 0;
+#endif
+#if !FF_FS_READONLY && FF_FS_DIRHINT
+	mem_set(fs->dh_stamp, 0, sizeof fs->dh_stamp);	/* Nothing is known about the free entries */
+	fs->dh_clock = 0;
+#endif
+#if FF_FS_DCACHE
+	mem_set(fs->dc_stamp, 0, sizeof fs->dc_stamp);	/* Empty the directory entry cache */
+	fs->dc_clock = fs->dc_hit = fs->dc_miss = 0;
+#endif
+#if FF_FS_NAMEINDEX
+	mem_set(fs->ni_stamp, 0, sizeof fs->ni_stamp);	/* No directory is indexed */
+	fs->ni_clock = 0;
+#endif
 #if FF_USE_LFN == 1
 	fs->lfnbuf = LfnBuf;	/* Static LFN working buffer */
 #if FF_FS_EXFAT
 	fs->dirbuf = DirBuf;	/* Static directory block scratchpad buffer */
 #endif
+#elif FF_USE_LFN == 4
+	fs->lfnbuf = fs->lfnwork;	/* LFN working buffer of this volume */
+#if FF_FS_EXFAT
+	fs->dirbuf = fs->dirwork;	/* Directory block scratchpad buffer of this volume */
+#endif
 #endif
 #if FF_FS_RPATH != 0
 	fs->cdir = 0;			/* Initialize current directory */
@@ -3609,9 +5678,74 @@ FRESULT validate (	/* Returns FR_OK or FR_INVALID_OBJECT */
 		}
 #endif
 	}
-	*rfs = (res == FR_OK) ? obj->fs : 0;	/* Corresponding filesystem object */
-	return res;
+	*rfs = (res == FR_OK) ? obj->fs : 0;	/* Corresponding filesystem object */
+	return res;
+}
+
+
+
+
+#if FF_SS_HEAP && !FF_FS_TINY
+/*-----------------------------------------------------------------------*/
+/* Allocate/Release the sector buffers of a file                         */
+/*-----------------------------------------------------------------------*/
+/* The buffers are linked to the volume by a header ahead of them, so that
+/  the unmount releases the buffers of the files left open without access
+/  to the file objects, which may be gone by then. */
+
+#define FB_HDR	16	/* Size of the header (a link, padded to keep the buffers aligned) */
+
+static
+BYTE* fb_alloc (	/* Returns pointer to the buffers (0:not enough core) */
+	FATFS* fs,		/* Filesystem object */
+	UINT size		/* Size of the buffers */
+)
+{
+	BYTE *p = ff_memalloc(FB_HDR + size);
+
+
+	if (!p) return 0;
+	*(BYTE**)p = fs->fb_list;	/* Link it to the volume */
+	fs->fb_list = p;
+	return p + FB_HDR;
+}
+
+
+static
+void fb_free (
+	FATFS* fs,		/* Filesystem object */
+	BYTE* buf		/* Pointer to the buffers (0:none) */
+)
+{
+	BYTE **pp;
+
+
+	if (!buf) return;
+	buf -= FB_HDR;
+	for (pp = &fs->fb_list; *pp; pp = (BYTE**)*pp) {	/* Unlink it from the volume */
+		if (*pp == buf) {
+			*pp = *(BYTE**)buf;
+			ff_memfree(buf);
+			break;
+		}
+	}
+}
+
+
+static
+void fb_free_all (
+	FATFS* fs		/* Filesystem object to be unmounted */
+)
+{
+	BYTE *p;
+
+
+	while ((p = fs->fb_list) != 0) {
+		fs->fb_list = *(BYTE**)p;
+		ff_memfree(p);
+	}
 }
+#endif
 
 
 
@@ -3652,12 +5786,43 @@ FRESULT f_mount (
 #if defined(FF_FS_POSIX_INTEGRATION) // OS_USE_MICRO_OS_PLUS
 	if (pdrv == 0) {
 	    // Unmount.
+	    ENTER_FF(fs);
 	    fs->fs_type = 0;
 
 	    disk_deinitialize(fs->pdrv);
-	    res = FR_OK;
+#if FF_SS_HEAP && !FF_FS_TINY
+	    fb_free_all(fs);				/* Release the sector buffers of the files left open */
+#endif
+#if FF_SS_HEAP
+	    ff_memfree(fs->win);			/* Release the sector window */
+	    fs->win = 0;
+#endif
+#if FF_FS_REENTRANT						/* Discard sync object of the volume */
+	    unlock_fs(fs, FR_OK);
+	    if (!ff_del_syncobj(fs->sobj)) return FR_INT_ERR;
+#endif
+	    return FR_OK;
 	} else {
+#if FF_FS_REENTRANT						/* Create sync object for the volume */
+      if (!ff_cre_syncobj(vol, &fs->sobj)) return FR_INT_ERR;
+#endif
+#if FF_SS_HEAP && !FF_FS_TINY
+      fs->fb_list = 0;					/* No file is open */
+#endif
       res = find_volume(pdrv, vol, fs, 0);
+#if FF_SS_HEAP
+      if (res != FR_OK) {				/* Not mounted, no unmount will follow */
+        ff_memfree(fs->win);
+        fs->win = 0;
+      }
+#endif
+#if FF_FS_REENTRANT
+      if (res != FR_OK) {				/* Not mounted, no unmount will follow */
+        unlock_fs(fs, res);
+        ff_del_syncobj(fs->sobj);
+        return res;
+      }
+#endif
 	}
 #else
 	/* Get logical drive number */
@@ -3673,10 +5838,23 @@ FRESULT f_mount (
 		if (!ff_del_syncobj(cfs->sobj)) return FR_INT_ERR;
 #endif
 		cfs->fs_type = 0;				/* Clear old fs object */
+#if FF_SS_HEAP && !FF_FS_TINY
+		fb_free_all(cfs);				/* Release the sector buffers of its files left open */
+#endif
+#if FF_SS_HEAP
+		ff_memfree(cfs->win);			/* Release its sector window */
+		cfs->win = 0;
+#endif
 	}
 
 	if (fs) {
 		fs->fs_type = 0;				/* Clear new fs object */
+#if FF_SS_HEAP
+		if (fs != cfs) fs->win = 0;		/* The sector window is allocated at mount */
+#endif
+#if FF_SS_HEAP && !FF_FS_TINY
+		if (fs != cfs) fs->fb_list = 0;	/* No file is open */
+#endif
 #if FF_FS_REENTRANT						/* Create sync object for the new volume */
 		if (!ff_cre_syncobj((BYTE)vol, &fs->sobj)) return FR_INT_ERR;
 #endif
@@ -3713,7 +5891,8 @@ FRESULT f_open (
 	FATFS *fs;
 #endif
 #if !FF_FS_READONLY
-	DWORD dw, cl, bcs, clst, sc;
+	DWORD cl, bcs, clst;
+	LBA_t sc, dw;
 	FSIZE_t ofs;
 #endif
 	DEF_NAMBUF
@@ -3727,6 +5906,7 @@ FRESULT f_open (
 	res = find_volume(&path, &fs, mode);
 	if (res == FR_OK) {
 #else
+	ENTER_FF(fs);
 	{
 #endif
 	  dj.obj.fs = fs;
@@ -3832,6 +6012,21 @@ FRESULT f_open (
 		}
 #endif
 
+#if FF_SS_HEAP && !FF_FS_TINY
+		if (res == FR_OK) {		/* Allocate the sector buffers of the file in the sector size of the volume */
+			fp->buf = fb_alloc(fs, SS(fs) * (1 + FF_FS_READAHEAD + FF_FS_WRITEBEHIND + FF_FS_DELALLOC));
+			if (!fp->buf) res = FR_NOT_ENOUGH_CORE;
+#if FF_FS_READAHEAD
+			fp->ra_buf = fp->buf + SS(fs);
+#endif
+#if FF_FS_WRITEBEHIND
+			fp->wb_buf = fp->buf + SS(fs) * (1 + FF_FS_READAHEAD);
+#endif
+#if FF_FS_DELALLOC
+			fp->da_buf = fp->buf + SS(fs) * (1 + FF_FS_READAHEAD + FF_FS_WRITEBEHIND);
+#endif
+		}
+#endif
 		if (res == FR_OK) {
 #if FF_FS_EXFAT
 			if (fs->fs_type == FS_EXFAT) {
@@ -3847,6 +6042,15 @@ FRESULT f_open (
 			}
 #if FF_USE_FASTSEEK
 			fp->cltbl = 0;			/* Disable fast seek mode */
+#endif
+#if FF_FS_EXTCACHE
+			fp->ec_n = fp->ec_last = 0;	/* Empty extent cache */
+#endif
+#if FF_USE_EXTENT
+			fp->pin = 0;			/* Not pinned */
+#endif
+#if FF_USE_PREAD
+			fp->pos_fptr = 0;		/* Positional cursor at top of the file */
 #endif
 			fp->obj.fs = fs;	 	/* Validate the file object */
 			fp->obj.id = fs->id;
@@ -3854,9 +6058,20 @@ FRESULT f_open (
 			fp->err = 0;			/* Clear error flag */
 			fp->sect = 0;			/* Invalidate current data sector */
 			fp->fptr = 0;			/* Set file pointer top of the file */
+#if FF_FS_READAHEAD
+			fp->ra_cnt = 0;			/* Invalidate read-ahead buffer */
+			fp->ra_fptr = 0;		/* A read from top of the file is sequential */
+#endif
+#if FF_FS_WRITEBEHIND
+			fp->wb_cnt = 0;			/* Empty write-behind buffer */
+#endif
+#if FF_FS_DELALLOC
+			fp->da_cnt = 0;			/* Empty delay buffer */
+			fp->da_cut = 0;
+#endif
 #if !FF_FS_READONLY
 #if !FF_FS_TINY
-			mem_set(fp->buf, 0, FF_MAX_SS);	/* Clear sector buffer */
+			mem_set(fp->buf, 0, SS(fs));	/* Clear sector buffer */
 #endif
 			if ((mode & FA_SEEKEND) && fp->obj.objsize > 0) {	/* Seek to end of file if FA_OPEN_APPEND is specified */
 				fp->fptr = fp->obj.objsize;			/* Offset to seek */
@@ -3879,6 +6094,15 @@ FRESULT f_open (
 					}
 				}
 			}
+#if FF_FS_RESERVE
+			if (res == FR_OK && (mode & FA_WRITE)) rsv_reg(&fp->obj, 1);	/* Get a slot of the allocation window */
+#endif
+#endif
+#if FF_SS_HEAP && !FF_FS_TINY
+			if (res != FR_OK) {
+				fb_free(fs, fp->buf);
+				fp->buf = 0;
+			}
 #endif
 		}
 
@@ -3906,10 +6130,14 @@ FRESULT f_read (
 {
 	FRESULT res;
 	FATFS *fs;
-	DWORD clst, sect;
+	DWORD clst;
+	LBA_t sect;
 	FSIZE_t remain;
 	UINT rcnt, cc, csect;
 	BYTE *rbuff = (BYTE*)buff;
+#if FF_FS_READAHEAD
+	BYTE seq;
+#endif
 
 
 	*br = 0;	/* Clear read byte counter */
@@ -3918,6 +6146,15 @@ FRESULT f_read (
 	if (!(fp->flag & FA_READ)) LEAVE_FF(fs, FR_DENIED); /* Check access mode */
 	remain = fp->obj.objsize - fp->fptr;
 	if (btr > remain) btr = (UINT)remain;		/* Truncate btr by remaining bytes */
+#if FF_FS_READAHEAD
+	seq = (fp->fptr == fp->ra_fptr);			/* Does it continue the previous read? */
+#endif
+#if FF_FS_WRITEBEHIND
+	if (wb_flush(fp) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Data to be read can be in the write-behind buffer */
+#endif
+#if FF_FS_REENTRANT_FILE
+	unlock_fs(fs, FR_OK);	/* The data path needs only the file object, which is locked by the caller */
+#endif
 
 	for ( ;  btr;								/* Repeat until all data read */
 		btr -= rcnt, *br += rcnt, rbuff += rcnt, fp->fptr += rcnt) {
@@ -3933,22 +6170,51 @@ FRESULT f_read (
 					} else
 #endif
 					{
+#if FF_FS_REENTRANT_FILE
+						if (!lock_fs(fs)) ABORT_RD(fs, FR_TIMEOUT);	/* The FAT is read through the volume window */
+#endif
+#if FF_FS_EXTCACHE
+						clst = ec_next(fp, fp->clust, (DWORD)(fp->fptr / SS(fs) / fs->csize), 0);	/* Follow cluster chain via the extent cache */
+#else
 						clst = get_fat(&fp->obj, fp->clust);	/* Follow cluster chain on the FAT */
+#endif
+#if FF_FS_REENTRANT_FILE
+						unlock_fs(fs, FR_OK);
+#endif
 					}
 				}
-				if (clst < 2) ABORT(fs, FR_INT_ERR);
-				if (clst == 0xFFFFFFFF) ABORT(fs, FR_DISK_ERR);
+				if (clst < 2) ABORT_RD(fs, FR_INT_ERR);
+				if (clst == 0xFFFFFFFF) ABORT_RD(fs, FR_DISK_ERR);
 				fp->clust = clst;				/* Update current cluster */
 			}
 			sect = clst2sect(fs, fp->clust);	/* Get current sector */
-			if (sect == 0) ABORT(fs, FR_INT_ERR);
+			if (sect == 0) ABORT_RD(fs, FR_INT_ERR);
 			sect += csect;
 			cc = btr / SS(fs);					/* When remaining bytes >= sector size, */
 			if (cc > 0) {						/* Read maximum contiguous sectors directly */
 				if (csect + cc > fs->csize) {	/* Clip at cluster boundary */
 					cc = fs->csize - csect;
 				}
-				if (disk_read(fs->pdrv, rbuff, sect, cc) != RES_OK) ABORT(fs, FR_DISK_ERR);
+#if FF_FS_READAHEAD
+				if (sect - fp->ra_sect < fp->ra_cnt) {	/* Take the sectors from the read-ahead buffer if they are there */
+					if (cc > fp->ra_cnt - (sect - fp->ra_sect)) cc = fp->ra_cnt - (UINT)(sect - fp->ra_sect);
+					mem_cpy(rbuff, fp->ra_buf + (sect - fp->ra_sect) * SS(fs), SS(fs) * cc);
+				} else
+#endif
+				{
+#if FF_FS_MAXXFER
+					if (csect + cc == fs->csize && btr / SS(fs) > cc) {	/* Stretch it over the following contiguous clusters */
+#if FF_FS_REENTRANT_FILE
+						if (!lock_fs(fs)) ABORT_RD(fs, FR_TIMEOUT);	/* The FAT is read through the volume window */
+#endif
+						cc = xfer_run(fp, cc, btr / SS(fs), 0);
+#if FF_FS_REENTRANT_FILE
+						unlock_fs(fs, FR_OK);
+#endif
+					}
+#endif
+					if (disk_read(fs->pdrv, rbuff, sect, cc) != RES_OK) ABORT_RD(fs, FR_DISK_ERR);
+				}
 #if !FF_FS_READONLY && FF_FS_MINIMIZE <= 2		/* Replace one of the read sectors with cached data if it contains a dirty sector */
 #if FF_FS_TINY
 				if (fs->wflag && fs->winsect - sect < cc) {
@@ -3967,11 +6233,26 @@ FRESULT f_read (
 			if (fp->sect != sect) {			/* Load data sector if not in cache */
 #if !FF_FS_READONLY
 				if (fp->flag & FA_DIRTY) {		/* Write-back dirty sector cache */
-					if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);
+					if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) ABORT_RD(fs, FR_DISK_ERR);
 					fp->flag &= (BYTE)~FA_DIRTY;
 				}
 #endif
-				if (disk_read(fs->pdrv, fp->buf, sect, 1) != RES_OK)	ABORT(fs, FR_DISK_ERR);	/* Fill sector cache */
+#if FF_FS_READAHEAD
+				if (seq && sect - fp->ra_sect >= fp->ra_cnt) {	/* Read ahead up to the end of the cluster at sequential read */
+					cc = fs->csize - csect;
+					if (cc > FF_FS_READAHEAD) cc = FF_FS_READAHEAD;
+					if ((FSIZE_t)cc * SS(fs) > fp->obj.objsize - fp->fptr) cc = (UINT)((fp->obj.objsize - fp->fptr + SS(fs) - 1) / SS(fs));	/* Clip at end of the file */
+					if (cc > 1) {
+						fp->ra_cnt = 0;
+						if (disk_read(fs->pdrv, fp->ra_buf, sect, cc) != RES_OK) ABORT_RD(fs, FR_DISK_ERR);
+						fp->ra_sect = sect; fp->ra_cnt = cc;
+					}
+				}
+				if (sect - fp->ra_sect < fp->ra_cnt) {	/* Take the sector from the read-ahead buffer if it is there */
+					mem_cpy(fp->buf, fp->ra_buf + (sect - fp->ra_sect) * SS(fs), SS(fs));
+				} else
+#endif
+				if (disk_read(fs->pdrv, fp->buf, sect, 1) != RES_OK)	ABORT_RD(fs, FR_DISK_ERR);	/* Fill sector cache */
 			}
 #endif
 			fp->sect = sect;
@@ -3979,14 +6260,18 @@ FRESULT f_read (
 		rcnt = SS(fs) - (UINT)fp->fptr % SS(fs);	/* Number of bytes left in the sector */
 		if (rcnt > btr) rcnt = btr;					/* Clip it by btr if needed */
 #if FF_FS_TINY
-		if (move_window(fs, fp->sect) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Move sector window */
+		if (move_window(fs, fp->sect) != FR_OK) ABORT_RD(fs, FR_DISK_ERR);	/* Move sector window */
 		mem_cpy(rbuff, fs->win + fp->fptr % SS(fs), rcnt);	/* Extract partial sector */
 #else
 		mem_cpy(rbuff, fp->buf + fp->fptr % SS(fs), rcnt);	/* Extract partial sector */
 #endif
 	}
 
-	LEAVE_FF(fs, FR_OK);
+#if FF_FS_READAHEAD
+	fp->ra_fptr = fp->fptr;
+#endif
+
+	LEAVE_RD(fs, FR_OK);
 }
 
 
@@ -4006,7 +6291,8 @@ FRESULT f_write (
 {
 	FRESULT res;
 	FATFS *fs;
-	DWORD clst, sect;
+	DWORD clst;
+	LBA_t sect;
 	UINT wcnt, cc, csect;
 	const BYTE *wbuff = (const BYTE*)buff;
 
@@ -4015,14 +6301,51 @@ FRESULT f_write (
 	res = validate(&fp->obj, &fs);			/* Check validity of the file object */
 	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);	/* Check validity */
 	if (!(fp->flag & FA_WRITE)) LEAVE_FF(fs, FR_DENIED);	/* Check access mode */
+#if FF_FS_READAHEAD
+	fp->ra_cnt = 0;		/* Invalidate read-ahead buffer */
+#endif
 
 	/* Check fptr wrap-around (file size cannot reach 4 GiB at FAT volume) */
 	if ((!FF_FS_EXFAT || fs->fs_type != FS_EXFAT) && (DWORD)(fp->fptr + btw) < (DWORD)fp->fptr) {
 		btw = (UINT)(0xFFFFFFFF - (DWORD)fp->fptr);
 	}
+#if FF_FS_FREEEXT
+	cc = btw / ((UINT)fs->csize * SS(fs));	/* Number of clusters to be written */
+	if (fs->fx_obj != &fp->obj || fs->fx_want < cc) {	/* Let the allocator know the size of the write */
+		fs->fx_obj = &fp->obj; fs->fx_want = cc;
+	}
+#endif
 
 	for ( ;  btw;							/* Repeat until all data written */
 		btw -= wcnt, *bw += wcnt, wbuff += wcnt, fp->fptr += wcnt, fp->obj.objsize = (fp->fptr > fp->obj.objsize) ? fp->fptr : fp->obj.objsize) {
+#if FF_FS_DELALLOC
+		wcnt = da_room(fp, btw);			/* Number of bytes to be delayed */
+		if (wcnt == 0 && fp->da_cnt) {		/* Allocate the clusters for the delayed data if the buffer is full */
+			clst = (DWORD)fp->fptr;
+			res = da_flush(fp);
+			if (res == FR_DENIED) {			/* Disk full: the data cut off is not counted as written */
+				clst -= (DWORD)fp->fptr;
+				if (clst > *bw) fp->da_cut = 1;	/* The data of the previous writes was cut too */
+				*bw = (*bw > clst) ? *bw - clst : 0;
+				break;
+			}
+			if (res != FR_OK) ABORT(fs, res);
+			wcnt = da_room(fp, btw);
+		}
+		if (wcnt) {
+			if (fp->da_cnt == 0 && (fp->flag & FA_DIRTY)) {	/* Write-back sector cache before the data is delayed */
+#if FF_FS_WRITEBEHIND
+				if (wb_put(fp, fp->buf, fp->sect, 1, 1) != FR_OK) ABORT(fs, FR_DISK_ERR);
+#else
+				if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);
+#endif
+				fp->flag &= (BYTE)~FA_DIRTY;
+			}
+			mem_cpy(fp->da_buf + fp->da_cnt, wbuff, wcnt);	/* Put the data into the delay buffer */
+			fp->da_cnt += wcnt;
+			continue;
+		}
+#endif
 		if (fp->fptr % SS(fs) == 0) {		/* On the sector boundary? */
 			csect = (UINT)(fp->fptr / SS(fs)) & (fs->csize - 1);	/* Sector offset in the cluster */
 			if (csect == 0) {				/* On the cluster boundary? */
@@ -4038,7 +6361,11 @@ FRESULT f_write (
 					} else
 #endif
 					{
+#if FF_FS_EXTCACHE
+						clst = ec_next(fp, fp->clust, (DWORD)(fp->fptr / SS(fs) / fs->csize), 1);	/* Follow or stretch cluster chain via the extent cache */
+#else
 						clst = create_chain(&fp->obj, fp->clust);	/* Follow or stretch cluster chain on the FAT */
+#endif
 					}
 				}
 				if (clst == 0) break;		/* Could not allocate a new cluster (disk full) */
@@ -4051,7 +6378,11 @@ FRESULT f_write (
 			if (fs->winsect == fp->sect && sync_window(fs) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Write-back sector cache */
 #else
 			if (fp->flag & FA_DIRTY) {		/* Write-back sector cache */
+#if FF_FS_WRITEBEHIND
+				if (wb_put(fp, fp->buf, fp->sect, 1, csect == 0) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Collect it, flush at the cluster boundary */
+#else
 				if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);
+#endif
 				fp->flag &= (BYTE)~FA_DIRTY;
 			}
 #endif
@@ -4063,7 +6394,16 @@ FRESULT f_write (
 				if (csect + cc > fs->csize) {	/* Clip at cluster boundary */
 					cc = fs->csize - csect;
 				}
+#if FF_FS_MAXXFER
+				if (csect + cc == fs->csize && btw / SS(fs) > cc) {	/* Stretch it over the following contiguous clusters */
+					cc = xfer_run(fp, cc, btw / SS(fs), 1);
+				}
+#endif
+#if FF_FS_WRITEBEHIND
+				if (wb_put(fp, wbuff, sect, cc, ((csect + cc) & (fs->csize - 1)) == 0) != FR_OK) ABORT(fs, FR_DISK_ERR);
+#else
 				if (disk_write(fs->pdrv, wbuff, sect, cc) != RES_OK) ABORT(fs, FR_DISK_ERR);
+#endif
 #if FF_FS_MINIMIZE <= 2
 #if FF_FS_TINY
 				if (fs->winsect - sect < cc) {	/* Refill sector cache if it gets invalidated by the direct write */
@@ -4126,11 +6466,23 @@ FRESULT f_sync (
 	FATFS *fs;
 	DWORD tm;
 	BYTE *dir;
+#if FF_FS_DELALLOC
+	FRESULT dres = FR_OK;
+#endif
 
 
 	res = validate(&fp->obj, &fs);	/* Check validity of the file object */
 	if (res == FR_OK) {
 		if (fp->flag & FA_MODIFIED) {	/* Is there any change to the file? */
+#if FF_FS_DELALLOC
+			dres = da_flush(fp);	/* Allocate the clusters for the delayed data and write it */
+			if (dres != FR_OK && dres != FR_DENIED) LEAVE_FF(fs, dres);	/* The file cut by disk full is recorded as it is */
+			if (fp->da_cut) dres = FR_DENIED;	/* The cut found by f_write() is reported once */
+			fp->da_cut = 0;
+#endif
+#if FF_FS_WRITEBEHIND
+			if (wb_flush(fp) != FR_OK) LEAVE_FF(fs, FR_DISK_ERR);	/* Write the collected sectors */
+#endif
 #if !FF_FS_TINY
 			if (fp->flag & FA_DIRTY) {	/* Write-back cached data if needed */
 				if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) LEAVE_FF(fs, FR_DISK_ERR);
@@ -4191,6 +6543,9 @@ FRESULT f_sync (
 		}
 	}
 
+#if FF_FS_DELALLOC
+	if (res == FR_OK) res = dres;
+#endif
 	LEAVE_FF(fs, res);
 }
 
@@ -4209,25 +6564,44 @@ FRESULT f_close (
 {
 	FRESULT res;
 	FATFS *fs;
+#if FF_FS_DELALLOC
+	FRESULT dres;
+#endif
 
 #if !FF_FS_READONLY
 	res = f_sync(fp);					/* Flush cached data */
+#if FF_FS_DELALLOC
+	dres = res;
+	if (res == FR_DENIED) res = FR_OK;	/* The file cut by disk full has been recorded, close it anyway */
+#endif
 	if (res == FR_OK)
 #endif
 	{
 		res = validate(&fp->obj, &fs);	/* Lock volume */
 		if (res == FR_OK) {
+#if !FF_FS_READONLY && FF_FS_RESERVE
+			rsv_reg(&fp->obj, 0);		/* Release the allocation window */
+#endif
 #if FF_FS_LOCK != 0
 			res = dec_lock(fp->obj.lockid);		/* Decrement file open counter */
 			if (res == FR_OK) fp->obj.fs = 0;	/* Invalidate file object */
 #else
 			fp->obj.fs = 0;	/* Invalidate file object */
 #endif
+#if FF_SS_HEAP && !FF_FS_TINY
+			if (res == FR_OK) {			/* Release the sector buffers */
+				fb_free(fs, fp->buf);
+				fp->buf = 0;
+			}
+#endif
 #if FF_FS_REENTRANT
 			unlock_fs(fs, FR_OK);		/* Unlock volume */
 #endif
 		}
 	}
+#if FF_FS_DELALLOC
+	if (res == FR_OK) res = dres;		/* Report the cut */
+#endif
 	return res;
 }
 
@@ -4397,18 +6771,29 @@ FRESULT f_lseek (
 {
 	FRESULT res;
 	FATFS *fs;
-	DWORD clst, bcs, nsect;
+	DWORD clst, bcs;
+	LBA_t nsect;
 	FSIZE_t ifptr;
 #if FF_USE_FASTSEEK
-	DWORD cl, pcl, ncl, tcl, dsc, tlen, ulen, *tbl;
+	DWORD cl, pcl, ncl, tcl, tlen, ulen, *tbl;
+	LBA_t dsc;
+#endif
+#if FF_FS_EXTCACHE
+	DWORD ci, ecl;
 #endif
 
 	res = validate(&fp->obj, &fs);		/* Check validity of the file object */
 	if (res == FR_OK) res = (FRESULT)fp->err;
+#if FF_FS_DELALLOC
+	if (res == FR_OK) res = da_flush(fp);	/* The chain is followed over the delayed data */
+#endif
 #if FF_FS_EXFAT && !FF_FS_READONLY
 	if (res == FR_OK && fs->fs_type == FS_EXFAT) {
 		res = fill_last_frag(&fp->obj, fp->clust, 0xFFFFFFFF);	/* Fill last fragment on the FAT if needed */
 	}
+#endif
+#if FF_FS_WRITEBEHIND
+	if (res == FR_OK) res = wb_flush(fp);	/* The sector to be loaded can be in the write-behind buffer */
 #endif
 	if (res != FR_OK) LEAVE_FF(fs, res);
 
@@ -4494,6 +6879,17 @@ FRESULT f_lseek (
 				fp->clust = clst;
 			}
 			if (clst != 0) {
+#if FF_FS_EXTCACHE
+				ci = (DWORD)((fp->fptr + ofs - 1) / bcs);	/* Cluster offset of the destination */
+				ecl = ec_find(fp, &ci);						/* Get the nearest cached cluster at or before it */
+				if (ecl != 0 && (FSIZE_t)ci * bcs > fp->fptr) {	/* Jump to it if it is ahead of the start point */
+					ofs -= (FSIZE_t)ci * bcs - fp->fptr;
+					fp->fptr = (FSIZE_t)ci * bcs;
+					fp->clust = clst = ecl;
+				} else {
+					ci = (DWORD)(fp->fptr / bcs);			/* Cluster offset of the start point */
+				}
+#endif
 				while (ofs > bcs) {						/* Cluster following loop */
 					ofs -= bcs; fp->fptr += bcs;
 #if !FF_FS_READONLY
@@ -4502,14 +6898,22 @@ FRESULT f_lseek (
 							fp->obj.objsize = fp->fptr;
 							fp->flag |= FA_MODIFIED;
 						}
+#if FF_FS_EXTCACHE
+						clst = ec_next(fp, clst, ++ci, 1);	/* Follow chain with forced stretch */
+#else
 						clst = create_chain(&fp->obj, clst);	/* Follow chain with forced stretch */
+#endif
 						if (clst == 0) {				/* Clip file size in case of disk full */
 							ofs = 0; break;
 						}
 					} else
 #endif
 					{
+#if FF_FS_EXTCACHE
+						clst = ec_next(fp, clst, ++ci, 0);	/* Follow cluster chain if not in write mode */
+#else
 						clst = get_fat(&fp->obj, clst);	/* Follow cluster chain if not in write mode */
+#endif
 					}
 					if (clst == 0xFFFFFFFF) ABORT(fs, FR_DISK_ERR);
 					if (clst <= 1 || clst >= fs->n_fatent) ABORT(fs, FR_INT_ERR);
@@ -4546,6 +6950,137 @@ FRESULT f_lseek (
 
 
 
+#if FF_USE_PREAD
+/*-----------------------------------------------------------------------*/
+/* Read/Write File at a Given Offset                                     */
+/*-----------------------------------------------------------------------*/
+
+static
+FRESULT pos_switch (	/* FR_OK(0):succeeded, !=0:error */
+	FIL* fp,		/* Pointer to the file object */
+	FSIZE_t* fptr,	/* File pointer to switch to, the current one is returned */
+	DWORD* clst		/* Current cluster of the file pointer, the current one is returned */
+)
+{
+	FRESULT res = FR_OK;
+	FSIZE_t ofs;
+	DWORD cl;
+
+
+#if FF_FS_DELALLOC
+	if (fp->da_cnt) res = f_lseek(fp, fp->fptr);	/* The delayed data is written before the file pointer is saved */
+#endif
+#if FF_FS_EXFAT && !FF_FS_READONLY
+	if (res == FR_OK && fp->obj.n_frag) res = f_lseek(fp, fp->fptr);	/* The last fragment is filled on the FAT with the current cluster as its last one */
+#endif
+	ofs = fp->fptr; cl = fp->clust;
+	fp->fptr = *fptr; fp->clust = *clst;
+	*fptr = ofs; *clst = cl;
+	return res;
+}
+
+
+static
+FRESULT pos_restore (	/* FR_OK(0):succeeded, !=0:error */
+	FIL* fp,		/* Pointer to the file object */
+	LBA_t sect		/* Sector of the restored file pointer */
+)
+{
+	if (fp->sect == sect) return FR_OK;	/* The sector cache is still the one of the file pointer */
+#if !FF_FS_TINY
+	if (fp->fptr % SS(fp->obj.fs) == 0) return FR_OK;	/* The sector is loaded at the next access on the sector boundary */
+#if !FF_FS_READONLY
+	if (fp->flag & FA_DIRTY) {			/* Write-back dirty sector cache */
+		if (disk_write(fp->obj.fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) return FR_DISK_ERR;
+		fp->flag &= (BYTE)~FA_DIRTY;
+	}
+#endif
+#if FF_FS_WRITEBEHIND
+	if (wb_flush(fp) != FR_OK) return FR_DISK_ERR;	/* The sector to be loaded can be in the write-behind buffer */
+#endif
+	if (disk_read(fp->obj.fs->pdrv, fp->buf, sect, 1) != RES_OK) return FR_DISK_ERR;	/* Reload the sector cache */
+#endif
+	fp->sect = sect;
+	return FR_OK;
+}
+
+
+FRESULT f_pread (
+	FIL* fp, 	/* Pointer to the file object */
+	void* buff,	/* Pointer to data buffer */
+	UINT btr,	/* Number of bytes to read */
+	FSIZE_t ofs,	/* File offset to read from */
+	UINT* br	/* Pointer to number of bytes read */
+)
+{
+	FRESULT res, rres;
+	FATFS *fs;
+	FSIZE_t fptr;
+	DWORD clst;
+	LBA_t sect;
+	int eof;
+
+
+	*br = 0;	/* Clear read byte counter */
+	res = validate(&fp->obj, &fs);				/* Check validity of the file object */
+	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);	/* Check validity */
+	eof = (ofs >= fp->obj.objsize);
+#if FF_FS_REENTRANT
+	unlock_fs(fs, FR_OK);						/* The accesses below lock the volume by themselves */
+#endif
+	if (eof) return FR_OK;	/* Nothing to read (and do not let f_lseek() stretch the file) */
+	fptr = fp->pos_fptr; clst = fp->pos_clust;
+	res = pos_switch(fp, &fptr, &clst);			/* Seek from the positional cursor, saving the file pointer */
+	sect = fp->sect;
+	if (res == FR_OK) res = f_lseek(fp, ofs);
+	if (res == FR_OK) res = f_read(fp, buff, btr, br);
+	rres = pos_switch(fp, &fptr, &clst);		/* Restore the file pointer */
+	fp->pos_fptr = fptr; fp->pos_clust = clst;	/* Keep the positional cursor for the next access */
+	if (rres == FR_OK) rres = pos_restore(fp, sect);	/* and its sector in the sector cache if it was replaced */
+
+	return (res != FR_OK) ? res : rres;
+}
+
+
+#if !FF_FS_READONLY
+FRESULT f_pwrite (
+	FIL* fp,			/* Pointer to the file object */
+	const void* buff,	/* Pointer to the data to be written */
+	UINT btw,			/* Number of bytes to write */
+	FSIZE_t ofs,		/* File offset to write at */
+	UINT* bw			/* Pointer to number of bytes written */
+)
+{
+	FRESULT res, rres;
+	FATFS *fs;
+	FSIZE_t fptr;
+	DWORD clst;
+	LBA_t sect;
+
+
+	*bw = 0;	/* Clear write byte counter */
+	res = validate(&fp->obj, &fs);				/* Check validity of the file object */
+	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);	/* Check validity */
+#if FF_FS_REENTRANT
+	unlock_fs(fs, FR_OK);						/* The accesses below lock the volume by themselves */
+#endif
+	fptr = fp->pos_fptr; clst = fp->pos_clust;
+	res = pos_switch(fp, &fptr, &clst);			/* Seek from the positional cursor, saving the file pointer */
+	sect = fp->sect;
+	if (res == FR_OK) res = f_lseek(fp, ofs);	/* The file is stretched if the offset is beyond its end */
+	if (res == FR_OK) res = f_write(fp, buff, btw, bw);
+	rres = pos_switch(fp, &fptr, &clst);		/* Restore the file pointer */
+	fp->pos_fptr = fptr; fp->pos_clust = clst;	/* Keep the positional cursor for the next access */
+	if (rres == FR_OK) rres = pos_restore(fp, sect);	/* and its sector in the sector cache if it was replaced */
+
+	return (res != FR_OK) ? res : rres;
+}
+#endif
+
+#endif /* FF_USE_PREAD */
+
+
+
 #if FF_FS_MINIMIZE <= 1
 /*-----------------------------------------------------------------------*/
 /* Create a Directory Object                                             */
@@ -4575,6 +7110,7 @@ FRESULT f_opendir (
 	res = find_volume(&path, &fs, 0);
 	if (res == FR_OK) {
 #else
+	ENTER_FF(fs);
 	{
 #endif
 		dp->obj.fs = fs;
@@ -4783,6 +7319,7 @@ FRESULT f_stat (
 	res = find_volume(&path, &dj.obj.fs, 0);
 	if (res == FR_OK) {
 #else
+	ENTER_FF(fs);
   {
     dj.obj.fs = fs;
 #endif
@@ -4807,6 +7344,145 @@ FRESULT f_stat (
 /* Get Number of Free Clusters                                           */
 /*-----------------------------------------------------------------------*/
 
+static
+DWORD count_free (	/* Number of free clusters in the block */
+	BYTE fstype,	/* FS_FAT16, FS_FAT32 or FS_EXFAT */
+	const BYTE* p,	/* Top of the FAT entries (FAT16/32) or the allocation bitmap (exFAT) */
+	UINT n			/* Number of FAT entries or bitmap bits to be counted */
+)
+{
+	DWORD nf = 0, w;
+
+
+	switch (fstype) {
+	case FS_FAT16 :		/* Two entries in a word */
+		for ( ; n >= 2; n -= 2, p += 4) {
+			w = ld_dword(p);
+			w = (((w & 0x7FFF7FFF) + 0x7FFF7FFF) | w) & 0x80008000;	/* b15/b31: the entry is not zero */
+			nf += 2 - ((w >> 15) & 1) - (w >> 31);
+		}
+		if (n && ld_word(p) == 0) nf++;
+		break;
+
+	case FS_FAT32 :		/* An entry in a word */
+		for ( ; n >= 2; n -= 2, p += 8) {
+			if ((ld_dword(p) & 0x0FFFFFFF) == 0) nf++;
+			if ((ld_dword(p + 4) & 0x0FFFFFFF) == 0) nf++;
+		}
+		if (n && (ld_dword(p) & 0x0FFFFFFF) == 0) nf++;
+		break;
+#if FF_FS_EXFAT
+	case FS_EXFAT :		/* 32 bits in a word */
+		for ( ; n; n = (n >= 32) ? n - 32 : 0, p += 4) {
+			w = ld_dword(p);
+			if (n < 32) w |= 0xFFFFFFFF << n;	/* Mask out bits over the end of the bitmap */
+			w = ~w & 0xFFFFFFFF;	/* Count bits with zero */
+			if (w == 0) continue;
+			w -= (w >> 1) & 0x55555555;
+			w = (w & 0x33333333) + ((w >> 2) & 0x33333333);
+			w = (w + (w >> 4)) & 0x0F0F0F0F;
+			nf += ((w * 0x01010101) >> 24) & 0xFF;
+		}
+		break;
+#endif
+	}
+	return nf;
+}
+
+
+static
+FRESULT scan_free (	/* FR_OK(0):succeeded, !=0:error */
+	FATFS* fs,		/* Filesystem object */
+	DWORD* cur,		/* Cluster number to be scanned next (updated, 0:from the top) */
+	DWORD* nfree,	/* Number of free clusters found so far (updated) */
+	DWORD nsect		/* Number of FAT sectors to be scanned at most */
+)
+{
+	FRESULT res = FR_OK;
+	DWORD clst, stat;
+	LBA_t sect;
+	UINT i;
+	FFOBJID obj;
+#if defined(BULK_MAX)
+	UINT j, n, szb;
+	BYTE *ibuf = 0;
+#endif
+
+
+	if (fs->fs_type == FS_FAT12) {	/* FAT12: Scan bit field FAT entries */
+		if (*cur < 2) *cur = 2;
+		mem_set(&obj, 0, sizeof obj);
+		obj.fs = fs; i = 0;
+		while (*cur < fs->n_fatent) {
+			stat = get_fat(&obj, *cur);
+			if (stat == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }
+			if (stat == 1) { res = FR_INT_ERR; break; }
+			if (stat == 0) (*nfree)++;
+			(*cur)++;
+			if (++i == SS(fs) * 2 / 3) {	/* A sector worth of entries has been scanned */
+				i = 0;
+				if (--nsect == 0) break;
+			}
+		}
+	} else {	/* FAT16/32/exFAT: Scan the table in unit of sector */
+#if FF_FS_EXFAT
+		if (fs->fs_type == FS_EXFAT) {	/* exFAT: Scan allocation bitmap */
+			if (*cur < 2) *cur = 2;
+			i = SS(fs) * 8;				/* Bits per sector */
+			sect = fs->database + (*cur - 2) / i;	/* Assuming bitmap starts at cluster 2 */
+		} else
+#endif
+		{	/* FAT16/32: Scan WORD/DWORD FAT entries */
+			i = SS(fs) / ((fs->fs_type == FS_FAT16) ? 2 : 4);	/* Entries per sector */
+			sect = fs->fatbase + *cur / i;
+		}
+		clst = fs->n_fatent - *cur;		/* Number of entries (bits) left */
+		if (nsect > (clst + i - 1) / i) nsect = (clst + i - 1) / i;
+#if defined(BULK_MAX)	/* Quick table scan by using multi-sector read */
+		/* Allocate a temporary buffer fit to the sectors to be scanned */
+		for (szb = BULK_MAX; szb > SS(fs) && szb / 2 / SS(fs) >= nsect; szb /= 2) ;
+		for ( ; szb > SS(fs) && !(ibuf = BULK_ALLOC(fs, szb)); szb /= 2) ;
+		if (szb > SS(fs)) {		/* Buffer allocated? */
+			szb /= SS(fs);		/* Bytes -> Sectors */
+			res = sync_window(fs);	/* The table is read bypassing the window */
+#if FF_FS_WINCACHE
+			if (res == FR_OK) res = wc_sync(fs);
+#endif
+			while (res == FR_OK && nsect) {
+				n = (nsect < szb) ? nsect : szb;
+				if (disk_read(fs->pdrv, ibuf, sect, n) != RES_OK) {
+					res = FR_DISK_ERR;
+					break;
+				}
+				for (j = 0; j < n; j++) {
+					stat = (clst < i) ? clst : i;
+					*nfree += count_free(fs->fs_type, ibuf + j * SS(fs), (UINT)stat);
+					*cur += stat; clst -= stat;
+				}
+				sect += n; nsect -= n;
+			}
+			BULK_FREE(ibuf);
+		} else
+#endif
+		{
+			while (nsect) {	/* Count free clusters sector by sector */
+				res = move_window(fs, sect++);
+				if (res != FR_OK) break;
+				stat = (clst < i) ? clst : i;
+				*nfree += count_free(fs->fs_type, fs->win, (UINT)stat);
+				*cur += stat; clst -= stat;
+				nsect--;
+			}
+		}
+	}
+	if (res == FR_OK && *cur >= fs->n_fatent) {	/* Has the scan been completed? */
+		fs->free_clst = *nfree;	/* Now free_clst is valid */
+		fs->fsi_flag |= 1;		/* FAT32: FSInfo is to be updated */
+		*cur = *nfree = 0;
+	}
+	return res;
+}
+
 
 FRESULT f_getfree (
 #if defined(FF_FS_POSIX_INTEGRATION) // OS_USE_MICRO_OS_PLUS
@@ -4823,9 +7499,9 @@ FRESULT f_getfree (
 #if !defined(FF_FS_POSIX_INTEGRATION) // OS_USE_MICRO_OS_PLUS
 	FATFS *fs;
 #endif
-	DWORD nfree, clst, sect, stat;
-	UINT i;
-	FFOBJID obj;
+#if !FF_FS_FREESCAN
+	DWORD clst, nfree;
+#endif
 
 
 #if !defined(FF_FS_POSIX_INTEGRATION) // OS_USE_MICRO_OS_PLUS
@@ -4834,75 +7510,81 @@ FRESULT f_getfree (
 	if (res == FR_OK) {
 		*fatfs = fs;				/* Return ptr to the fs object */
 #else
+	ENTER_FF(fs);
 	{
 		res = FR_OK;
-		memset(&obj, 0, sizeof(obj));
 #endif
-		/* If free_clst is valid, return it without full FAT scan */
-		if (fs->free_clst <= fs->n_fatent - 2) {
-			*nclst = fs->free_clst;
-		} else {
-			/* Scan FAT to obtain number of free clusters */
-			nfree = 0;
-			if (fs->fs_type == FS_FAT12) {	/* FAT12: Scan bit field FAT entries */
-				clst = 2; obj.fs = fs;
-				do {
-					stat = get_fat(&obj, clst);
-					if (stat == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }
-					if (stat == 1) { res = FR_INT_ERR; break; }
-					if (stat == 0) nfree++;
-				} while (++clst < fs->n_fatent);
-			} else {
-#if FF_FS_EXFAT
-				if (fs->fs_type == FS_EXFAT) {	/* exFAT: Scan allocation bitmap */
-					BYTE bm;
-					UINT b;
-
-					clst = fs->n_fatent - 2;	/* Number of clusters */
-					sect = fs->database;		/* Assuming bitmap starts at cluster 2 */
-					i = 0;						/* Offset in the sector */
-					do {	/* Counts number of bits with zero in the bitmap */
-						if (i == 0) {
-							res = move_window(fs, sect++);
-							if (res != FR_OK) break;
-						}
-						for (b = 8, bm = fs->win[i]; b && clst; b--, clst--) {
-							if (!(bm & 1)) nfree++;
-							bm >>= 1;
-						}
-						i = (i + 1) % SS(fs);
-					} while (clst);
-				} else
+		/* If free_clst is not valid, obtain it with a full FAT scan */
+		if (fs->free_clst > fs->n_fatent - 2) {
+#if FF_FS_FREEMAP
+			if (fs->fs_type != FS_EXFAT) {	/* FAT12/16/32: Build the free cluster map in the same scan */
+				res = fm_build(fs);
+			} else
 #endif
-				{	/* FAT16/32: Scan WORD/DWORD FAT entries */
-					clst = fs->n_fatent;	/* Number of entries */
-					sect = fs->fatbase;		/* Top of the FAT */
-					i = 0;					/* Offset in the sector */
-					do {	/* Counts number of entries with zero in the FAT */
-						if (i == 0) {
-							res = move_window(fs, sect++);
-							if (res != FR_OK) break;
-						}
-						if (fs->fs_type == FS_FAT16) {
-							if (ld_word(fs->win + i) == 0) nfree++;
-							i += 2;
-						} else {
-							if ((ld_dword(fs->win + i) & 0x0FFFFFFF) == 0) nfree++;
-							i += 4;
-						}
-						i %= SS(fs);
-					} while (--clst);
-				}
+			{
+#if FF_FS_FREESCAN
+				res = scan_free(fs, &fs->fsc_clst, &fs->fsc_free, 0xFFFFFFFF);	/* Complete the scan in progress */
+#else
+				clst = nfree = 0;
+				res = scan_free(fs, &clst, &nfree, 0xFFFFFFFF);
+#endif
+			}
+		}
+		if (res == FR_OK) *nclst = fs->free_clst;	/* Return the free clusters */
+	}
+
+	LEAVE_FF(fs, res);
+}
+
+
+
+#if FF_FS_FREESCAN
+/*-----------------------------------------------------------------------*/
+/* Advance Free Cluster Scan                                             */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_scanfree (
+#if defined(FF_FS_POSIX_INTEGRATION) // OS_USE_MICRO_OS_PLUS
+	FATFS *fs,
+#else
+	const TCHAR* path,	/* Logical drive number */
+#endif
+	UINT nsect,			/* Number of FAT sectors to be scanned at most (0:only get the status) */
+	DWORD* nclst,		/* Pointer to a variable to return number of free clusters */
+	BYTE* exact			/* Pointer to a variable to return 1:*nclst is exact, 0:lower bound */
+)
+{
+	FRESULT res;
+#if !defined(FF_FS_POSIX_INTEGRATION) // OS_USE_MICRO_OS_PLUS
+	FATFS *fs;
+
+
+	res = find_volume(&path, &fs, 0);
+	if (res == FR_OK) {
+#else
+	ENTER_FF(fs);
+	{
+		res = FR_OK;
+#endif
+		if (fs->free_clst > fs->n_fatent - 2 && nsect) {	/* Scan the next sectors if the count is not valid */
+			res = scan_free(fs, &fs->fsc_clst, &fs->fsc_free, nsect);
+		}
+		if (res == FR_OK) {
+			if (fs->free_clst <= fs->n_fatent - 2) {
+				*nclst = fs->free_clst; *exact = 1;
+			} else {
+				*nclst = fs->fsc_free; *exact = 0;	/* Clusters found free so far */
 			}
-			*nclst = nfree;			/* Return the free clusters */
-			fs->free_clst = nfree;	/* Now free_clst is valid */
-			fs->fsi_flag |= 1;		/* FAT32: FSInfo is to be updated */
 		}
 	}
 
 	LEAVE_FF(fs, res);
 }
 
+#endif	/* FF_FS_FREESCAN */
+
+
+
 
 /*-----------------------------------------------------------------------*/
 /* Truncate File                                                         */
@@ -4920,8 +7602,20 @@ FRESULT f_truncate (
 	res = validate(&fp->obj, &fs);	/* Check validity of the file object */
 	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);
 	if (!(fp->flag & FA_WRITE)) LEAVE_FF(fs, FR_DENIED);	/* Check access mode */
+#if FF_USE_EXTENT
+	if (fp->pin && fp->fptr < fp->obj.objsize) LEAVE_FF(fs, FR_LOCKED);	/* The clusters can be in use through the extents */
+#endif
+#if FF_FS_READAHEAD
+	fp->ra_cnt = 0;		/* Invalidate read-ahead buffer */
+#endif
+#if FF_FS_WRITEBEHIND
+	if (wb_flush(fp) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Write the collected sectors before the clusters are freed */
+#endif
 
 	if (fp->fptr < fp->obj.objsize) {	/* Process when fptr is not on the eof */
+#if FF_FS_EXTCACHE
+		fp->ec_n = 0;			/* Empty extent cache */
+#endif
 		if (fp->fptr == 0) {	/* When set file size to zero, remove entire cluster chain */
 			res = remove_chain(&fp->obj, fp->obj.sclust, 0);
 			fp->obj.sclust = 0;
@@ -4936,6 +7630,9 @@ FRESULT f_truncate (
 		}
 		fp->obj.objsize = fp->fptr;	/* Set file size to current read/write point */
 		fp->flag |= FA_MODIFIED;
+#if FF_USE_PREAD
+		if (fp->pos_fptr > fp->fptr) fp->pos_fptr = 0;	/* The positional cursor can be on a removed cluster */
+#endif
 #if !FF_FS_TINY
 		if (res == FR_OK && (fp->flag & FA_DIRTY)) {
 			if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) {
@@ -4984,6 +7681,7 @@ FRESULT f_unlink (
 	res = find_volume(&path, &fs, FA_WRITE);
 	if (res == FR_OK) {
 #else
+	ENTER_FF(fs);
   {
 #endif
 		dj.obj.fs = fs;
@@ -5040,6 +7738,15 @@ FRESULT f_unlink (
 			}
 			if (res == FR_OK) {
 				res = dir_remove(&dj);			/* Remove the directory entry */
+#if FF_FS_DCACHE
+				if (dj.obj.attr & AM_DIR) dc_purge(fs, dclst);	/* The clusters of the removed directory can be reused */
+#endif
+#if FF_FS_NAMEINDEX
+				if (dj.obj.attr & AM_DIR) ni_drop(fs, dclst);
+#endif
+#if FF_FS_DIRHINT
+				if (dj.obj.attr & AM_DIR) dh_drop(fs, dclst);
+#endif
 				if (res == FR_OK && dclst != 0) {	/* Remove the cluster chain if exist */
 #if FF_FS_EXFAT
 					res = remove_chain(&obj, dclst, 0);
@@ -5078,6 +7785,7 @@ FRESULT f_mkdir (
   FATFS *fs;
 #endif
 	BYTE *dir;
+	FFOBJID sobj = {0};
 	DWORD dcl, pcl, tm;
 	DEF_NAMBUF
 
@@ -5087,6 +7795,7 @@ FRESULT f_mkdir (
 	res = find_volume(&path, &fs, FA_WRITE);
 	if (res == FR_OK) {
 #else
+	ENTER_FF(fs);
   {
 #endif
 		dj.obj.fs = fs;
@@ -5097,8 +7806,8 @@ FRESULT f_mkdir (
 			res = FR_INVALID_NAME;
 		}
 		if (res == FR_NO_FILE) {				/* Can create a new directory */
-			dcl = create_chain(&dj.obj, 0);		/* Allocate a cluster for the new directory table */
-			dj.obj.objsize = (DWORD)fs->csize * SS(fs);
+			sobj.fs = fs;						/* New object id to create a new chain (dj.obj is needed to register it) */
+			dcl = create_chain(&sobj, 0);		/* Allocate a cluster for the new directory table */
 			res = FR_OK;
 			if (dcl == 0) res = FR_DENIED;		/* No space to allocate a new cluster */
 			if (dcl == 1) res = FR_INT_ERR;
@@ -5128,8 +7837,8 @@ FRESULT f_mkdir (
 				if (fs->fs_type == FS_EXFAT) {	/* Initialize directory entry block */
 					st_dword(fs->dirbuf + XDIR_ModTime, tm);	/* Created time */
 					st_dword(fs->dirbuf + XDIR_FstClus, dcl);	/* Table start cluster */
-					st_dword(fs->dirbuf + XDIR_FileSize, (DWORD)dj.obj.objsize);	/* File size needs to be valid */
-					st_dword(fs->dirbuf + XDIR_ValidFileSize, (DWORD)dj.obj.objsize);
+					st_dword(fs->dirbuf + XDIR_FileSize, (DWORD)fs->csize * SS(fs));	/* File size needs to be valid */
+					st_dword(fs->dirbuf + XDIR_ValidFileSize, (DWORD)fs->csize * SS(fs));
 					fs->dirbuf[XDIR_GenFlags] = 3;				/* Initialize the object flag */
 					fs->dirbuf[XDIR_Attr] = AM_DIR;				/* Attribute */
 					res = store_xdir(&dj);
@@ -5146,7 +7855,7 @@ FRESULT f_mkdir (
 					res = sync_fs(fs);
 				}
 			} else {
-				remove_chain(&dj.obj, dcl, 0);		/* Could not register, remove cluster chain */
+				remove_chain(&sobj, dcl, 0);		/* Could not register, remove cluster chain */
 			}
 		}
 		FREE_NAMBUF();
@@ -5178,7 +7887,7 @@ FRESULT f_rename (
 	FATFS *fs;
 #endif
 	BYTE buf[FF_FS_EXFAT ? SZDIRE * 2 : SZDIRE], *dir;
-	DWORD dw;
+	LBA_t dw;
 	DEF_NAMBUF
 
 
@@ -5187,6 +7896,7 @@ FRESULT f_rename (
 	res = find_volume(&path_old, &fs, FA_WRITE);	/* Get logical drive of the old object */
 	if (res == FR_OK) {
 #else
+	ENTER_FF(fs);
   {
 #endif
 		djo.obj.fs = fs;
@@ -5310,6 +8020,7 @@ FRESULT f_chmod (
 	res = find_volume(&path, &fs, FA_WRITE);	/* Get logical drive */
   if (res == FR_OK) {
 #else
+	ENTER_FF(fs);
   {
 #endif
 		dj.obj.fs = fs;
@@ -5365,6 +8076,7 @@ FRESULT f_utime (
 	res = find_volume(&path, &fs, FA_WRITE);	/* Get logical drive */
 	if (res == FR_OK) {
 #else
+	ENTER_FF(fs);
 	{
 #endif
 		dj.obj.fs = fs;
@@ -5585,6 +8297,9 @@ FRESULT f_setlabel (
 					mem_cpy(dj.dir, dirvn, 11);	/* Change the volume label */
 				} else {
 					dj.dir[DIR_Name] = DDEM;	/* Remove the volume label */
+#if FF_FS_DIRHINT
+					dh_release(fs, 0, dj.dptr);
+#endif
 				}
 			}
 			fs->wflag = 1;
@@ -5634,6 +8349,9 @@ FRESULT f_expand (
 	FRESULT res;
 	FATFS *fs;
 	DWORD n, clst, stcl, scl, ncl, tcl, lclst;
+#if FF_FS_FREEMAP
+	BYTE wrap = 0;
+#endif
 
 
 	res = validate(&fp->obj, &fs);		/* Check validity of the file object */
@@ -5644,12 +8362,22 @@ FRESULT f_expand (
 #endif
 	n = (DWORD)fs->csize * SS(fs);	/* Cluster size */
 	tcl = (DWORD)(fsz / n) + ((fsz & (n - 1)) ? 1 : 0);	/* Number of clusters required */
+#if FF_FS_DELALLOC
+	if (opt && fs->free_clst <= fs->n_fatent - 2 && (fs->free_clst < fs->da_clst || tcl > fs->free_clst - fs->da_clst)) {
+		LEAVE_FF(fs, FR_DENIED);	/* The free clusters are promised to the delayed data */
+	}
+#endif
 	stcl = fs->last_clst; lclst = 0;
 	if (stcl < 2 || stcl >= fs->n_fatent) stcl = 2;
 
 #if FF_FS_EXFAT
 	if (fs->fs_type == FS_EXFAT) {
-		scl = find_bitmap(fs, stcl, tcl);			/* Find a contiguous cluster block */
+		scl = 0;
+#if FF_FS_FREEEXT
+		scl = fx_find(fs, tcl, 0);					/* Find the best-fit free run */
+#endif
+		if (scl == 0) scl = find_bitmap(fs, stcl, tcl);	/* Find a contiguous cluster block */
+		if (scl == 1) res = FR_INT_ERR;
 		if (scl == 0) res = FR_DENIED;				/* No contiguous cluster block was found */
 		if (scl == 0xFFFFFFFF) res = FR_DISK_ERR;
 		if (res == FR_OK) {	/* A contiguous free area is found */
@@ -5664,7 +8392,43 @@ FRESULT f_expand (
 #endif
 	{
 		scl = clst = stcl; ncl = 0;
-		for (;;) {	/* Find a contiguous cluster block */
+#if FF_FS_FREEEXT
+		n = fx_find(fs, tcl, 0);			/* Find the best-fit free run */
+		if (n == 1) res = FR_INT_ERR;
+		if (n == 0xFFFFFFFF) res = FR_DISK_ERR;
+		if (n >= 2 && n != 0xFFFFFFFF) {	/* Found, skip the search */
+			scl = n; ncl = tcl;
+		}
+#endif
+#if FF_FS_FREEMAP
+		if (res == FR_OK && ncl < tcl && fs->fm_shift == 0xFF) res = fm_build(fs);	/* Build the free cluster map if not yet */
+		while (res == FR_OK && ncl < tcl) {	/* Find a contiguous cluster block with the free cluster map */
+			if (ncl == 0) {		/* Skip the area in use */
+				clst = fm_next(fs, clst);
+				if (wrap && clst >= stcl) { res = FR_DENIED; break; }	/* No contiguous cluster? */
+				if (clst >= fs->n_fatent) { wrap = 1; clst = 2; continue; }
+				scl = clst;
+			}
+			if (fs->fm_shift == 0) {	/* Exact map: test the bit */
+				n = (fs->fm_map[clst / 32] >> (clst % 32) & 1) ? 0 : 2;
+			} else {
+				n = get_fat(&fp->obj, clst);
+			}
+			if (n == 1) { res = FR_INT_ERR; break; }
+			if (n == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }
+			clst++;
+			if (n == 0) {	/* Is it a free cluster? */
+				if (++ncl == tcl) break;	/* Break if a contiguous cluster block is found */
+			} else {
+				ncl = 0;					/* Not a free cluster */
+			}
+			if (clst >= fs->n_fatent) {		/* The block cannot wrap around */
+				if (wrap) { res = FR_DENIED; break; }
+				wrap = 1; clst = 2; ncl = 0;
+			}
+		}
+#else
+		while (res == FR_OK && ncl < tcl) {	/* Find a contiguous cluster block */
 			n = get_fat(&fp->obj, clst);
 			if (++clst >= fs->n_fatent) clst = 2;
 			if (n == 1) { res = FR_INT_ERR; break; }
@@ -5676,6 +8440,7 @@ FRESULT f_expand (
 			}
 			if (clst == stcl) { res = FR_DENIED; break; }	/* No contiguous cluster? */
 		}
+#endif
 		if (res == FR_OK) {	/* A contiguous free area is found */
 			if (opt) {		/* Allocate it now */
 				for (clst = scl, n = tcl; n; clst++, n--) {	/* Create a cluster chain on the FAT */
@@ -5693,6 +8458,9 @@ FRESULT f_expand (
 		fs->last_clst = lclst;		/* Set suggested start cluster to start next */
 		if (opt) {	/* Is it allocated now? */
 			fp->obj.sclust = scl;		/* Update object allocation information */
+#if FF_FS_EXTCACHE
+			fp->ec_n = 0;				/* Empty extent cache */
+#endif
 			fp->obj.objsize = fsz;
 			if (FF_FS_EXFAT) fp->obj.stat = 2;	/* Set status 'contiguous chain' */
 			fp->flag |= FA_MODIFIED;
@@ -5700,7 +8468,17 @@ FRESULT f_expand (
 				fs->free_clst -= tcl;
 				fs->fsi_flag |= 1;
 			}
+#if FF_FS_FREESCAN
+			if (scl < fs->fsc_clst) {	/* Update the free cluster scan in progress */
+				fs->fsc_free -= ((scl + tcl < fs->fsc_clst) ? scl + tcl : fs->fsc_clst) - scl;
+			}
+#endif
 		}
+#if FF_FS_FREEEXT
+		else {		/* The writes to the file go to the best-fit run for the prepared size */
+			fs->fx_obj = &fp->obj; fs->fx_want = tcl;
+		}
+#endif
 	}
 
 	LEAVE_FF(fs, res);
@@ -5715,6 +8493,132 @@ FRESULT f_expand (
 /* Forward Data to the Stream Directly                                   */
 /*-----------------------------------------------------------------------*/
 
+static
+FRESULT fwd_span (	/* FR_OK(0):succeeded, !=0:error */
+	FIL* fp,			/* Pointer to the file object */
+	UINT btf,			/* Number of bytes left to forward (>0) */
+	const BYTE** dbuf,	/* Pointer to return the data at the file pointer */
+	UINT* rcnt			/* Pointer to return number of bytes at *dbuf */
+)
+{
+	FATFS *fs = fp->obj.fs;
+	DWORD clst;
+	LBA_t sect;
+	UINT csect, ofs;
+#if FF_FS_READAHEAD
+	UINT cc;
+#endif
+
+
+	ofs = (UINT)fp->fptr % SS(fs);				/* Byte offset in the sector */
+	csect = (UINT)(fp->fptr / SS(fs) & (fs->csize - 1));	/* Sector offset in the cluster */
+	if (ofs == 0 && csect == 0) {				/* On the cluster boundary? */
+		if (fp->fptr == 0) {					/* On the top of the file? */
+			clst = fp->obj.sclust;
+		} else {
+#if FF_USE_FASTSEEK
+			if (fp->cltbl) {
+				clst = clmt_clust(fp, fp->fptr);	/* Get cluster# from the CLMT */
+			} else
+#endif
+			{
+#if FF_FS_REENTRANT_FILE
+				if (!lock_fs(fs)) return FR_TIMEOUT;	/* The FAT is read through the volume window */
+#endif
+#if FF_FS_EXTCACHE
+				clst = ec_next(fp, fp->clust, (DWORD)(fp->fptr / SS(fs) / fs->csize), 0);	/* Follow cluster chain via the extent cache */
+#else
+				clst = get_fat(&fp->obj, fp->clust);	/* Follow cluster chain on the FAT */
+#endif
+#if FF_FS_REENTRANT_FILE
+				unlock_fs(fs, FR_OK);
+#endif
+			}
+		}
+		if (clst < 2) return FR_INT_ERR;
+		if (clst == 0xFFFFFFFF) return FR_DISK_ERR;
+		fp->clust = clst;						/* Update current cluster */
+	}
+	sect = clst2sect(fs, fp->clust);			/* Get current data sector */
+	if (sect == 0) return FR_INT_ERR;
+	sect += csect;
+#if FF_FS_READAHEAD
+	if (ofs == 0 && btf > SS(fs) && sect - fp->ra_sect >= fp->ra_cnt) {	/* Load the following sectors up to the end of the cluster at a time */
+		cc = fs->csize - csect;
+		if (cc > FF_FS_READAHEAD) cc = FF_FS_READAHEAD;
+		if (cc > (btf + SS(fs) - 1) / SS(fs)) cc = (btf + SS(fs) - 1) / SS(fs);	/* Clip it by the data to be forwarded */
+		if (cc > 1) {
+#if !FF_FS_READONLY
+			if (fp->flag & FA_DIRTY) {		/* Write-back dirty sector cache */
+				if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) return FR_DISK_ERR;
+				fp->flag &= (BYTE)~FA_DIRTY;
+			}
+#endif
+			fp->ra_cnt = 0;
+			if (disk_read(fs->pdrv, fp->ra_buf, sect, cc) != RES_OK) return FR_DISK_ERR;
+			fp->ra_sect = sect; fp->ra_cnt = cc;
+		}
+	}
+	if (sect - fp->ra_sect < fp->ra_cnt) {		/* Forward the sectors in the read-ahead buffer at a time */
+		*dbuf = fp->ra_buf + (sect - fp->ra_sect) * SS(fs) + ofs;
+		*rcnt = (fp->ra_cnt - (UINT)(sect - fp->ra_sect)) * SS(fs) - ofs;
+		if (*rcnt > btf) *rcnt = btf;
+		return FR_OK;
+	}
+#endif
+#if FF_FS_TINY
+	if (move_window(fs, sect) != FR_OK) return FR_DISK_ERR;	/* Move sector window to the file data */
+	*dbuf = fs->win + ofs;
+#else
+	if (fp->sect != sect) {		/* Fill sector cache with file data */
+#if !FF_FS_READONLY
+		if (fp->flag & FA_DIRTY) {		/* Write-back dirty sector cache */
+			if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) return FR_DISK_ERR;
+			fp->flag &= (BYTE)~FA_DIRTY;
+		}
+#endif
+		if (disk_read(fs->pdrv, fp->buf, sect, 1) != RES_OK) return FR_DISK_ERR;
+	}
+	*dbuf = fp->buf + ofs;
+#endif
+	fp->sect = sect;
+	*rcnt = SS(fs) - ofs;						/* Number of bytes left in the sector */
+	if (*rcnt > btf) *rcnt = btf;				/* Clip it by btf if needed */
+	return FR_OK;
+}
+
+
+static
+FRESULT fwd_end (	/* FR_OK(0):succeeded, !=0:error */
+	FIL* fp			/* Pointer to the file object */
+)
+{
+#if FF_FS_READAHEAD
+	FATFS *fs = fp->obj.fs;
+	LBA_t sect;
+
+
+	if (fp->fptr % SS(fs) != 0) {	/* Stopped in the middle of a sector? */
+		sect = clst2sect(fs, fp->clust) + (UINT)(fp->fptr / SS(fs) & (fs->csize - 1));
+		if (sect != fp->sect && sect - fp->ra_sect < fp->ra_cnt) {	/* The sector at the file pointer is expected in the sector cache */
+#if !FF_FS_READONLY
+			if (fp->flag & FA_DIRTY) {		/* Write-back dirty sector cache */
+				if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) return FR_DISK_ERR;
+				fp->flag &= (BYTE)~FA_DIRTY;
+			}
+#endif
+			mem_cpy(fp->buf, fp->ra_buf + (sect - fp->ra_sect) * SS(fs), SS(fs));
+			fp->sect = sect;
+		}
+	}
+	fp->ra_fptr = fp->fptr;		/* A read from here is sequential */
+#else
+	(void)fp;
+#endif
+	return FR_OK;
+}
+
+
 FRESULT f_forward (
 	FIL* fp, 						/* Pointer to the file object */
 	UINT (*func)(const BYTE*,UINT),	/* Pointer to the streaming function */
@@ -5724,60 +8628,314 @@ FRESULT f_forward (
 {
 	FRESULT res;
 	FATFS *fs;
-	DWORD clst, sect;
 	FSIZE_t remain;
-	UINT rcnt, csect;
-	BYTE *dbuf;
+	UINT rcnt;
+	const BYTE *dbuf;
 
 
 	*bf = 0;	/* Clear transfer byte counter */
 	res = validate(&fp->obj, &fs);		/* Check validity of the file object */
 	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);
 	if (!(fp->flag & FA_READ)) LEAVE_FF(fs, FR_DENIED);	/* Check access mode */
+#if FF_FS_WRITEBEHIND
+	if (wb_flush(fp) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Data to be forwarded can be in the write-behind buffer */
+#endif
+#if FF_FS_REENTRANT_FILE
+	unlock_fs(fs, FR_OK);	/* The data path needs only the file object, which is locked by the caller */
+#endif
 
 	remain = fp->obj.objsize - fp->fptr;
 	if (btf > remain) btf = (UINT)remain;			/* Truncate btf by remaining bytes */
 
 	for ( ;  btf && (*func)(0, 0);					/* Repeat until all data transferred or stream goes busy */
 		fp->fptr += rcnt, *bf += rcnt, btf -= rcnt) {
-		csect = (UINT)(fp->fptr / SS(fs) & (fs->csize - 1));	/* Sector offset in the cluster */
-		if (fp->fptr % SS(fs) == 0) {				/* On the sector boundary? */
-			if (csect == 0) {						/* On the cluster boundary? */
-				clst = (fp->fptr == 0) ?			/* On the top of the file? */
-					fp->obj.sclust : get_fat(&fp->obj, fp->clust);
-				if (clst <= 1) ABORT(fs, FR_INT_ERR);
-				if (clst == 0xFFFFFFFF) ABORT(fs, FR_DISK_ERR);
-				fp->clust = clst;					/* Update current cluster */
-			}
-		}
-		sect = clst2sect(fs, fp->clust);			/* Get current data sector */
-		if (sect == 0) ABORT(fs, FR_INT_ERR);
-		sect += csect;
-#if FF_FS_TINY
-		if (move_window(fs, sect) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Move sector window to the file data */
-		dbuf = fs->win;
-#else
-		if (fp->sect != sect) {		/* Fill sector cache with file data */
+		res = fwd_span(fp, btf, &dbuf, &rcnt);		/* Get the data at the file pointer */
+		if (res != FR_OK) ABORT_RD(fs, res);
+		rcnt = (*func)(dbuf, rcnt);					/* Forward the file data */
+		if (rcnt == 0) ABORT_RD(fs, FR_INT_ERR);
+	}
+	res = fwd_end(fp);
+	if (res != FR_OK) ABORT_RD(fs, res);
+
+	LEAVE_RD(fs, FR_OK);
+}
+
+
+
+
+FRESULT f_stream (
+	FIL* fp, 								/* Pointer to the file object */
+	UINT (*func)(void*,const BYTE*,UINT),	/* Pointer to the streaming function */
+	void* arg,								/* Argument passed to the streaming function */
+	UINT btf,								/* Number of bytes to forward */
+	UINT* bf								/* Pointer to number of bytes forwarded */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	FSIZE_t remain;
+	DWORD clst;
+	UINT rcnt, n;
+	const BYTE *dbuf;
+
+
+	*bf = 0;	/* Clear transfer byte counter */
+	res = validate(&fp->obj, &fs);		/* Check validity of the file object */
+	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);
+	if (!(fp->flag & FA_READ)) LEAVE_FF(fs, FR_DENIED);	/* Check access mode */
+#if FF_FS_WRITEBEHIND
+	if (wb_flush(fp) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Data to be forwarded can be in the write-behind buffer */
+#endif
+#if FF_FS_REENTRANT_FILE
+	unlock_fs(fs, FR_OK);	/* The data path needs only the file object, which is locked by the caller */
+#endif
+
+	remain = fp->obj.objsize - fp->fptr;
+	if (btf > remain) btf = (UINT)remain;			/* Truncate btf by remaining bytes */
+
+	while (btf) {									/* Repeat until all data transferred or stream goes busy */
+		clst = fp->clust;
+		res = fwd_span(fp, btf, &dbuf, &rcnt);		/* Get the data at the file pointer */
+		if (res != FR_OK) ABORT_RD(fs, res);
+		n = (*func)(arg, dbuf, rcnt);				/* Forward the file data */
+		if (n > rcnt) ABORT_RD(fs, FR_INT_ERR);
+		if (n == 0) fp->clust = clst;				/* Nothing taken: the file pointer stays in the previous cluster */
+		fp->fptr += n; *bf += n; btf -= n;
+		if (n < rcnt) break;						/* The stream took a part of the data, it is busy */
+	}
+	res = fwd_end(fp);
+	if (res != FR_OK) ABORT_RD(fs, res);
+
+	LEAVE_RD(fs, FR_OK);
+}
+#endif /* FF_USE_FORWARD */
+
+
+
+#if FF_USE_EXTENT
+/*-----------------------------------------------------------------------*/
+/* Get the Sectors Holding the File Data                                 */
+/*-----------------------------------------------------------------------*/
+
+static
+void put_extent (
+	FATFS* fs,		/* Filesystem object */
+	FEXTENT* ext,	/* Extent to be filled */
+	DWORD clst,		/* Top cluster of the run */
+	DWORD ci,		/* Cluster offset of the run in the file */
+	DWORD ncl,		/* Number of clusters in the run */
+	FSIZE_t fs0,	/* First file sector of the data */
+	FSIZE_t fs1		/* Last file sector of the data */
+)
+{
+	FSIZE_t s0 = (FSIZE_t)ci * fs->csize, s1 = s0 + (FSIZE_t)ncl * fs->csize - 1;
+
+
+	if (s0 < fs0) s0 = fs0;		/* Clip the run by the data */
+	if (s1 > fs1) s1 = fs1;
+	ext->ofs = s0 * SS(fs);
+	ext->sect = clst2sect(fs, clst) + (LBA_t)(s0 - (FSIZE_t)ci * fs->csize);
+	ext->count = (LBA_t)(s1 - s0 + 1);
+}
+
+
+FRESULT f_getextent (
+	FIL* fp,		/* Pointer to the file object */
+	FSIZE_t ofs,	/* File offset of the data */
+	FSIZE_t len,	/* Number of bytes of the data */
+	FEXTENT* ext,	/* Pointer to the extent array to return */
+	UINT n,			/* Number of items in the extent array */
+	UINT* ne		/* Pointer to number of extents returned */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	DWORD clst, ncl, ci, ce, c, rcl, rci;
+	FSIZE_t fs0, fs1;
+	UINT i = 0;
+
+
+	*ne = 0;
+	res = validate(&fp->obj, &fs);		/* Check validity of the file object */
+	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);
+	if (n == 0) LEAVE_FF(fs, FR_INVALID_PARAMETER);
+	if (fp->pin == 0xFFFF) LEAVE_FF(fs, FR_TOO_MANY_OPEN_FILES);
+#if FF_FS_READAHEAD
+	fp->ra_cnt = 0;		/* The data can be modified through the extents */
+#endif
 #if !FF_FS_READONLY
-			if (fp->flag & FA_DIRTY) {		/* Write-back dirty sector cache */
-				if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);
-				fp->flag &= (BYTE)~FA_DIRTY;
+#if FF_FS_DELALLOC
+	res = da_flush(fp);	/* The extents of the delayed data are not allocated yet */
+	if (res != FR_OK && res != FR_DENIED) ABORT(fs, res);
+	res = FR_OK;
+#endif
+#if FF_FS_WRITEBEHIND
+	if (wb_flush(fp) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Data in the extents can be in the write-behind buffer */
+#endif
+#if !FF_FS_TINY
+	if (fp->flag & FA_DIRTY) {	/* Write-back dirty sector cache */
+		if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);
+		fp->flag &= (BYTE)~FA_DIRTY;
+	}
+#endif
+#if FF_FS_EXFAT
+	if (fs->fs_type == FS_EXFAT) {
+		res = fill_last_frag(&fp->obj, fp->clust, 0xFFFFFFFF);	/* The growing edge of the chain is followed on the FAT */
+		if (res != FR_OK) ABORT(fs, res);
+	}
+#endif
+#endif
+
+	if (ofs > fp->obj.objsize) ofs = fp->obj.objsize;	/* Clip the data at the end of the file */
+	if (len > fp->obj.objsize - ofs) len = fp->obj.objsize - ofs;
+	if (len > 0) {
+		fs0 = ofs / SS(fs);						/* First and last file sector of the data */
+		fs1 = (ofs + len - 1) / SS(fs);
+		ci = (DWORD)(fs0 / fs->csize);			/* First and last cluster offset of the data */
+		ce = (DWORD)(fs1 / fs->csize);
+#if FF_FS_EXFAT
+		if (fs->fs_type == FS_EXFAT && fp->obj.stat == 2) {	/* Contiguous file: a single extent */
+			put_extent(fs, ext, fp->obj.sclust + ci, ci, ce - ci + 1, fs0, fs1);
+			i = 1;
+		} else
+#endif
+		{
+			c = 0; clst = fp->obj.sclust;		/* Start at top of the file, */
+			if (fp->fptr > 0 && (DWORD)((fp->fptr - 1) / SS(fs) / fs->csize) <= ci) {	/* or at current cluster if it is on the way */
+				c = (DWORD)((fp->fptr - 1) / SS(fs) / fs->csize);
+				clst = fp->clust;
+			}
+#if FF_FS_EXTCACHE
+			rci = ci;
+			ncl = ec_find(fp, &rci);			/* Or at the nearest cached cluster */
+			if (ncl != 0 && rci >= c) {
+				c = rci; clst = ncl;
 			}
 #endif
-			if (disk_read(fs->pdrv, fp->buf, sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);
+			if (clst < 2 || clst >= fs->n_fatent) ABORT(fs, FR_INT_ERR);
+			rcl = rci = 0;
+			for (;;) {
+				if (c >= ci) {		/* In the data */
+					if (rcl != 0 && clst == rcl + (c - rci)) {	/* Contiguous to the run */
+						if (c == ce) break;
+					} else {
+						if (rcl != 0) {		/* Put the run to the array */
+							put_extent(fs, &ext[i], rcl, rci, c - rci, fs0, fs1);
+							if (++i == n) break;	/* No room for more extents */
+						}
+						rcl = clst; rci = c;	/* Start a new run */
+						if (c == ce) break;
+					}
+				}
+#if FF_USE_FASTSEEK
+				if (fp->cltbl) {
+					ncl = clmt_clust(fp, (FSIZE_t)(c + 1) * fs->csize * SS(fs));	/* Get cluster# from the CLMT */
+				} else
+#endif
+				{
+#if FF_FS_EXTCACHE
+					ncl = ec_next(fp, clst, c + 1, 0);	/* Follow the chain via the extent cache */
+#else
+					ncl = get_fat(&fp->obj, clst);		/* Follow the chain */
+#endif
+				}
+				if (ncl == 0xFFFFFFFF) ABORT(fs, FR_DISK_ERR);
+				if (ncl < 2 || ncl >= fs->n_fatent) ABORT(fs, FR_INT_ERR);
+				clst = ncl; c++;
+			}
+			if (i < n) put_extent(fs, &ext[i++], rcl, rci, ce - rci + 1, fs0, fs1);	/* Put the last run */
+		}
+	}
+	*ne = i;
+	fp->pin++;		/* Pin the file until f_putextent() */
+
+	LEAVE_FF(fs, FR_OK);
+}
+
+
+
+
+FRESULT f_putextent (
+	FIL* fp		/* Pointer to the file object */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+
+
+	res = validate(&fp->obj, &fs);		/* Check validity of the file object */
+	if (res == FR_OK) {
+		if (fp->pin == 0) {
+			res = FR_INVALID_PARAMETER;	/* Not pinned */
+		} else {
+			fp->pin--;
 		}
-		dbuf = fp->buf;
+	}
+
+	LEAVE_FF(fs, res);
+}
+
+#endif /* FF_USE_EXTENT */
+
+
+
+#if FF_FS_RESERVE || FF_USE_EXTENT
+/*-----------------------------------------------------------------------*/
+/* Get the Number of Fragments of the File                               */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_getfrag (
+	FIL* fp,		/* Pointer to the file object */
+	DWORD* nfrag	/* Pointer to the number of fragments to return */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	DWORD clst, ncl, c, ce;
+
+
+	*nfrag = 0;
+	res = validate(&fp->obj, &fs);		/* Check validity of the file object */
+	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);
+#if FF_FS_DELALLOC
+	res = da_flush(fp);	/* The clusters of the delayed data are not allocated yet */
+	if (res != FR_OK && res != FR_DENIED) ABORT(fs, res);
+	res = FR_OK;
 #endif
-		fp->sect = sect;
-		rcnt = SS(fs) - (UINT)fp->fptr % SS(fs);	/* Number of bytes left in the sector */
-		if (rcnt > btf) rcnt = btf;					/* Clip it by btr if needed */
-		rcnt = (*func)(dbuf + ((UINT)fp->fptr % SS(fs)), rcnt);	/* Forward the file data */
-		if (rcnt == 0) ABORT(fs, FR_INT_ERR);
+#if FF_FS_EXFAT && !FF_FS_READONLY
+	if (fs->fs_type == FS_EXFAT) {
+		res = fill_last_frag(&fp->obj, fp->clust, 0xFFFFFFFF);	/* The growing edge of the chain is followed on the FAT */
+		if (res != FR_OK) ABORT(fs, res);
+	}
+#endif
+
+	if (fp->obj.objsize > 0) {
+		*nfrag = 1;
+#if FF_FS_EXFAT
+		if (fs->fs_type != FS_EXFAT || fp->obj.stat != 2)	/* Contiguous file has a fragment */
+#endif
+		{
+			ce = (DWORD)((fp->obj.objsize - 1) / SS(fs) / fs->csize);	/* Last cluster offset of the data */
+			clst = fp->obj.sclust;
+			if (clst < 2 || clst >= fs->n_fatent) ABORT(fs, FR_INT_ERR);
+			for (c = 0; c < ce; c++) {	/* Follow the chain and count the breaks */
+#if FF_FS_EXTCACHE
+				ncl = ec_next(fp, clst, c + 1, 0);
+#else
+				ncl = get_fat(&fp->obj, clst);
+#endif
+				if (ncl == 0xFFFFFFFF) ABORT(fs, FR_DISK_ERR);
+				if (ncl < 2 || ncl >= fs->n_fatent) ABORT(fs, FR_INT_ERR);
+				if (ncl != clst + 1) (*nfrag)++;
+				clst = ncl;
+			}
+		}
 	}
 
 	LEAVE_FF(fs, FR_OK);
 }
-#endif /* FF_USE_FORWARD */
+
+#endif /* FF_FS_RESERVE || FF_USE_EXTENT */
 
 
 
@@ -5809,17 +8967,21 @@ FRESULT f_mkfs (
   BYTE fmt, sys, *buf, *pte, pdrv, part;
 #endif
 	WORD ss;	/* Sector size */
-	DWORD szb_buf, sz_buf, sz_blk, n_clst, pau, sect, nsect, n;
-	DWORD b_vol, b_fat, b_data;				/* Base LBA for volume, fat, data */
-	DWORD sz_vol, sz_rsv, sz_fat, sz_dir;	/* Size for volume, fat, dir, data */
+	DWORD szb_buf, sz_buf, sz_blk, n_clst, pau, nsect, n;
+	LBA_t b_vol, b_fat, b_data, sect;		/* Base LBA for volume, fat, data */
+	LBA_t sz_vol;							/* Size for volume */
+	DWORD sz_rsv, sz_fat, sz_dir;			/* Size for fat, dir, data */
 	UINT i;
 #if !defined(FF_FS_POSIX_INTEGRATION) // OS_USE_MICRO_OS_PLUS
 	int vol;
 #endif
 	DSTATUS stat;
-#if FF_USE_TRIM || FF_FS_EXFAT
+#if FF_FS_EXFAT
 	DWORD tbl[3];
 #endif
+#if FF_USE_TRIM
+	LBA_t rt[2];
+#endif
 
 #if defined(FF_FS_POSIX_INTEGRATION) // OS_USE_MICRO_OS_PLUS
 
@@ -5875,6 +9037,9 @@ FRESULT f_mkfs (
 		b_vol = (opt & FM_SFD) ? 0 : 63;		/* Volume start sector */
 		if (sz_vol < b_vol) LEAVE_MKFS(FR_MKFS_ABORTED);
 		sz_vol -= b_vol;						/* Volume size */
+#if FF_LBA64
+		if (b_vol && b_vol + sz_vol > 0x100000000) LEAVE_MKFS(FR_MKFS_ABORTED);	/* The partition cannot be described in the MBR (use FM_SFD) */
+#endif
 	}
 	if (sz_vol < 128) LEAVE_MKFS(FR_MKFS_ABORTED);	/* Check if volume size is >=128s */
 
@@ -5904,8 +9069,8 @@ FRESULT f_mkfs (
 
 		if (sz_vol < 0x1000) LEAVE_MKFS(FR_MKFS_ABORTED);	/* Too small volume? */
 #if FF_USE_TRIM
-		tbl[0] = b_vol; tbl[1] = b_vol + sz_vol - 1;	/* Inform the device the volume area may be erased */
-		disk_ioctl(pdrv, CTRL_TRIM, tbl);
+		rt[0] = b_vol; rt[1] = b_vol + sz_vol - 1;	/* Inform the device the volume area may be erased */
+		disk_ioctl(pdrv, CTRL_TRIM, rt);
 #endif
 		/* Determine FAT location, data location and number of clusters */
 		if (au == 0) {	/* au auto-selection */
@@ -5915,11 +9080,11 @@ FRESULT f_mkfs (
 		}
 		b_fat = b_vol + 32;										/* FAT start at offset 32 */
 		sz_fat = ((sz_vol / au + 2) * 4 + ss - 1) / ss;			/* Number of FAT sectors */
-		b_data = (b_fat + sz_fat + sz_blk - 1) & ~(sz_blk - 1);	/* Align data area to the erase block boundary */
+		b_data = (b_fat + sz_fat + sz_blk - 1) & ~((LBA_t)sz_blk - 1);	/* Align data area to the erase block boundary */
 		if (b_data >= sz_vol / 2) LEAVE_MKFS(FR_MKFS_ABORTED);	/* Too small volume? */
-		n_clst = (sz_vol - (b_data - b_vol)) / au;				/* Number of clusters */
+		if ((sz_vol - (b_data - b_vol)) / au > MAX_EXFAT) LEAVE_MKFS(FR_MKFS_ABORTED);	/* Too many clusters? */
+		n_clst = (DWORD)((sz_vol - (b_data - b_vol)) / au);	/* Number of clusters */
 		if (n_clst <16) LEAVE_MKFS(FR_MKFS_ABORTED);			/* Too few clusters? */
-		if (n_clst > MAX_EXFAT) LEAVE_MKFS(FR_MKFS_ABORTED);	/* Too many clusters? */
 
 		szb_bit = (n_clst + 7) / 8;						/* Size of allocation bitmap */
 		tbl[0] = (szb_bit + au * ss - 1) / (au * ss);	/* Number of allocation bitmap clusters */
@@ -6019,11 +9184,11 @@ FRESULT f_mkfs (
 			/* Main record (+0) */
 			mem_set(buf, 0, ss);
 			mem_cpy(buf + BS_JmpBoot, "\xEB\x76\x90" "EXFAT   ", 11);	/* Boot jump code (x86), OEM name */
-			st_dword(buf + BPB_VolOfsEx, b_vol);					/* Volume offset in the physical drive [sector] */
-			st_dword(buf + BPB_TotSecEx, sz_vol);					/* Volume size [sector] */
-			st_dword(buf + BPB_FatOfsEx, b_fat - b_vol);			/* FAT offset [sector] */
+			st_qword(buf + BPB_VolOfsEx, b_vol);					/* Volume offset in the physical drive [sector] */
+			st_qword(buf + BPB_TotSecEx, sz_vol);					/* Volume size [sector] */
+			st_dword(buf + BPB_FatOfsEx, (DWORD)(b_fat - b_vol));	/* FAT offset [sector] */
 			st_dword(buf + BPB_FatSzEx, sz_fat);					/* FAT size [sector] */
-			st_dword(buf + BPB_DataOfsEx, b_data - b_vol);			/* Data offset [sector] */
+			st_dword(buf + BPB_DataOfsEx, (DWORD)(b_data - b_vol));	/* Data offset [sector] */
 			st_dword(buf + BPB_NumClusEx, n_clst);					/* Number of clusters */
 			st_dword(buf + BPB_RootClusEx, 2 + tbl[0] + tbl[1]);	/* Root dir cluster # */
 			st_dword(buf + BPB_VolIDEx, GET_FATTIME());				/* VSN */
@@ -6059,25 +9224,28 @@ FRESULT f_mkfs (
 	} else
 #endif	/* FF_FS_EXFAT */
 	{	/* Create an FAT/FAT32 volume */
+#if FF_LBA64
+		if (b_vol + sz_vol > 0x100000000) LEAVE_MKFS(FR_MKFS_ABORTED);	/* Too large volume for FAT/FAT32 */
+#endif
 		do {
 			pau = au;
 			/* Pre-determine number of clusters and FAT sub-type */
 			if (fmt == FS_FAT32) {	/* FAT32 volume */
 				if (pau == 0) {	/* au auto-selection */
-					n = sz_vol / 0x20000;	/* Volume size in unit of 128KS */
+					n = (DWORD)(sz_vol / 0x20000);	/* Volume size in unit of 128KS */
 					for (i = 0, pau = 1; cst32[i] && cst32[i] <= n; i++, pau <<= 1) ;	/* Get from table */
 				}
-				n_clst = sz_vol / pau;	/* Number of clusters */
+				n_clst = (DWORD)(sz_vol / pau);	/* Number of clusters */
 				sz_fat = (n_clst * 4 + 8 + ss - 1) / ss;	/* FAT size [sector] */
 				sz_rsv = 32;	/* Number of reserved sectors */
 				sz_dir = 0;		/* No static directory */
 				if (n_clst <= MAX_FAT16 || n_clst > MAX_FAT32) LEAVE_MKFS(FR_MKFS_ABORTED);
 			} else {				/* FAT volume */
 				if (pau == 0) {	/* au auto-selection */
-				  n = sz_vol / 0x1000;  /* Volume size in unit of 4KS */
+				  n = (DWORD)(sz_vol / 0x1000);  /* Volume size in unit of 4KS */
 					for (i = 0, pau = 1; cst[i] && cst[i] <= n; i++, pau <<= 1) ;	/* Get from table */
 				}
-				n_clst = sz_vol / pau;
+				n_clst = (DWORD)(sz_vol / pau);
 				if (n_clst > MAX_FAT12) {
 					n = n_clst * 2 + 4;		/* FAT size [byte] */
 				} else {
@@ -6095,7 +9263,7 @@ FRESULT f_mkfs (
 #if defined(FF_FS_POSIX_INTEGRATION) // OS_USE_MICRO_OS_PLUS
 			n = 0; // ((b_data * ss + sz_blk - 1) & ~(sz_blk - 1)) - b_data * ss;	/* Next nearest erase block from current data base */
 #else
-			n = ((b_data + sz_blk - 1) & ~(sz_blk - 1)) - b_data; /* Next nearest erase block from current data base */
+			n = (DWORD)(((b_data + sz_blk - 1) & ~((LBA_t)sz_blk - 1)) - b_data); /* Next nearest erase block from current data base */
 #endif
 			if (fmt == FS_FAT32) {		/* FAT32: Move FAT base */
 				sz_rsv += n; b_fat += n;
@@ -6105,7 +9273,7 @@ FRESULT f_mkfs (
 
 			/* Determine number of clusters and final check of validity of the FAT sub-type */
 			if (sz_vol < b_data + pau * 16 - b_vol) LEAVE_MKFS(FR_MKFS_ABORTED);	/* Too small volume */
-			n_clst = (sz_vol - sz_rsv - sz_fat * n_fats - sz_dir) / pau;
+			n_clst = (DWORD)((sz_vol - sz_rsv - sz_fat * n_fats - sz_dir) / pau);
 			if (fmt == FS_FAT32) {
 				if (n_clst <= MAX_FAT16) {	/* Too few clusters for FAT32 */
 					if (au == 0 && (au = pau / 2) != 0) continue;	/* Adjust cluster size and retry */
@@ -6135,8 +9303,8 @@ FRESULT f_mkfs (
 		} while (1);
 
 #if FF_USE_TRIM
-		tbl[0] = b_vol; tbl[1] = b_vol + sz_vol - 1;	/* Inform the device the volume area can be erased */
-		disk_ioctl(pdrv, CTRL_TRIM, tbl);
+		rt[0] = b_vol; rt[1] = b_vol + sz_vol - 1;	/* Inform the device the volume area can be erased */
+		disk_ioctl(pdrv, CTRL_TRIM, rt);
 #endif
 		/* Create FAT VBR */
 		mem_set(buf, 0, ss);
@@ -6149,12 +9317,12 @@ FRESULT f_mkfs (
 		if (sz_vol < 0x10000) {
 			st_word(buf + BPB_TotSec16, (WORD)sz_vol);	/* Volume size in 16-bit LBA */
 		} else {
-			st_dword(buf + BPB_TotSec32, sz_vol);		/* Volume size in 32-bit LBA */
+			st_dword(buf + BPB_TotSec32, (DWORD)sz_vol);	/* Volume size in 32-bit LBA */
 		}
 		buf[BPB_Media] = 0xF8;							/* Media descriptor byte */
 		st_word(buf + BPB_SecPerTrk, 63);				/* Number of sectors per track (for int13) */
 		st_word(buf + BPB_NumHeads, 255);				/* Number of heads (for int13) */
-		st_dword(buf + BPB_HiddSec, b_vol);				/* Volume offset in the physical drive [sector] */
+		st_dword(buf + BPB_HiddSec, (DWORD)b_vol);		/* Volume offset in the physical drive [sector] */
 		if (fmt == FS_FAT32) {
 			st_dword(buf + BS_VolID32, GET_FATTIME());	/* VSN */
 			st_dword(buf + BPB_FATSz32, sz_fat);		/* FAT size [sector] */
@@ -6247,12 +9415,12 @@ FRESULT f_mkfs (
 			pte[PTE_StSec] = 1;					/* Start sector */
 			pte[PTE_StCyl] = 0;					/* Start cylinder */
 			pte[PTE_System] = sys;				/* System type */
-			n = (b_vol + sz_vol) / (63 * 255);	/* (End CHS may be invalid) */
+			n = (DWORD)((b_vol + sz_vol) / (63 * 255));	/* (End CHS may be invalid) */
 			pte[PTE_EdHead] = 254;				/* End head */
 			pte[PTE_EdSec] = (BYTE)(((n >> 2) & 0xC0) | 63);	/* End sector */
 			pte[PTE_EdCyl] = (BYTE)n;			/* End cylinder */
-			st_dword(pte + PTE_StLba, b_vol);	/* Start offset in LBA */
-			st_dword(pte + PTE_SizLba, sz_vol);	/* Size in sectors */
+			st_dword(pte + PTE_StLba, (DWORD)b_vol);	/* Start offset in LBA */
+			st_dword(pte + PTE_SizLba, (DWORD)sz_vol);	/* Size in sectors */
 			if (disk_write(pdrv, buf, 0, 1) != RES_OK) LEAVE_MKFS(FR_DISK_ERR);	/* Write it to the MBR */
 		}
 	}
@@ -6284,7 +9452,8 @@ FRESULT f_fdisk (
 	UINT i, n, sz_cyl, tot_cyl, b_cyl, e_cyl, p_cyl;
 	BYTE s_hd, e_hd, *p, *buf; = (BYTE*)work;
 	DSTATUS stat;
-	DWORD sz_disk, sz_part, s_part;
+	LBA_t sz_disk;
+	DWORD sz_part, s_part;
 	FRESULT res;
 
 
@@ -6292,6 +9461,9 @@ FRESULT f_fdisk (
 	if (stat & STA_NOINIT) return FR_NOT_READY;
 	if (stat & STA_PROTECT) return FR_WRITE_PROTECTED;
 	if (disk_ioctl(pdrv, GET_SECTOR_COUNT, &sz_disk)) return FR_DISK_ERR;
+#if FF_LBA64
+	if (sz_disk > 0xFFFFFFFF) sz_disk = 0xFFFFFFFF;	/* (The MBR addresses up to 2^32 sectors) */
+#endif
 
 	buf = (BYTE*)work;
 #if FF_USE_LFN == 3
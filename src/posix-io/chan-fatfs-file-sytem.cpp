@@ -52,7 +52,9 @@ namespace os
     chan_fatfs_file_system_impl::chan_fatfs_file_system_impl (
         block_device& device) :
         file_system_impl
-          { device }
+          { device }, //
+        ff_fs_
+          { } // With FF_SS_HEAP, no sector window until mounted.
     {
 #if defined(OS_TRACE_POSIX_IO_CHAN_FATFS)
       trace::printf ("chan_fatfs_file_system_impl::%s()=@%p\n", __func__, this);
@@ -81,6 +83,9 @@ namespace os
      * - size_t au_bytes
      * - void* work
      * - size_t size
+     *
+     * On a device with physical blocks larger than the logical
+     * blocks (512e), au_bytes is raised to the physical block size.
      */
     int
     chan_fatfs_file_system_impl::do_vmkfs (int options, std::va_list args)
@@ -92,6 +97,15 @@ namespace os
       UINT size = static_cast<UINT> (va_arg(args, size_t));
       va_end(args);
 
+      // On a device with logical blocks smaller than the physical
+      // blocks (512e), keep the clusters a multiple of the physical
+      // block, so that file data is accessed in whole physical blocks.
+      std::size_t psz = device ().block_physical_size_bytes ();
+      if (psz > device ().block_logical_size_bytes () && au_bytes < psz)
+        {
+          au_bytes = static_cast<DWORD> (psz);
+        }
+
       // Guarantee the volume is not mounted.
       ff_fs_.fs_type = 0;
 
@@ -146,8 +160,14 @@ namespace os
       trace::printf ("chan_fatfs_file_system_impl::%s(%u)\n", __func__, flags);
 #endif
 
-      FRESULT res;
-      res = f_mount (nullptr, 0, &ff_fs_);
+      // Write back the window and the dirty cache lines first, the
+      // unmount drops them; unmount anyway if the device fails.
+      FRESULT res = fs_sync (&ff_fs_);
+      FRESULT ures = f_mount (nullptr, 0, &ff_fs_);
+      if (res == FR_OK)
+        {
+          res = ures;
+        }
       if (res != FR_OK)
         {
           errno = fatfs_compute_errno (res);
@@ -489,7 +509,15 @@ namespace os
 #endif
 
       DWORD nclst;
+#if FF_FS_FREESCAN
+      // Do not wait for a full FAT scan; advance it by one step and
+      // report the clusters found free so far, a lower bound until
+      // scan_free_space() tells that the count is exact.
+      BYTE exact;
+      FRESULT res = f_scanfree (&ff_fs_, FF_FS_FREESCAN, &nclst, &exact);
+#else
       FRESULT res = f_getfree (&ff_fs_, &nclst);
+#endif
       if (res != FR_OK)
         {
           errno = fatfs_compute_errno (res);
@@ -506,8 +534,9 @@ namespace os
       buf->f_frsize = buf->f_bsize;
       buf->f_blocks = static_cast<fsblkcnt_t> (device ().blocks ());
 
-      // Compute free blocks from free clusters.
-      buf->f_bfree = static_cast<fsblkcnt_t> (ff_fs_.free_clst * ff_fs_.csize);
+      // Compute free blocks from free clusters; on a large exFAT
+      // volume the product does not fit in a DWORD.
+      buf->f_bfree = static_cast<fsblkcnt_t> (nclst) * ff_fs_.csize;
       buf->f_bavail = buf->f_bfree;
 
 #pragma GCC diagnostic pop
@@ -527,6 +556,106 @@ namespace os
       return 0;
     }
 
+    // ------------------------------------------------------------------------
+
+    chan_fatfs_file_system_impl::cache_statistics_t
+    chan_fatfs_file_system_impl::cache_statistics (void) const
+    {
+      cache_statistics_t stats
+        { 0, 0, 0, 0, 0 };
+
+#if FF_FS_WINCACHE
+      stats.hits = ff_fs_.wc_hit;
+      stats.misses = ff_fs_.wc_miss;
+      stats.writebacks = ff_fs_.wc_wback;
+#endif
+#if FF_FS_DCACHE
+      stats.lookup_hits = ff_fs_.dc_hit;
+      stats.lookup_misses = ff_fs_.dc_miss;
+#endif
+
+      return stats;
+    }
+
+    void
+    chan_fatfs_file_system_impl::cache_statistics_clear (void)
+    {
+#if FF_FS_WINCACHE
+      ff_fs_.wc_hit = 0;
+      ff_fs_.wc_miss = 0;
+      ff_fs_.wc_wback = 0;
+#endif
+#if FF_FS_DCACHE
+      ff_fs_.dc_hit = 0;
+      ff_fs_.dc_miss = 0;
+#endif
+    }
+
+    // ------------------------------------------------------------------------
+
+    chan_fatfs_file_system_impl::lock_statistics_t
+    chan_fatfs_file_system_impl::lock_statistics (void) const
+    {
+      lock_statistics_t stats
+        { 0, 0, 0, 0, 0 };
+
+#if FF_FS_REENTRANT
+      // The sync object exists only while the volume is mounted.
+      if (ff_fs_.fs_type != 0)
+        {
+          fatfs_sync_statistics_t st;
+          fatfs_sync_statistics (ff_fs_.sobj, &st);
+          stats.acquisitions = st.acquisitions;
+          stats.contentions = st.contentions;
+          stats.timeouts = st.timeouts;
+          stats.wait_us = st.wait_us;
+          stats.wait_max_us = st.wait_max_us;
+        }
+#endif
+
+      return stats;
+    }
+
+    void
+    chan_fatfs_file_system_impl::lock_statistics_clear (void)
+    {
+#if FF_FS_REENTRANT
+      if (ff_fs_.fs_type != 0)
+        {
+          fatfs_sync_statistics_clear (ff_fs_.sobj);
+        }
+#endif
+    }
+
+    // ------------------------------------------------------------------------
+
+    int
+    chan_fatfs_file_system_impl::scan_free_space (std::size_t sectors)
+    {
+#if defined(OS_TRACE_POSIX_IO_CHAN_FATFS)
+      trace::printf ("chan_fatfs_file_system_impl::%s(%zu)\n", __func__,
+                     sectors);
+#endif
+
+      DWORD nclst;
+#if FF_FS_FREESCAN
+      BYTE exact;
+      FRESULT res = f_scanfree (&ff_fs_, static_cast<UINT> (sectors), &nclst,
+                                &exact);
+#else
+      (void) sectors;
+      BYTE exact = 1;
+      FRESULT res = f_getfree (&ff_fs_, &nclst);
+#endif
+      if (res != FR_OK)
+        {
+          errno = fatfs_compute_errno (res);
+          return -1;
+        }
+
+      return exact ? 1 : 0;
+    }
+
   // ========================================================================
   } /* namespace posix */
 } /* namespace os */
@@ -19,6 +19,7 @@
 
 #include <fcntl.h>
 #include <cerrno>
+#include <limits>
 #include <unistd.h>
 #include <string.h>
 
@@ -123,12 +124,39 @@ namespace os
     off_t
     chan_fatfs_file_impl::do_lseek (off_t offset, int whence)
     {
-      if (whence != SEEK_SET || offset < 0)
+      off_t base;
+      switch (whence)
         {
+        case SEEK_SET:
+          base = 0;
+          break;
+
+        case SEEK_CUR:
+          base = static_cast<off_t> (f_tell (&ff_fil_));
+          break;
+
+        case SEEK_END:
+          base = static_cast<off_t> (f_size (&ff_fil_));
+          break;
+
+        default:
           errno = EINVAL;
           return -1;
         }
 
+      if (offset < -base)
+        {
+          // The resulting offset would be negative.
+          errno = EINVAL;
+          return -1;
+        }
+      if (offset > std::numeric_limits<off_t>::max () - base)
+        {
+          errno = EOVERFLOW;
+          return -1;
+        }
+      offset += base;
+
       FRESULT res = f_lseek (&ff_fil_, static_cast<FSIZE_t> (offset));
       if (res != FR_OK)
         {
@@ -142,8 +170,31 @@ namespace os
     int
     chan_fatfs_file_impl::do_ftruncate (off_t length)
     {
+      if (length < 0)
+        {
+          errno = EINVAL;
+          return -1;
+        }
+
+      FSIZE_t pos = f_tell (&ff_fil_);
+      FRESULT res;
+#if FF_USE_EXPAND && !FF_FS_READONLY
+      if (f_size (&ff_fil_) == 0 && length > 0)
+        {
+          // Grow an empty file with a contiguous block if there is one,
+          // otherwise by stretching the chain below.
+          res = f_expand (&ff_fil_, static_cast<FSIZE_t> (length), 1);
+          if (res != FR_OK && res != FR_DENIED)
+            {
+              errno = fatfs_compute_errno (res);
+              return -1;
+            }
+        }
+#endif
+
       // Since f_truncate() has no param, do it in two steps.
-      FRESULT res = f_lseek (&ff_fil_, static_cast<FSIZE_t> (length));
+      // Seeking beyond the end stretches the file.
+      res = f_lseek (&ff_fil_, static_cast<FSIZE_t> (length));
       if (res != FR_OK)
         {
           errno = fatfs_compute_errno (res);
@@ -156,6 +207,17 @@ namespace os
           errno = fatfs_compute_errno (res);
           return -1;
         }
+
+      // Keep the file offset, unless it is now beyond the end.
+      if (pos < static_cast<FSIZE_t> (length))
+        {
+          res = f_lseek (&ff_fil_, pos);
+          if (res != FR_OK)
+            {
+              errno = fatfs_compute_errno (res);
+              return -1;
+            }
+        }
       return 0;
     }
 
@@ -166,6 +228,15 @@ namespace os
       FRESULT res = f_sync (&ff_fil_);
       if (res != FR_OK)
         {
+#if FF_FS_DELALLOC
+          if (res == FR_DENIED)
+            {
+              // The delayed data did not fit on the volume, the file
+              // was cut at the end of its allocated clusters.
+              errno = ENOSPC;
+              return -1;
+            }
+#endif
           errno = fatfs_compute_errno (res);
           return -1;
         }
@@ -181,12 +252,192 @@ namespace os
       // TODO: link to deferred list.
       if (res != FR_OK)
         {
+#if FF_FS_DELALLOC
+          if (res == FR_DENIED)
+            {
+              // The delayed data did not fit on the volume; the file
+              // was cut and closed anyway.
+              errno = ENOSPC;
+              return -1;
+            }
+#endif
+          errno = fatfs_compute_errno (res);
+          return -1;
+        }
+      return 0;
+    }
+
+#if FF_USE_PREAD
+
+    // ------------------------------------------------------------------------
+
+    // Check the offset of a positional request and clamp its byte count.
+    // FatFs counts the bytes in an UINT; a larger request is served
+    // short, as POSIX allows.
+    static bool
+    clamp_request (std::size_t& nbyte, off_t offset)
+    {
+      if (offset < 0)
+        {
+          errno = EINVAL;
+          return false;
+        }
+
+      if (nbyte > std::numeric_limits<UINT>::max ())
+        {
+          nbyte = std::numeric_limits<UINT>::max ();
+        }
+      constexpr std::size_t ssize_max = static_cast<std::size_t> (
+          std::numeric_limits<ssize_t>::max ());
+      if (nbyte > ssize_max)
+        {
+          nbyte = ssize_max;
+        }
+      return true;
+    }
+
+    // http://pubs.opengroup.org/onlinepubs/9699919799/functions/pread.html
+    ssize_t
+    chan_fatfs_file_impl::pread (void* buf, std::size_t nbyte, off_t offset)
+    {
+      if (!clamp_request (nbyte, offset))
+        {
+          return -1;
+        }
+
+      UINT br;
+      FRESULT res = f_pread (&ff_fil_, buf, static_cast<UINT> (nbyte),
+                             static_cast<FSIZE_t> (offset), &br);
+      if (res != FR_OK)
+        {
+          errno = fatfs_compute_errno (res);
+          return -1;
+        }
+      return static_cast<ssize_t> (br);
+    }
+
+    // http://pubs.opengroup.org/onlinepubs/9699919799/functions/pwrite.html
+    ssize_t
+    chan_fatfs_file_impl::pwrite (const void* buf, std::size_t nbyte,
+                                  off_t offset)
+    {
+      if (!clamp_request (nbyte, offset))
+        {
+          return -1;
+        }
+
+      UINT bw;
+      FRESULT res = f_pwrite (&ff_fil_, buf, static_cast<UINT> (nbyte),
+                              static_cast<FSIZE_t> (offset), &bw);
+      if (res != FR_OK)
+        {
           errno = fatfs_compute_errno (res);
           return -1;
         }
+      return static_cast<ssize_t> (bw);
+    }
+
+#endif /* FF_USE_PREAD */
+
+#if FF_USE_EXPAND && !FF_FS_READONLY
+
+    int
+    chan_fatfs_file_impl::preallocate (off_t length, allocation mode)
+    {
+      if (length <= 0 || f_size (&ff_fil_) != 0)
+        {
+          // f_expand() works on an empty file only.
+          errno = EINVAL;
+          return -1;
+        }
+      if (static_cast<std::uint64_t> (length) > 0xFFFFFFFFu
+          && (!FF_FS_EXFAT || ff_fil_.obj.fs == nullptr
+              || ff_fil_.obj.fs->fs_type != FS_EXFAT))
+        {
+          // Over the file size limit of the FAT volume.
+          errno = EFBIG;
+          return -1;
+        }
+
+      FRESULT res = f_expand (&ff_fil_, static_cast<FSIZE_t> (length),
+                              static_cast<BYTE> (mode));
+      if (res != FR_OK)
+        {
+          if (res == FR_DENIED && (ff_fil_.flag & FA_WRITE) != 0)
+            {
+              // No contiguous free block large enough.
+              errno = ENOSPC;
+            }
+          else
+            {
+              errno = fatfs_compute_errno (res);
+            }
+          return -1;
+        }
       return 0;
     }
 
+#endif /* FF_USE_EXPAND && !FF_FS_READONLY */
+
+#if FF_USE_EXTENT
+
+    // ------------------------------------------------------------------------
+
+    ssize_t
+    chan_fatfs_file_impl::extents (off_t offset, std::size_t nbyte,
+                                   extent_t* ext, std::size_t count)
+    {
+      if (offset < 0 || ext == nullptr || count == 0)
+        {
+          errno = EINVAL;
+          return -1;
+        }
+
+      UINT ne;
+      FRESULT res = f_getextent (&ff_fil_, static_cast<FSIZE_t> (offset),
+                                 static_cast<FSIZE_t> (nbyte), ext,
+                                 static_cast<UINT> (count), &ne);
+      if (res != FR_OK)
+        {
+          errno = fatfs_compute_errno (res);
+          return -1;
+        }
+      return static_cast<ssize_t> (ne);
+    }
+
+    int
+    chan_fatfs_file_impl::release_extents (void)
+    {
+      FRESULT res = f_putextent (&ff_fil_);
+      if (res != FR_OK)
+        {
+          errno = fatfs_compute_errno (res);
+          return -1;
+        }
+      return 0;
+    }
+
+#endif /* FF_USE_EXTENT */
+
+#if FF_FS_RESERVE || FF_USE_EXTENT
+
+    // ------------------------------------------------------------------------
+
+    ssize_t
+    chan_fatfs_file_impl::fragments (void)
+    {
+      DWORD nfrag;
+      FRESULT res = f_getfrag (&ff_fil_, &nfrag);
+      if (res != FR_OK)
+        {
+          errno = fatfs_compute_errno (res);
+          return -1;
+        }
+      return static_cast<ssize_t> (nfrag);
+    }
+
+#endif /* FF_FS_RESERVE || FF_USE_EXTENT */
+
   // ==========================--==============================================
   } /* namespace posix */
 } /* namespace os */
@@ -101,11 +101,15 @@ disk_deinitialize (PDRV pdrv /* Pointer to block device */
 DRESULT
 disk_read (PDRV pdrv, /* Pointer to block device */
            BYTE *buff, /* Data buffer to store read data */
-           DWORD sector, /* Start sector in LBA */
+           LBA_t sector, /* Start sector in LBA */
            UINT count /* Number of sectors to read */
            )
 {
   os::posix::block_device* pdb = static_cast<os::posix::block_device*> (pdrv);
+  if (static_cast<os::posix::block_device::blknum_t> (sector) != sector)
+    {
+      return RES_PARERR;
+    }
   ssize_t ret = pdb->read_block (buff, sector, count);
   if (ret > 0)
     {
@@ -121,11 +125,15 @@ disk_read (PDRV pdrv, /* Pointer to block device */
 DRESULT
 disk_write (PDRV pdrv, /* Pointer to block device */
             const BYTE *buff, /* Data to be written */
-            DWORD sector, /* Start sector in LBA */
+            LBA_t sector, /* Start sector in LBA */
             UINT count /* Number of sectors to write */
             )
 {
   os::posix::block_device* pdb = static_cast<os::posix::block_device*> (pdrv);
+  if (static_cast<os::posix::block_device::blknum_t> (sector) != sector)
+    {
+      return RES_PARERR;
+    }
   ssize_t ret = pdb->write_block (buff, sector, count);
   if (ret > 0)
     {
@@ -148,18 +156,28 @@ disk_ioctl (PDRV pdrv, /* Pointer to block device */
   os::posix::block_device* pdb = static_cast<os::posix::block_device*> (pdrv);
   if (cmd == GET_SECTOR_COUNT)
     {
-      DWORD* pdw = static_cast<DWORD*> (buff);
-      *pdw = pdb->blocks ();
+      // Without FF_LBA64, a device over 2^32 sectors is used up to
+      // the last addressable sector instead of being truncated.
+      os::posix::block_device::blknum_t n = pdb->blocks ();
+      LBA_t* plba = static_cast<LBA_t*> (buff);
+      *plba = (static_cast<LBA_t> (n) == n) ? static_cast<LBA_t> (n) : ~static_cast<LBA_t> (0);
     }
   else if (cmd == GET_SECTOR_SIZE)
     {
+      // Sizes that do not fit are returned as 0, which the mount refuses,
+      // instead of being truncated to a valid looking size.
+      std::size_t sz = pdb->block_logical_size_bytes ();
       WORD* pw = static_cast<WORD*> (buff);
-      *pw = static_cast<WORD> (pdb->block_logical_size_bytes ());
+      *pw = (sz <= 0xFFFF) ? static_cast<WORD> (sz) : 0;
     }
   else if (cmd == GET_BLOCK_SIZE)
     {
+      // FatFs expects the erase block size in sectors; mkfs aligns the
+      // FAT and the data area to it. On a 512e device it is 8.
+      std::size_t lsz = pdb->block_logical_size_bytes ();
+      std::size_t psz = pdb->block_physical_size_bytes ();
       DWORD* pdw = static_cast<DWORD*> (buff);
-      *pdw = pdb->block_physical_size_bytes ();
+      *pdw = (lsz != 0 && psz > lsz) ? static_cast<DWORD> (psz / lsz) : 1;
     }
   else if (cmd == CTRL_SYNC)
     {
@@ -7,7 +7,9 @@
 //#include "ff.h"
 #include "chan-fatfs/ff.h"
 
-#if FF_USE_LFN == 3	/* Dynamic memory allocation */
+#if FF_USE_LFN == 3 || FF_SS_HEAP	/* Dynamic memory allocation */
+
+#include <stdlib.h>
 
 /*------------------------------------------------------------------------*/
 /* Allocate a memory block                                                */
@@ -35,6 +37,91 @@ void ff_memfree (
 
 #if FF_FS_REENTRANT	/* Mutal exclusion */
 
+// OS_USE_MICRO_OS_PLUS
+// The sync object is a mutex allocated for each mounted volume.
+// By default it is a µOS++ mutex and FF_FS_TIMEOUT is in system clock
+// ticks. With OS_USE_CHAN_FATFS_STD_MUTEX (Linux host builds) it is a
+// std::timed_mutex and FF_FS_TIMEOUT is in milliseconds.
+// With OS_INCLUDE_CHAN_FATFS_SYNC_STATISTICS, a busy mutex is first
+// retried OS_INTEGER_CHAN_FATFS_SYNC_SPIN times without blocking, and
+// the acquisitions, the contended waits and the timeouts are counted.
+
+#include "chan-fatfs/utils.h"
+
+#include <new>
+
+#if defined(OS_USE_CHAN_FATFS_STD_MUTEX)
+#include <chrono>
+#include <mutex>
+#else
+#include <cmsis-plus/rtos/os.h>
+#endif
+
+#if defined(OS_INCLUDE_CHAN_FATFS_SYNC_STATISTICS)
+#include <atomic>
+
+#if !defined(OS_INTEGER_CHAN_FATFS_SYNC_SPIN)
+// On single core devices the owner cannot run while we spin; use 0.
+#define OS_INTEGER_CHAN_FATFS_SYNC_SPIN (32)
+#endif
+#endif
+
+struct ff_sync
+{
+#if defined(OS_USE_CHAN_FATFS_STD_MUTEX)
+  std::timed_mutex mutex;
+#else
+  os::rtos::mutex mutex
+    { "fatfs" };
+#endif
+#if defined(OS_INCLUDE_CHAN_FATFS_SYNC_STATISTICS)
+  // Updated with the mutex held.
+  DWORD acquisitions;
+  DWORD contentions;
+  DWORD wait_us;
+  DWORD wait_max_us;
+  // Updated without the mutex.
+  std::atomic<DWORD> timeouts;
+#endif
+};
+
+static inline bool
+sync_try_lock (FF_SYNC_t sobj)
+{
+#if defined(OS_USE_CHAN_FATFS_STD_MUTEX)
+  return sobj->mutex.try_lock ();
+#else
+  return sobj->mutex.try_lock () == os::rtos::result::ok;
+#endif
+}
+
+static inline bool
+sync_timed_lock (FF_SYNC_t sobj)
+{
+#if defined(OS_USE_CHAN_FATFS_STD_MUTEX)
+  return sobj->mutex.try_lock_for (std::chrono::milliseconds (FF_FS_TIMEOUT));
+#else
+  return sobj->mutex.timed_lock (FF_FS_TIMEOUT) == os::rtos::result::ok;
+#endif
+}
+
+#if defined(OS_INCLUDE_CHAN_FATFS_SYNC_STATISTICS)
+
+static inline DWORD
+sync_now_us (void)
+{
+#if defined(OS_USE_CHAN_FATFS_STD_MUTEX)
+  return static_cast<DWORD> (std::chrono::duration_cast<
+      std::chrono::microseconds> (
+      std::chrono::steady_clock::now ().time_since_epoch ()).count ());
+#else
+  return static_cast<DWORD> (os::rtos::sysclock.now ()
+      * (1000000u / os::rtos::clock_systick::frequency_hz));
+#endif
+}
+
+#endif
+
 /*------------------------------------------------------------------------*/
 /* Create a Synchronization Object                                        */
 /*------------------------------------------------------------------------*/
@@ -43,30 +130,13 @@ void ff_memfree (
  /  When a 0 is returned, the f_mount() function fails with FR_INT_ERR.
  */
 
-//const osMutexDef_t Mutex[FF_VOLUMES];	/* CMSIS-RTOS */
 int ff_cre_syncobj ( /* 1:Function succeeded, 0:Could not create the sync object */
-    BYTE vol, /* Corresponding volume (logical drive number) */
+    BYTE vol __attribute__((unused)), /* Corresponding volume (logical drive number) */
     FF_SYNC_t *sobj /* Pointer to return the created sync object */
 )
   {
-    /* Win32 */
-    *sobj = CreateMutex(NULL, FALSE, NULL);
-    return (int)(*sobj != INVALID_HANDLE_VALUE);
-
-    /* uITRON */
-//	T_CSEM csem = {TA_TPRI,1,1};
-//	*sobj = acre_sem(&csem);
-//	return (int)(*sobj > 0);
-    /* uC/OS-II */
-//	OS_ERR err;
-//	*sobj = OSMutexCreate(0, &err);
-//	return (int)(err == OS_NO_ERR);
-    /* FreeRTOS */
-//	*sobj = xSemaphoreCreateMutex();
-//	return (int)(*sobj != NULL);
-    /* CMSIS-RTOS */
-//	*sobj = osMutexCreate(Mutex + vol);
-//	return (int)(*sobj != NULL);
+    *sobj = new (std::nothrow) ff_sync ();
+    return (int)(*sobj != nullptr);
   }
 
 /*------------------------------------------------------------------------*/
@@ -81,20 +151,8 @@ int ff_del_syncobj ( /* 1:Function succeeded, 0:Could not delete due to an error
     FF_SYNC_t sobj /* Sync object tied to the logical drive to be deleted */
 )
   {
-    /* Win32 */
-    return (int)CloseHandle(sobj);
-
-    /* uITRON */
-//	return (int)(del_sem(sobj) == E_OK);
-    /* uC/OS-II */
-//	OS_ERR err;
-//	OSMutexDel(sobj, OS_DEL_ALWAYS, &err);
-//	return (int)(err == OS_NO_ERR);
-    /* FreeRTOS */
-//  vSemaphoreDelete(sobj);
-//	return 1;
-    /* CMSIS-RTOS */
-//	return (int)(osMutexDelete(sobj) == osOK);
+    delete sobj;
+    return 1;
   }
 
 /*------------------------------------------------------------------------*/
@@ -108,19 +166,35 @@ int ff_req_grant ( /* 1:Got a grant to access the volume, 0:Could not get a gran
     FF_SYNC_t sobj /* Sync object to wait */
 )
   {
-    /* Win32 */
-    return (int)(WaitForSingleObject(sobj, FF_FS_TIMEOUT) == WAIT_OBJECT_0);
-
-    /* uITRON */
-//	return (int)(wai_sem(sobj) == E_OK);
-    /* uC/OS-II */
-//	OS_ERR err;
-//	OSMutexPend(sobj, FF_FS_TIMEOUT, &err));
-//	return (int)(err == OS_NO_ERR);
-    /* FreeRTOS */
-//	return (int)(xSemaphoreTake(sobj, FF_FS_TIMEOUT) == pdTRUE);
-    /* CMSIS-RTOS */
-//	return (int)(osMutexWait(sobj, FF_FS_TIMEOUT) == osOK);
+#if defined(OS_INCLUDE_CHAN_FATFS_SYNC_STATISTICS)
+    if (!sync_try_lock (sobj))
+      {
+        /* Contended, spin a while before blocking */
+        DWORD begin = sync_now_us ();
+        bool ok = false;
+        for (int i = 0; i < OS_INTEGER_CHAN_FATFS_SYNC_SPIN && !ok; ++i)
+          {
+            ok = sync_try_lock (sobj);
+          }
+        if (!ok && !sync_timed_lock (sobj))
+          {
+            sobj->timeouts++;
+            return 0;
+          }
+        DWORD wait = sync_now_us () - begin;
+        sobj->contentions++;
+        sobj->wait_us += wait;
+        if (wait > sobj->wait_max_us)
+          {
+            sobj->wait_max_us = wait;
+          }
+      }
+    sobj->acquisitions++;
+    return 1;
+#else
+    /* The uncontended try is cheaper than a timed wait */
+    return (int)(sync_try_lock (sobj) || sync_timed_lock (sobj));
+#endif
   }
 
 /*------------------------------------------------------------------------*/
@@ -133,18 +207,41 @@ void ff_rel_grant (
     FF_SYNC_t sobj /* Sync object to be signaled */
 )
   {
-    /* Win32 */
-    ReleaseMutex(sobj);
-
-    /* uITRON */
-//	sig_sem(sobj);
-    /* uC/OS-II */
-//	OSMutexPost(sobj);
-    /* FreeRTOS */
-//	xSemaphoreGive(sobj);
-    /* CMSIS-RTOS */
-//	osMutexRelease(sobj);
+    sobj->mutex.unlock ();
+  }
+
+/*------------------------------------------------------------------------*/
+/* Get/Clear the Statistics of a Synchronization Object                   */
+/*------------------------------------------------------------------------*/
+/* All zero without OS_INCLUDE_CHAN_FATFS_SYNC_STATISTICS.
+ */
+
+void
+fatfs_sync_statistics (FF_SYNC_t sobj, fatfs_sync_statistics_t* stats)
+  {
+#if defined(OS_INCLUDE_CHAN_FATFS_SYNC_STATISTICS)
+    stats->acquisitions = sobj->acquisitions;
+    stats->contentions = sobj->contentions;
+    stats->timeouts = sobj->timeouts;
+    stats->wait_us = sobj->wait_us;
+    stats->wait_max_us = sobj->wait_max_us;
+#else
+    (void) sobj;
+    stats->acquisitions = stats->contentions = stats->timeouts = 0;
+    stats->wait_us = stats->wait_max_us = 0;
+#endif
   }
 
+void
+fatfs_sync_statistics_clear (FF_SYNC_t sobj)
+  {
+#if defined(OS_INCLUDE_CHAN_FATFS_SYNC_STATISTICS)
+    sobj->acquisitions = sobj->contentions = 0;
+    sobj->wait_us = sobj->wait_max_us = 0;
+    sobj->timeouts = 0;
+#else
+    (void) sobj;
 #endif
+  }
 
+#endif
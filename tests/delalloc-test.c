@@ -0,0 +1,128 @@
+/*------------------------------------------------------------------------*/
+/* Test of the delayed allocation on a full volume (FF_FS_DELALLOC)       */
+/*------------------------------------------------------------------------*/
+/* The data of a file is left in its delay buffer, and the volume is then
+/  filled by the data written through by another file, by the directories,
+/  by f_lseek() and by f_expand(). The delayed data has to get its
+/  clusters when the file is closed, and to be read back after a remount.
+/  At last, the files are removed and the free clusters are checked
+/  against the empty volume.
+/
+/  usage: delalloc-test */
+
+#include <string.h>
+#include "ramdisk.h"
+
+#if !FF_FS_DELALLOC
+#error Build it with FF_FS_DELALLOC enabled
+#endif
+
+#define DELAYED	(FF_FS_DELALLOC * 512 - 100)	/* Bytes left in the delay buffer */
+
+static FATFS Fs;
+static BYTE Work[FF_MAX_SS * 16];
+static BYTE Buf[64 * 1024];
+
+
+
+static BYTE pattern (DWORD ofs)
+{
+	return (BYTE)(ofs * 7 + (ofs >> 8) + 3);
+}
+
+
+static void run (BYTE fmt, unsigned long size, DWORD au, const char* tag)
+{
+	FIL fa = {0}, fb = {0};
+	FRESULT res;
+	DWORD fre0, fre1, ofs, nd;
+	UINT n, i;
+	char path[16];
+
+
+	EXPECT(ramdisk_create(size / 512, 512) == 0);
+	CHECK(f_mkfs(RAMDISK, 0, fmt | FM_SFD, au, Work, sizeof Work));
+	CHECK(f_mount(RAMDISK, 0, &Fs));
+	CHECK(f_getfree(&Fs, &fre0));	/* The free clusters are known from now */
+	CHECK(f_mkdir(&Fs, "/d"));
+
+	/* Leave the data of /a in the delay buffer */
+	CHECK(f_open(&Fs, &fa, "/a", FA_WRITE | FA_CREATE_ALWAYS));
+	for (ofs = 0; ofs < DELAYED; ofs += n) {
+		n = (DELAYED - ofs < 700) ? DELAYED - ofs : 700;
+		for (i = 0; i < n; i++) Buf[i] = pattern(ofs + i);
+		CHECK(f_write(&fa, Buf, n, &n));
+		EXPECT(n > 0);
+	}
+	EXPECT(fa.da_cnt == DELAYED);
+
+	/* Fill the volume with the data written through */
+	CHECK(f_open(&Fs, &fb, "/b", FA_WRITE | FA_CREATE_ALWAYS));
+	memset(Buf, 0x55, sizeof Buf);
+	do {
+		CHECK(f_write(&fb, Buf, sizeof Buf, &n));
+	} while (n == sizeof Buf);
+	CHECK(f_close(&fb));
+
+	/* The directories, f_lseek() and f_expand() cannot take the promised clusters */
+	EXPECT(f_mkdir(&Fs, "/x") == FR_DENIED);
+	for (nd = 0; ; nd++) {	/* Files until the directory has to grow */
+		sprintf(path, "/d/%lu", (unsigned long)nd);
+		if ((res = f_open(&Fs, &fb, path, FA_WRITE | FA_CREATE_NEW)) != FR_OK) break;
+		CHECK(f_close(&fb));
+	}
+	EXPECT(res == FR_DENIED);
+	CHECK(f_open(&Fs, &fb, "/c", FA_WRITE | FA_CREATE_ALWAYS));
+	CHECK(f_lseek(&fb, (FSIZE_t)size));
+	EXPECT(f_size(&fb) == 0);
+#if FF_USE_EXPAND
+	CHECK(f_close(&fb));
+	CHECK(f_open(&Fs, &fb, "/e", FA_WRITE | FA_CREATE_ALWAYS));
+	EXPECT(f_expand(&fb, au, 1) == FR_DENIED);
+#endif
+	CHECK(f_close(&fb));
+
+	/* The delayed data gets its clusters */
+	CHECK(f_close(&fa));
+	CHECK(f_mount(0, 0, &Fs));
+	CHECK(f_mount(RAMDISK, 0, &Fs));
+	CHECK(f_open(&Fs, &fa, "/a", FA_READ));
+	EXPECT(f_size(&fa) == DELAYED);
+	CHECK(f_read(&fa, Buf, sizeof Buf, &n));
+	EXPECT(n == DELAYED);
+	for (i = 0; i < n && Buf[i] == pattern(i); i++) ;
+	EXPECT(i == n);
+	CHECK(f_close(&fa));
+
+	/* Remove all and check that no cluster leaks */
+	for (i = 0; i < nd; i++) {
+		sprintf(path, "/d/%u", i);
+		CHECK(f_unlink(&Fs, path));
+	}
+	CHECK(f_unlink(&Fs, "/d"));
+	CHECK(f_unlink(&Fs, "/a"));
+	CHECK(f_unlink(&Fs, "/b"));
+	CHECK(f_unlink(&Fs, "/c"));
+#if FF_USE_EXPAND
+	CHECK(f_unlink(&Fs, "/e"));
+#endif
+	CHECK(f_mount(0, 0, &Fs));
+	CHECK(f_mount(RAMDISK, 0, &Fs));
+	Fs.free_clst = 0xFFFFFFFF;	/* Force a full FAT scan */
+	CHECK(f_getfree(&Fs, &fre1));
+	EXPECT(fre1 == fre0);
+	CHECK(f_mount(0, 0, &Fs));
+
+	printf("%-6s au=%5lu DELALLOC=%u: %lu files made on the full volume, ok\n",
+		tag, (unsigned long)au, (unsigned)FF_FS_DELALLOC, (unsigned long)nd);
+	ramdisk_delete();
+}
+
+
+int main (void)
+{
+	run(FM_FAT, 4UL * 1024 * 1024, 512, "FAT16");
+	run(FM_FAT32, 64UL * 1024 * 1024, 512, "FAT32");
+	run(FM_EXFAT, 8UL * 1024 * 1024, 4096, "exFAT");
+	return 0;
+}
@@ -0,0 +1,498 @@
+/*------------------------------------------------------------------------*/
+/* Functional test of the FatFs core, built once per option               */
+/*------------------------------------------------------------------------*/
+/* A few files are appended at a time in writes of mixed sizes, synced and
+/  read by another file object, rewritten and read back at random places
+/  through the same file objects, truncated and appended again, while a
+/  model of their data is kept in memory. With FF_USE_EXTENT, the sectors
+/  given by f_getextent() are read off the disk and checked, and the files
+/  cannot be truncated until they are released. With FF_USE_FORWARD, the
+/  files are also read back through f_stream() and f_forward() by a sink
+/  that checks the data and goes busy now and then. With FF_USE_PREAD, the
+/  files are also written and read at random places by f_pwrite() and
+/  f_pread(), which leave the file pointer where it was. With FF_USE_EXPAND,
+/  a file is given a contiguous block by f_expand() before it is written,
+/  and another is written after a block is only found for it. A directory of many small files
+/  is filled, then a part of it is removed and another part moved to a
+/  subdirectory, and the paths through a moved directory are looked up
+/  again. The free cluster count kept by FatFs is checked against a full
+/  scan, and after a remount all the data is read back in reads of mixed
+/  sizes and at random places. At last, all is removed and the free
+/  clusters are checked against the empty volume. It is built with each
+/  of the options by run.sh, on FAT12, FAT16, FAT32 and exFAT volumes.
+/
+/  usage: feature-test [seed] */
+
+#include <string.h>
+#include "ramdisk.h"
+
+#define NFILE	4		/* Files written at a time */
+#define NMANY	300		/* Small files in /many */
+#define SSIZE	512		/* Sector size of the RAM disk */
+
+static FATFS Fs;
+static BYTE Work[FF_MAX_SS * 16];
+static BYTE Buf[64 * 1024];
+static FIL Fil[NFILE];
+static BYTE *Model[NFILE];	/* Data expected in each file */
+static DWORD Size[NFILE];	/* Size expected of each file */
+static DWORD Seed;
+
+static const UINT Chunk[] = { 1, 100, 511, 512, 513, 1000, 4096, 5000, 20000, 65536 };
+
+
+
+static DWORD rnd (DWORD n)
+{
+	Seed = Seed * 1103515245 + 12345;
+	return (Seed >> 8) % n;
+}
+
+
+static void file_path (char* path, UINT f)
+{
+	sprintf(path, "/dir/file number %u with a long name.bin", f);
+}
+
+
+static void many_path (char* path, const char* dir, UINT i)
+{
+	sprintf(path, "%s/entry %04u of the index.txt", dir, i);
+}
+
+
+/* Write n bytes of new data at the file pointer of a file and to its model */
+static void put (UINT f, UINT n)
+{
+	DWORD ofs = (DWORD)f_tell(&Fil[f]);
+	UINT i, bw;
+
+
+	for (i = 0; i < n; i++) Model[f][ofs + i] = (BYTE)(rnd(255) + 1);
+	CHECK(f_write(&Fil[f], &Model[f][ofs], n, &bw));
+	EXPECT(bw == n);
+	if (ofs + n > Size[f]) Size[f] = ofs + n;
+}
+
+
+/* Read n bytes at the file pointer of an open file and check them against its model */
+static void get (UINT f, UINT n)
+{
+	DWORD ofs = (DWORD)f_tell(&Fil[f]);
+	UINT br;
+
+
+	CHECK(f_read(&Fil[f], Buf, n, &br));
+	EXPECT(br == ((Size[f] - ofs < n) ? Size[f] - ofs : n));
+	EXPECT(!memcmp(Buf, &Model[f][ofs], br));
+}
+
+
+#if FF_USE_FORWARD
+/* Sink of f_stream() and f_forward() checking the data against the model */
+typedef struct {
+	UINT f;			/* File */
+	DWORD ofs;		/* File offset of the next data */
+	UINT room;		/* Bytes it can take before it goes busy */
+} SINK;
+
+static SINK Sink;
+
+
+static UINT sink (void* arg, const BYTE* p, UINT n)
+{
+	SINK *sk = arg;
+
+
+	if (n > sk->room) n = sk->room;
+	EXPECT(!memcmp(p, &Model[sk->f][sk->ofs], n));
+	sk->ofs += n; sk->room -= n;
+	return n;
+}
+
+
+static UINT sink_fwd (const BYTE* p, UINT n)
+{
+	return n ? sink(&Sink, p, n) : Sink.room != 0;	/* n == 0: ready? */
+}
+
+
+/* Forward the file from a place to the end in parts of mixed sizes, read some data in the middle */
+static void stream (UINT f, DWORD ofs)
+{
+	UINT n, bf;
+
+
+	CHECK(f_lseek(&Fil[f], ofs));
+	Sink.f = f;
+	while (ofs < Size[f]) {
+		Sink.ofs = ofs;
+		Sink.room = Chunk[rnd(sizeof Chunk / sizeof Chunk[0])];
+		n = Chunk[rnd(sizeof Chunk / sizeof Chunk[0])];
+		if (rnd(2)) {
+			CHECK(f_stream(&Fil[f], sink, &Sink, n, &bf));
+		} else {
+			CHECK(f_forward(&Fil[f], sink_fwd, n, &bf));
+		}
+		if (n > Size[f] - ofs) n = Size[f] - ofs;
+		EXPECT(bf == ((n < Sink.ofs - ofs + Sink.room) ? n : Sink.ofs - ofs + Sink.room));	/* Up to the room of the sink */
+		EXPECT(Sink.ofs == ofs + bf && f_tell(&Fil[f]) == ofs + bf);
+		if (rnd(4) == 0) get(f, Chunk[rnd(sizeof Chunk / sizeof Chunk[0])]);	/* The file pointer is where the stream stopped */
+		ofs = (DWORD)f_tell(&Fil[f]);
+	}
+}
+#endif
+
+
+/* Read a whole file in reads of mixed sizes and at random places, and check it */
+static void verify (UINT f)
+{
+	char path[64];
+	UINT i;
+
+
+	file_path(path, f);
+	CHECK(f_open(&Fs, &Fil[f], path, FA_READ));
+	EXPECT(f_size(&Fil[f]) == Size[f]);
+	while (f_tell(&Fil[f]) < Size[f]) get(f, Chunk[rnd(sizeof Chunk / sizeof Chunk[0])]);
+	for (i = 0; i < 50; i++) {
+		CHECK(f_lseek(&Fil[f], rnd(Size[f])));
+		get(f, Chunk[rnd(sizeof Chunk / sizeof Chunk[0])]);
+	}
+#if FF_USE_FORWARD
+	stream(f, 0);
+	stream(f, rnd(Size[f]));
+#endif
+	CHECK(f_close(&Fil[f]));
+}
+
+
+#if FF_USE_EXPAND
+static void expand_path (char* path, UINT k)
+{
+	sprintf(path, "/dir/file %u expanded before it is written.bin", k);
+}
+
+
+static BYTE pattern (UINT k, DWORD ofs)
+{
+	return (BYTE)(ofs * 7 + (ofs >> 9) + k * 0x35);
+}
+
+
+/* Create a file of a contiguous block by f_expand() (opt 1:allocated, 0:prepared) and write it */
+static void expand (UINT k, DWORD fsz, BYTE opt)
+{
+	FIL fil = {0};
+	DWORD fre0, fre1, ofs, csz = (DWORD)Fs.csize * SSIZE;
+	UINT n, i, bw;
+#if FF_FS_RESERVE || FF_USE_EXTENT
+	DWORD nfrag;
+#endif
+	char path[64];
+
+
+	expand_path(path, k);
+	CHECK(f_getfree(&Fs, &fre0));
+	CHECK(f_open(&Fs, &fil, path, FA_WRITE | FA_CREATE_NEW));
+	CHECK(f_expand(&fil, fsz, opt));
+	CHECK(f_getfree(&Fs, &fre1));
+	EXPECT(f_size(&fil) == (opt ? fsz : 0) && f_tell(&fil) == 0);
+	EXPECT(fre0 - fre1 == (opt ? (fsz + csz - 1) / csz : 0));
+	for (ofs = 0; ofs < fsz; ofs += n) {
+		n = Chunk[rnd(sizeof Chunk / sizeof Chunk[0])];
+		if (n > fsz - ofs) n = fsz - ofs;
+		for (i = 0; i < n; i++) Buf[i] = pattern(k, ofs + i);
+		CHECK(f_write(&fil, Buf, n, &bw));
+		EXPECT(bw == n);
+	}
+	EXPECT(f_expand(&fil, fsz * 2, 1) == FR_DENIED);	/* Not an empty file */
+#if FF_FS_RESERVE || FF_USE_EXTENT
+	CHECK(f_getfrag(&fil, &nfrag));
+	EXPECT(nfrag == 1);
+#endif
+	CHECK(f_close(&fil));
+}
+
+
+/* Read back a file written by expand() and remove it */
+static void expand_verify (UINT k, DWORD fsz)
+{
+	FIL fil = {0};
+	DWORD ofs;
+	UINT n, i;
+	char path[64];
+
+
+	expand_path(path, k);
+	CHECK(f_open(&Fs, &fil, path, FA_READ));
+	EXPECT(f_size(&fil) == fsz);
+	for (ofs = 0; ofs < fsz; ofs += n) {
+		CHECK(f_read(&fil, Buf, sizeof Buf, &n));
+		EXPECT(n > 0);
+		for (i = 0; i < n && Buf[i] == pattern(k, ofs + i); i++) ;
+		EXPECT(i == n);
+	}
+	CHECK(f_close(&fil));
+	CHECK(f_unlink(&Fs, path));
+}
+#endif
+
+
+#if FF_USE_EXTENT
+/* Get the extents of a part of an open file, read the sectors off the disk and check them */
+static void extent (UINT f, DWORD ofs, DWORD len)
+{
+	static FEXTENT ext[512];
+	static BYTE sect[SSIZE];
+	DWORD end, pos, p0, p1;
+	LBA_t k;
+	UINT ne, i;
+
+
+	CHECK(f_getextent(&Fil[f], ofs, len, ext, sizeof ext / sizeof ext[0], &ne));
+	end = (ofs + len < Size[f]) ? ofs + len : Size[f];
+	for (pos = ofs, i = 0; i < ne; i++) {
+		EXPECT(ext[i].ofs <= pos && ext[i].ofs + ext[i].count * SSIZE > pos && ext[i].count > 0);
+		for (k = 0; k < ext[i].count && pos < end; k++) {
+			EXPECT(disk_read(RAMDISK, sect, ext[i].sect + k, 1) == RES_OK);
+			p0 = (DWORD)(ext[i].ofs + k * SSIZE);
+			p1 = (p0 + SSIZE < end) ? p0 + SSIZE : end;
+			if (p0 < pos) p0 = pos;
+			EXPECT(!memcmp(&sect[p0 % SSIZE], &Model[f][p0], p1 - p0));
+			pos = p1;
+		}
+		EXPECT(k == ext[i].count);		/* No sectors beyond the data */
+	}
+	EXPECT(pos == end || ne == sizeof ext / sizeof ext[0]);
+}
+#endif
+
+
+static void run (BYTE fmt, unsigned long size, DWORD au, const char* tag)
+{
+	FIL fil = {0};
+	FFDIR dir = {0};
+	FILINFO fno;
+	DWORD fre0, fre1, fre2, fsz, ofs;
+#if FF_USE_PREAD
+	DWORD pos;
+	UINT nb;
+#endif
+	UINT f, i, n, nf;
+	char path[64], path2[64];
+
+
+	EXPECT(ramdisk_create(size / SSIZE, SSIZE) == 0);
+	CHECK(f_mkfs(RAMDISK, 0, fmt | FM_SFD, au, Work, sizeof Work));
+	CHECK(f_mount(RAMDISK, 0, &Fs));
+	CHECK(f_getfree(&Fs, &fre0));
+	CHECK(f_mkdir(&Fs, "/dir"));
+	CHECK(f_mkdir(&Fs, "/dir/sub"));
+	CHECK(f_mkdir(&Fs, "/many"));
+
+	/* Append the files in turn, then rewrite, truncate and append again */
+	fsz = (size / 16 < 1024UL * 1024) ? size / 16 : 1024UL * 1024;
+	for (f = 0; f < NFILE; f++) {
+		Model[f] = malloc(fsz + 65536);
+		EXPECT(Model[f]);
+		Size[f] = 0;
+		file_path(path, f);
+		CHECK(f_open(&Fs, &Fil[f], path, FA_READ | FA_WRITE | FA_CREATE_ALWAYS));
+	}
+	for (nf = 0; nf < NFILE; ) {
+		for (f = nf = 0; f < NFILE; f++) {
+			n = Chunk[rnd(sizeof Chunk / sizeof Chunk[0])];
+			if (Size[f] + n > fsz - f * (fsz / 8)) {
+				nf++;
+				continue;
+			}
+			put(f, n);
+		}
+	}
+	for (f = 0; f < NFILE; f++) {	/* The synced data can be read by another file object */
+		CHECK(f_sync(&Fil[f]));
+		file_path(path, f);
+		CHECK(f_open(&Fs, &fil, path, FA_READ));
+		EXPECT(f_size(&fil) == Size[f]);
+		for (ofs = 0; ofs < Size[f]; ofs += n) {
+			CHECK(f_read(&fil, Buf, sizeof Buf, &n));
+			EXPECT(n > 0 && !memcmp(Buf, &Model[f][ofs], n));
+		}
+		CHECK(f_close(&fil));
+	}
+	for (i = 0; i < 200; i++) {	/* Rewrite and read back through the same file objects */
+		f = rnd(NFILE);
+		n = Chunk[rnd(sizeof Chunk / sizeof Chunk[0])];
+		ofs = rnd(Size[f]);
+		if (ofs + n > Size[f]) n = Size[f] - ofs;
+		CHECK(f_lseek(&Fil[f], ofs));
+		if (rnd(2)) {
+			get(f, n);
+		} else {
+			put(f, n);
+			CHECK(f_lseek(&Fil[f], ofs > 1000 ? ofs - 1000 : 0));
+			get(f, Chunk[rnd(sizeof Chunk / sizeof Chunk[0])]);
+		}
+	}
+#if FF_USE_PREAD
+	for (i = 0; i < 200; i++) {	/* Positional writes and reads, at the end too, leave the file pointer */
+		f = rnd(NFILE);
+		n = Chunk[rnd(sizeof Chunk / sizeof Chunk[0])];
+		ofs = (rnd(8) == 0 && Size[f] + n <= fsz) ? Size[f] : rnd(Size[f]);
+		if (ofs < Size[f] && ofs + n > Size[f]) n = Size[f] - ofs;
+		pos = (DWORD)f_tell(&Fil[f]);
+		if (ofs < Size[f] && rnd(2)) {
+			CHECK(f_pread(&Fil[f], Buf, n, ofs, &nb));
+			EXPECT(nb == n && !memcmp(Buf, &Model[f][ofs], n));
+		} else {
+			for (nb = 0; nb < n; nb++) Model[f][ofs + nb] = (BYTE)(rnd(255) + 1);
+			CHECK(f_pwrite(&Fil[f], &Model[f][ofs], n, ofs, &nb));
+			EXPECT(nb == n);
+			if (ofs + n > Size[f]) Size[f] = ofs + n;
+		}
+		EXPECT(f_tell(&Fil[f]) == pos);
+		get(f, Chunk[rnd(sizeof Chunk / sizeof Chunk[0])]);	/* The reads at the file pointer see the data */
+	}
+#endif
+	for (f = 0; f < NFILE; f += 2) {
+		CHECK(f_lseek(&Fil[f], Size[f] / 3));
+		CHECK(f_truncate(&Fil[f]));
+		Size[f] /= 3;
+		put(f, Chunk[rnd(sizeof Chunk / sizeof Chunk[0])]);
+	}
+#if FF_USE_EXTENT
+	for (f = 0; f < NFILE; f++) {	/* The sectors given by f_getextent() hold the data */
+		put(f, Chunk[rnd(sizeof Chunk / sizeof Chunk[0])]);		/* Data just written is in the extents */
+		extent(f, 0, Size[f]);
+		for (i = 0; i < 10; i++) {
+			ofs = rnd(Size[f]);
+			extent(f, ofs, Chunk[rnd(sizeof Chunk / sizeof Chunk[0])]);
+		}
+		CHECK(f_lseek(&Fil[f], Size[f] / 2));
+		EXPECT(f_truncate(&Fil[f]) == FR_LOCKED);		/* Pinned files cannot be truncated */
+		for (i = 0; i < 11; i++) CHECK(f_putextent(&Fil[f]));
+		EXPECT(f_putextent(&Fil[f]) == FR_INVALID_PARAMETER);
+		CHECK(f_truncate(&Fil[f]));
+		Size[f] = Size[f] / 2;
+	}
+#endif
+	for (f = 0; f < NFILE; f++) CHECK(f_close(&Fil[f]));
+#if FF_USE_EXPAND
+	expand(0, fsz / 2, 1);
+	expand(1, fsz / 2 + 1000, 0);
+#endif
+
+	/* Fill a directory, remove a third of it and move a fifth to another one */
+	for (i = 0; i < NMANY; i++) {
+		many_path(path, "/many", i);
+		CHECK(f_open(&Fs, &fil, path, FA_WRITE | FA_CREATE_NEW));
+		CHECK(f_write(&fil, path, (UINT)strlen(path), &n));
+		CHECK(f_close(&fil));
+	}
+	for (i = 0; i < NMANY; i += 3) {
+		many_path(path, "/many", i);
+		CHECK(f_unlink(&Fs, path));
+		EXPECT(f_stat(&Fs, path, &fno) == FR_NO_FILE);
+	}
+	for (i = 1; i < NMANY; i += 5) {
+		many_path(path, "/many", i);
+		many_path(path2, "/dir/sub", i);
+		if (i % 3) CHECK(f_rename(&Fs, path, path2));
+		EXPECT(f_stat(&Fs, path, &fno) == FR_NO_FILE);
+	}
+
+	/* The paths found before are not found after their directories are moved or replaced */
+	CHECK(f_mkdir(&Fs, "/x"));
+	CHECK(f_mkdir(&Fs, "/x/a directory with a long name"));
+	CHECK(f_mkdir(&Fs, "/x/a directory with a long name/z"));
+	CHECK(f_open(&Fs, &fil, "/x/a directory with a long name/z/f", FA_WRITE | FA_CREATE_NEW));
+	CHECK(f_close(&fil));
+	CHECK(f_stat(&Fs, "/x/a directory with a long name/z/f", &fno));
+	CHECK(f_rename(&Fs, "/x/a directory with a long name", "/dir/moved"));
+	EXPECT(f_stat(&Fs, "/x/a directory with a long name/z/f", &fno) == FR_NO_PATH);
+	CHECK(f_stat(&Fs, "/dir/moved/z/f", &fno));
+	for (i = 0; i < 2; i++) EXPECT(f_stat(&Fs, "/dir/moved/z/not there yet", &fno) == FR_NO_FILE);
+	CHECK(f_open(&Fs, &fil, "/dir/moved/z/not there yet", FA_WRITE | FA_CREATE_NEW));
+	CHECK(f_close(&fil));
+	CHECK(f_stat(&Fs, "/dir/moved/z/not there yet", &fno));
+	CHECK(f_unlink(&Fs, "/dir/moved/z/not there yet"));
+	CHECK(f_unlink(&Fs, "/dir/moved/z/f"));
+	CHECK(f_unlink(&Fs, "/dir/moved/z"));
+	CHECK(f_open(&Fs, &fil, "/dir/moved/z", FA_WRITE | FA_CREATE_NEW));	/* A file where the directory was */
+	CHECK(f_close(&fil));
+	EXPECT(f_stat(&Fs, "/dir/moved/z/f", &fno) == FR_NO_PATH);
+	CHECK(f_unlink(&Fs, "/dir/moved/z"));
+	CHECK(f_unlink(&Fs, "/dir/moved"));
+	CHECK(f_unlink(&Fs, "/x"));
+
+	/* The free clusters counted on the way are the free clusters on the table */
+	CHECK(f_getfree(&Fs, &fre1));
+	Fs.free_clst = 0xFFFFFFFF;	/* Force a full FAT scan */
+	CHECK(f_getfree(&Fs, &fre2));
+	EXPECT(fre1 == fre2);
+
+	/* Read all back after a remount */
+	CHECK(f_mount(0, 0, &Fs));
+	CHECK(f_mount(RAMDISK, 0, &Fs));
+	for (f = 0; f < NFILE; f++) verify(f);
+#if FF_USE_EXPAND
+	expand_verify(0, fsz / 2);
+	expand_verify(1, fsz / 2 + 1000);
+#endif
+	for (i = 0; i < NMANY; i++) {
+		many_path(path, (i % 3 && i % 5 == 1) ? "/dir/sub" : "/many", i);
+		if (i % 3 == 0) {
+			EXPECT(f_stat(&Fs, path, &fno) == FR_NO_FILE);
+			continue;
+		}
+		CHECK(f_open(&Fs, &fil, path, FA_READ));
+		CHECK(f_read(&fil, Buf, sizeof Buf, &n));
+		many_path(path2, "/many", i);
+		EXPECT(n == strlen(path2) && !memcmp(Buf, path2, n));
+		CHECK(f_close(&fil));
+	}
+	CHECK(f_opendir(&Fs, &dir, "/many"));
+	for (n = 0; ; n++) {
+		CHECK(f_readdir(&dir, &fno));
+		if (!fno.fname[0]) break;
+	}
+	CHECK(f_closedir(&dir));
+	EXPECT(n == NMANY - (NMANY + 2) / 3 - (NMANY / 5 - NMANY / 15));
+
+	/* Remove all and check that no cluster leaks */
+	for (f = 0; f < NFILE; f++) {
+		file_path(path, f);
+		CHECK(f_unlink(&Fs, path));
+		free(Model[f]);
+	}
+	for (i = 0; i < NMANY; i++) {
+		if (i % 3 == 0) continue;
+		many_path(path, (i % 5 == 1) ? "/dir/sub" : "/many", i);
+		CHECK(f_unlink(&Fs, path));
+	}
+	CHECK(f_unlink(&Fs, "/dir/sub"));
+	CHECK(f_unlink(&Fs, "/dir"));
+	CHECK(f_unlink(&Fs, "/many"));
+	CHECK(f_mount(0, 0, &Fs));
+	CHECK(f_mount(RAMDISK, 0, &Fs));
+	Fs.free_clst = 0xFFFFFFFF;
+	CHECK(f_getfree(&Fs, &fre1));
+	EXPECT(fre1 == fre0);
+	CHECK(f_mount(0, 0, &Fs));
+
+	printf("%-6s au=%5lu %8lu reads %8lu writes, ok\n",
+		tag, (unsigned long)au, ramdisk_stat.reads, ramdisk_stat.writes);
+	ramdisk_delete();
+}
+
+
+int main (int argc, char* argv[])
+{
+	Seed = (argc > 1) ? (DWORD)atol(argv[1]) : 1;
+	run(FM_FAT, 2UL * 1024 * 1024, 1024, "FAT12");
+	run(FM_FAT, 16UL * 1024 * 1024, 512, "FAT16");
+	run(FM_FAT32, 64UL * 1024 * 1024, 512, "FAT32");
+	run(FM_EXFAT, 32UL * 1024 * 1024, 4096, "exFAT");
+	return 0;
+}
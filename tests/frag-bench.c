@@ -0,0 +1,104 @@
+/*------------------------------------------------------------------------*/
+/* Benchmark of the per-file allocation windows (FF_FS_RESERVE)           */
+/*------------------------------------------------------------------------*/
+/* Three files are appended at a time in small writes, as by loggers, and
+/  the number of fragments of each file is printed by f_getfrag(), with the
+/  disk calls to read them back in large calls with FF_FS_MAXXFER. Build it
+/  with FF_USE_EXTENT and without FF_FS_RESERVE for the numbers before the
+/  option. The data is checked after a remount, and the free clusters after
+/  the files are removed.
+/
+/  usage: frag-bench */
+
+#include <string.h>
+#include "ramdisk.h"
+
+#define NFILE	3			/* Files written at a time */
+#define FSIZE	(4UL * 1024 * 1024)	/* Size of each file */
+#define CHUNK	1000		/* Bytes in a write */
+
+static FATFS Fs;
+static BYTE Work[FF_MAX_SS * 16];
+static BYTE Buf[64 * 1024];
+static FIL Fil[NFILE];
+
+
+
+static BYTE pattern (UINT f, DWORD ofs)
+{
+	return (BYTE)(ofs * 13 + (ofs >> 9) + f * 0x55);
+}
+
+
+static void run (BYTE fmt, DWORD au, const char* tag)
+{
+	DWORD fre0, fre1, ofs, nfrag[NFILE];
+	UINT f, n, i;
+	unsigned long nr;
+	char path[8];
+
+
+	EXPECT(ramdisk_create(64UL * 1024 * 1024 / 512, 512) == 0);
+	CHECK(f_mkfs(RAMDISK, 0, fmt | FM_SFD, au, Work, sizeof Work));
+	CHECK(f_mount(RAMDISK, 0, &Fs));
+	CHECK(f_getfree(&Fs, &fre0));
+
+	for (f = 0; f < NFILE; f++) {
+		sprintf(path, "/%u", f);
+		CHECK(f_open(&Fs, &Fil[f], path, FA_WRITE | FA_CREATE_ALWAYS));
+	}
+	for (ofs = 0; ofs < FSIZE; ofs += n) {	/* Append the files in turn */
+		n = (FSIZE - ofs < CHUNK) ? FSIZE - ofs : CHUNK;
+		for (f = 0; f < NFILE; f++) {
+			for (i = 0; i < n; i++) Buf[i] = pattern(f, ofs + i);
+			CHECK(f_write(&Fil[f], Buf, n, &i));
+			EXPECT(i == n);
+		}
+	}
+	for (f = 0; f < NFILE; f++) {
+		CHECK(f_getfrag(&Fil[f], &nfrag[f]));
+		CHECK(f_close(&Fil[f]));
+	}
+
+	CHECK(f_mount(0, 0, &Fs));
+	CHECK(f_mount(RAMDISK, 0, &Fs));
+	ramdisk_clear();
+	for (f = 0; f < NFILE; f++) {	/* Read them back in large calls */
+		sprintf(path, "/%u", f);
+		CHECK(f_open(&Fs, &Fil[f], path, FA_READ));
+		EXPECT(f_size(&Fil[f]) == FSIZE);
+		for (ofs = 0; ofs < FSIZE; ofs += n) {
+			CHECK(f_read(&Fil[f], Buf, sizeof Buf, &n));
+			EXPECT(n > 0);
+			for (i = 0; i < n && Buf[i] == pattern(f, ofs + i); i++) ;
+			EXPECT(i == n);
+		}
+		CHECK(f_close(&Fil[f]));
+	}
+	nr = ramdisk_stat.reads;
+
+	for (f = 0; f < NFILE; f++) {
+		sprintf(path, "/%u", f);
+		CHECK(f_unlink(&Fs, path));
+	}
+	CHECK(f_mount(0, 0, &Fs));
+	CHECK(f_mount(RAMDISK, 0, &Fs));
+	Fs.free_clst = 0xFFFFFFFF;	/* Force a full FAT scan */
+	CHECK(f_getfree(&Fs, &fre1));
+	EXPECT(fre1 == fre0);
+	CHECK(f_mount(0, 0, &Fs));
+
+	printf("%-6s au=%5lu RESERVE=%-3u fragments %6lu %6lu %6lu, %7lu reads to read back\n",
+		tag, (unsigned long)au, (unsigned)FF_FS_RESERVE,
+		(unsigned long)nfrag[0], (unsigned long)nfrag[1], (unsigned long)nfrag[2], nr);
+	ramdisk_delete();
+}
+
+
+int main (void)
+{
+	run(FM_FAT, 2048, "FAT16");
+	run(FM_FAT32, 512, "FAT32");
+	run(FM_EXFAT, 4096, "exFAT");
+	return 0;
+}
@@ -0,0 +1,111 @@
+/*------------------------------------------------------------------------*/
+/* Test of the 64-bit LBA (FF_LBA64) on a sparse exFAT volume             */
+/*------------------------------------------------------------------------*/
+/* A volume of 2^32 + 2^30 sectors is created. A file of the size up to a
+/  few clusters below sector 2^32 is allocated with f_expand(), and the
+/  data of a second file is written across sector 2^32, read back after a
+/  remount and removed again.
+/
+/  usage: lba64-test [sector size] */
+
+#include <string.h>
+#include "ramdisk.h"
+
+#if !FF_LBA64 || !FF_FS_EXFAT || !FF_USE_EXPAND
+#error Build it with FF_LBA64, FF_FS_EXFAT and FF_USE_EXPAND enabled
+#endif
+
+#define DATA	(64UL * 1024 * 1024)	/* Size of the file written across sector 2^32 */
+#define BLOCK	(1024UL * 1024)			/* Bytes per f_write()/f_read() */
+
+static FATFS Fs;
+static BYTE Work[FF_MAX_SS * 16];
+
+
+
+static BYTE pattern (QWORD ofs)
+{
+	return (BYTE)(ofs * 131 + (ofs >> 12) * 7 + 1);
+}
+
+
+int main (int argc, char* argv[])
+{
+	WORD ss = (argc > 1) ? (WORD)atoi(argv[1]) : 512;
+	unsigned long long nsect = (1ULL << 32) + (1ULL << 30);
+	FIL fl = {0}, fh = {0};
+	DWORD fre0, fre1;
+	QWORD ofs, low;
+	UINT n, i;
+	BYTE *buf = malloc(BLOCK);
+
+
+	EXPECT(buf);
+	EXPECT(ramdisk_create(nsect, ss) == 0);
+
+	/* FAT volumes have to reside below 2^32 sectors */
+	EXPECT(f_mkfs(RAMDISK, 0, FM_FAT32 | FM_SFD, 0, Work, sizeof Work) == FR_MKFS_ABORTED);
+	/* The partition of a volume over 2^32 sectors cannot be described in the MBR */
+	EXPECT(f_mkfs(RAMDISK, 0, FM_EXFAT, 0, Work, sizeof Work) == FR_MKFS_ABORTED);
+
+	CHECK(f_mkfs(RAMDISK, 0, FM_EXFAT | FM_SFD, 0, Work, sizeof Work));
+	CHECK(f_mount(RAMDISK, 0, &Fs));
+	CHECK(f_getfree(&Fs, &fre0));
+
+	/* Take the clusters up to a few clusters below sector 2^32 */
+	low = ((1ULL << 32) - Fs.database) / Fs.csize - 8;
+	low *= (QWORD)Fs.csize * ss;
+	CHECK(f_open(&Fs, &fl, "/low.bin", FA_WRITE | FA_CREATE_NEW));
+	CHECK(f_expand(&fl, low, 1));
+	CHECK(f_close(&fl));
+
+	/* Write the data across sector 2^32, with an unaligned head */
+	CHECK(f_open(&Fs, &fh, "/high.bin", FA_WRITE | FA_CREATE_NEW));
+	for (ofs = 0; ofs < DATA; ofs += n) {
+		n = (ofs == 0) ? 1000 : BLOCK;
+		if (n > DATA - ofs) n = (UINT)(DATA - ofs);
+		for (i = 0; i < n; i++) buf[i] = pattern(ofs + i);
+		CHECK(f_write(&fh, buf, n, &n));
+		EXPECT(n > 0);
+	}
+	CHECK(f_close(&fh));
+	EXPECT(ramdisk_stat.top >= (1ULL << 32));
+
+	/* Read it back after a remount, sequentially and across the boundary */
+	CHECK(f_mount(0, 0, &Fs));
+	CHECK(f_mount(RAMDISK, 0, &Fs));
+	CHECK(f_open(&Fs, &fl, "/low.bin", FA_READ));
+	EXPECT(f_size(&fl) == low);
+	CHECK(f_close(&fl));
+	CHECK(f_open(&Fs, &fh, "/high.bin", FA_READ));
+	EXPECT(f_size(&fh) == DATA);
+	for (ofs = 0; ofs < DATA; ofs += n) {
+		CHECK(f_read(&fh, buf, BLOCK, &n));
+		EXPECT(n == ((DATA - ofs < BLOCK) ? DATA - ofs : BLOCK));
+		for (i = 0; i < n && buf[i] == pattern(ofs + i); i++) ;
+		EXPECT(i == n);
+	}
+	for (i = 0; i < 256; i++) {	/* Random reads */
+		ofs = (QWORD)rand() % (DATA - 5000);
+		CHECK(f_lseek(&fh, ofs));
+		CHECK(f_read(&fh, buf, 5000, &n));
+		EXPECT(n == 5000);
+		for (n = 0; n < 5000 && buf[n] == pattern(ofs + n); n++) ;
+		EXPECT(n == 5000);
+	}
+	CHECK(f_close(&fh));
+
+	/* Remove both and check that no cluster leaks */
+	CHECK(f_unlink(&Fs, "/high.bin"));
+	CHECK(f_unlink(&Fs, "/low.bin"));
+	CHECK(f_mount(0, 0, &Fs));
+	CHECK(f_mount(RAMDISK, 0, &Fs));
+	CHECK(f_getfree(&Fs, &fre1));
+	EXPECT(fre1 == fre0);
+	CHECK(f_mount(0, 0, &Fs));
+
+	printf("lba64 ss=%u: %llu sectors, highest sector written %llu, ok\n", ss, nsect, ramdisk_stat.top);
+	ramdisk_delete();
+	free(buf);
+	return 0;
+}
@@ -0,0 +1,95 @@
+/*------------------------------------------------------------------------*/
+/* Benchmark of the numbered SFN generation (FF_FS_NUMNAME)               */
+/*------------------------------------------------------------------------*/
+/* 10000 files with the same long prefix are created in one directory, so
+/  that all their SFNs are numbered, and the time and the disk reads are
+/  printed. A third of them are replaced by files of another extension,
+/  and the SFNs are checked to be unique after a remount. Build it with
+/  FF_FS_NUMNAME 0 and 1, and with the name index, to compare.
+/
+/  usage: numname-bench [number of files] */
+
+#include <string.h>
+#include "ramdisk.h"
+
+static FATFS Fs;
+static BYTE Work[FF_MAX_SS * 16];
+static char (*Sfn)[12];
+
+
+
+static int cmp_sfn (const void* a, const void* b)
+{
+	return strcmp(a, b);
+}
+
+
+static void run (BYTE fmt, DWORD au, const char* tag, int nf)
+{
+	FIL f = {0};
+	FFDIR d = {0};
+	FILINFO fi;
+	char path[64];
+	int i, ns;
+	unsigned long nr;
+	double t;
+
+
+	EXPECT(ramdisk_create(128UL * 1024 * 1024 / 512, 512) == 0);
+	CHECK(f_mkfs(RAMDISK, 0, fmt | FM_SFD, au, Work, sizeof Work));
+	CHECK(f_mount(RAMDISK, 0, &Fs));
+	CHECK(f_mkdir(&Fs, "/log"));
+	CHECK(f_open(&Fs, &f, "/log/LOG_20~3.CSV", FA_WRITE | FA_CREATE_NEW));	/* A name made by hand that looks numbered */
+	CHECK(f_close(&f));
+
+	ramdisk_clear(); t = ramdisk_now();
+	for (i = 0; i < nf; i++) {
+		sprintf(path, "/log/log_2026-10-17_%06d.csv", i);
+		CHECK(f_open(&Fs, &f, path, FA_WRITE | FA_CREATE_NEW));
+		CHECK(f_close(&f));
+	}
+	t = ramdisk_now() - t; nr = ramdisk_stat.reads;
+
+	for (i = 0; i < nf; i += 3) {	/* Replace a third of them */
+		sprintf(path, "/log/log_2026-10-17_%06d.csv", i);
+		CHECK(f_unlink(&Fs, path));
+	}
+	for (i = 0; i < nf; i += 3) {
+		sprintf(path, "/log/log_2026-10-17_%06d.txt.csv", i);
+		CHECK(f_open(&Fs, &f, path, FA_WRITE | FA_CREATE_NEW));
+		CHECK(f_close(&f));
+	}
+	CHECK(f_mount(0, 0, &Fs));
+	CHECK(f_mount(RAMDISK, 0, &Fs));
+
+	CHECK(f_opendir(&Fs, &d, "/log"));	/* Collect the SFNs and check that they are unique */
+	for (ns = 0; ; ns++) {
+		CHECK(f_readdir(&d, &fi));
+		if (!fi.fname[0]) break;
+		EXPECT(ns <= nf);
+		strcpy(Sfn[ns], fi.altname[0] ? fi.altname : fi.fname);
+	}
+	CHECK(f_closedir(&d));
+	EXPECT(ns == nf + 1);
+	qsort(Sfn, (size_t)ns, sizeof Sfn[0], cmp_sfn);
+	for (i = 1; i < ns; i++) EXPECT(strcmp(Sfn[i], Sfn[i - 1]));
+
+	CHECK(f_mount(0, 0, &Fs));
+	printf("%-6s NUMNAME=%u NAMEINDEX=%-5u create %d files %8.2f s, %9lu reads\n",
+		tag, (unsigned)FF_FS_NUMNAME, (unsigned)FF_FS_NAMEINDEX, nf, t, nr);
+	ramdisk_delete();
+}
+
+
+int main (int argc, char* argv[])
+{
+	int nf = (argc > 1) ? atoi(argv[1]) : 10000;
+
+
+	Sfn = malloc(((size_t)nf + 1) * sizeof Sfn[0]);
+	EXPECT(Sfn);
+	run(FM_FAT, 4096, "FAT16", nf);
+	run(FM_FAT32, 1024, "FAT32", nf);
+	free(Sfn);
+	return 0;
+}
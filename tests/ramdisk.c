@@ -0,0 +1,180 @@
+/*------------------------------------------------------------------------*/
+/* Sparse RAM disk for the host tests of FatFs                            */
+/*------------------------------------------------------------------------*/
+/* The disk is held in chunks of 4 MiB allocated at the first write of
+/  non-zero data, so that a volume of several TiB can be created and
+/  written at a few places. A chunk never written reads as zeros. */
+
+#include <string.h>
+#include <time.h>
+#include "ramdisk.h"
+
+#define CHUNK	(4UL * 1024 * 1024)	/* Bytes per chunk */
+#define COUNT(v, n)	__atomic_fetch_add(&(v), (n), __ATOMIC_RELAXED)	/* The disk functions can be called by threads at a time */
+
+RAMDISK_STAT ramdisk_stat;
+
+static BYTE** Chunk;				/* Chunk table */
+static unsigned long long Nsect;	/* Number of sectors */
+static WORD Ssize;					/* Sector size */
+
+
+
+int ramdisk_create (
+	unsigned long long nsect,	/* Number of sectors */
+	WORD ssize					/* Sector size (512, 1024, 2048 or 4096) */
+)
+{
+	ramdisk_delete();
+	Chunk = calloc((size_t)((nsect * ssize + CHUNK - 1) / CHUNK), sizeof (BYTE*));
+	if (!Chunk) return -1;
+	Nsect = nsect; Ssize = ssize;
+	ramdisk_clear();
+	return 0;
+}
+
+
+void ramdisk_delete (void)
+{
+	size_t i;
+
+
+	if (Chunk) {
+		for (i = 0; i < (size_t)((Nsect * Ssize + CHUNK - 1) / CHUNK); i++) free(Chunk[i]);
+		free(Chunk);
+		Chunk = 0;
+	}
+}
+
+
+void ramdisk_clear (void)
+{
+	memset(&ramdisk_stat, 0, sizeof ramdisk_stat);
+}
+
+
+double ramdisk_now (void)
+{
+	struct timespec t;
+
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Disk I/O functions                                                    */
+/*-----------------------------------------------------------------------*/
+
+DSTATUS disk_initialize (PDRV pdrv)
+{
+	return (pdrv == RAMDISK && Chunk) ? 0 : STA_NOINIT;
+}
+
+
+DSTATUS disk_status (PDRV pdrv)
+{
+	return (pdrv == RAMDISK && Chunk) ? 0 : STA_NOINIT;
+}
+
+
+DSTATUS disk_deinitialize (PDRV pdrv)
+{
+	(void)pdrv;
+	return 0;
+}
+
+
+DRESULT disk_read (PDRV pdrv, BYTE* buff, LBA_t sector, UINT count)
+{
+	unsigned long long ofs = (unsigned long long)sector * Ssize;
+	size_t n = (size_t)count * Ssize;
+	BYTE *c;
+
+
+	if (pdrv != RAMDISK || !Chunk) return RES_NOTRDY;
+	if (sector >= Nsect || count > Nsect - sector) return RES_PARERR;
+	COUNT(ramdisk_stat.reads, 1); COUNT(ramdisk_stat.rsect, count);
+	while (n) {		/* Copy chunk by chunk */
+		size_t t = CHUNK - (size_t)(ofs % CHUNK);
+		if (t > n) t = n;
+		c = Chunk[ofs / CHUNK];
+		if (c) memcpy(buff, c + ofs % CHUNK, t); else memset(buff, 0, t);
+		buff += t; ofs += t; n -= t;
+	}
+	return RES_OK;
+}
+
+
+DRESULT disk_write (PDRV pdrv, const BYTE* buff, LBA_t sector, UINT count)
+{
+	unsigned long long ofs = (unsigned long long)sector * Ssize;
+	size_t n = (size_t)count * Ssize, i;
+	unsigned long long top;
+	BYTE **c;
+
+
+	if (pdrv != RAMDISK || !Chunk) return RES_NOTRDY;
+	if (sector >= Nsect || count > Nsect - sector) return RES_PARERR;
+	COUNT(ramdisk_stat.writes, 1); COUNT(ramdisk_stat.wsect, count);
+	top = __atomic_load_n(&ramdisk_stat.top, __ATOMIC_RELAXED);
+	while (sector + count - 1 > top && !__atomic_compare_exchange_n(&ramdisk_stat.top, &top, sector + count - 1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) ;
+	while (n) {		/* Copy chunk by chunk */
+		size_t t = CHUNK - (size_t)(ofs % CHUNK);
+		if (t > n) t = n;
+		c = &Chunk[ofs / CHUNK];
+		if (!*c) {	/* Allocate the chunk unless the data is all zeros */
+			for (i = 0; i < t && !buff[i]; i++) ;
+			if (i < t && !(*c = calloc(1, CHUNK))) return RES_ERROR;
+		}
+		if (*c) memcpy(*c + ofs % CHUNK, buff, t);
+		buff += t; ofs += t; n -= t;
+	}
+	return RES_OK;
+}
+
+
+DRESULT disk_ioctl (PDRV pdrv, BYTE cmd, void* buff)
+{
+	if (pdrv != RAMDISK || !Chunk) return RES_NOTRDY;
+	switch (cmd) {
+	case CTRL_SYNC :
+	case CTRL_TRIM :
+		return RES_OK;
+	case GET_SECTOR_COUNT :
+		*(LBA_t*)buff = (Nsect > (LBA_t)0 - 1) ? (LBA_t)0 - 1 : (LBA_t)Nsect;	/* Clipped to LBA_t */
+		return RES_OK;
+	case GET_SECTOR_SIZE :
+		*(WORD*)buff = Ssize;
+		return RES_OK;
+	case GET_BLOCK_SIZE :
+		*(DWORD*)buff = 1;
+		return RES_OK;
+	}
+	return RES_PARERR;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* OS dependent functions                                                */
+/*-----------------------------------------------------------------------*/
+
+DWORD get_fattime (void)
+{
+	return ((DWORD)(2026 - 1980) << 25 | (DWORD)10 << 21 | (DWORD)17 << 16);
+}
+
+
+void* ff_memalloc (UINT msize)
+{
+	return malloc(msize);
+}
+
+
+void ff_memfree (void* mblock)
+{
+	free(mblock);
+}
@@ -0,0 +1,35 @@
+/*------------------------------------------------------------------------*/
+/* Sparse RAM disk for the host tests of FatFs                            */
+/*------------------------------------------------------------------------*/
+
+#ifndef RAMDISK_DEFINED
+#define RAMDISK_DEFINED
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "chan-fatfs/ff.h"
+#include "chan-fatfs/diskio.h"
+
+#define RAMDISK		((PDRV)1)	/* Drive passed to f_mkfs() and f_mount() */
+
+/* Counters of the disk functions, cleared by ramdisk_clear() */
+typedef struct {
+	unsigned long reads;		/* disk_read() calls */
+	unsigned long writes;		/* disk_write() calls */
+	unsigned long long rsect;	/* Sectors read */
+	unsigned long long wsect;	/* Sectors written */
+	unsigned long long top;		/* Highest sector written */
+} RAMDISK_STAT;
+
+extern RAMDISK_STAT ramdisk_stat;
+
+int ramdisk_create (unsigned long long nsect, WORD ssize);	/* Create an empty disk, 0:succeeded */
+void ramdisk_delete (void);			/* Release the disk */
+void ramdisk_clear (void);			/* Clear the counters */
+double ramdisk_now (void);			/* Monotonic time in seconds */
+
+/* Stop the test on an unexpected result code */
+#define CHECK(x)	do { FRESULT r_ = (x); if (r_ != FR_OK) { printf("FAIL %s = %d (line %d)\n", #x, (int)r_, __LINE__); exit(1); } } while (0)
+#define EXPECT(c)	do { if (!(c)) { printf("FAIL %s (line %d)\n", #c, __LINE__); exit(1); } } while (0)
+
+#endif
@@ -0,0 +1,249 @@
+/*------------------------------------------------------------------------*/
+/* Test of the volume lock with threads (FF_FS_REENTRANT)                 */
+/*------------------------------------------------------------------------*/
+/* Reader threads read files of their own over and over in reads of mixed
+/  sizes, while a writer thread creates, appends, renames and removes files
+/  on the same volume, so that the readers follow their cluster chains on
+/  a FAT being changed. Other threads work on long names at the same time
+/  and check the names they find, which go through the LFN working buffer
+/  of the filesystem object (FF_USE_LFN == 4). The sync object is the one
+/  of ffsystem.cpp, built with std::timed_mutex, and its statistics are
+/  checked when they are built in. With FF_FS_REENTRANT_FILE, the readers
+/  do not hold the volume lock while their data is transferred. The data
+/  is checked by all threads and after a remount, and the free clusters
+/  after all is removed. Under ThreadSanitizer, std::timed_mutex can be
+/  reported as not held when it was taken by try_lock_for().
+/
+/  usage: reentrant-test */
+
+#include <pthread.h>
+#include <string.h>
+#include "ramdisk.h"
+#include "chan-fatfs/utils.h"
+
+#if !FF_FS_REENTRANT
+#error Build it with FF_FS_REENTRANT enabled
+#endif
+
+#define NREAD	3				/* Reader threads */
+#define RSIZE	(300UL * 1024)	/* Size of the file of a reader */
+#define NPASS	30				/* Reads of the whole file by a reader */
+#define NWFILE	600				/* Files created by the writer */
+#define NNAME	2				/* Threads working on long names */
+#define NNFILE	100				/* Files created by a name thread */
+
+static FATFS Fs;
+static BYTE Work[FF_MAX_SS * 16];
+static pthread_barrier_t Start;	/* All threads start at a time */
+
+static const UINT Chunk[] = { 1, 100, 511, 512, 513, 1000, 4096, 5000, 20000 };
+
+
+
+static BYTE pattern (UINT t, DWORD ofs)
+{
+	return (BYTE)(ofs * 7 + (ofs >> 9) + t * 0x35);
+}
+
+
+static DWORD wsize (UINT i)
+{
+	return (i * 1237) % 20000;
+}
+
+
+/* Read the file of the thread over and over in reads of mixed sizes and check it */
+static void* reader (void* arg)
+{
+	UINT t = (UINT)(size_t)arg, p, k = t, n, i;
+	FIL fil = {0};
+	BYTE buf[20000];
+	DWORD ofs;
+	char path[16];
+
+
+	sprintf(path, "/r%u", t);
+	pthread_barrier_wait(&Start);
+	for (p = 0; p < NPASS; p++) {
+		CHECK(f_open(&Fs, &fil, path, FA_READ));
+		for (ofs = 0; ofs < RSIZE; ofs += n) {
+			CHECK(f_read(&fil, buf, Chunk[k++ % (sizeof Chunk / sizeof Chunk[0])], &n));
+			EXPECT(n > 0);
+			for (i = 0; i < n && buf[i] == pattern(t, ofs + i); i++) ;
+			EXPECT(i == n);
+		}
+		CHECK(f_close(&fil));
+	}
+	return 0;
+}
+
+
+/* Create and append files, rename a half and remove a quarter of them */
+static void* writer (void* arg)
+{
+	FIL fil = {0};
+	BYTE buf[20000];
+	DWORD n, i;
+	UINT bw;
+	char path[32], path2[32];
+
+
+	(void)arg;
+	pthread_barrier_wait(&Start);
+	for (i = 0; i < NWFILE; i++) {
+		sprintf(path, "/w/%lu", (unsigned long)i);
+		CHECK(f_open(&Fs, &fil, path, FA_WRITE | FA_CREATE_NEW));
+		for (n = 0; n < wsize(i); n++) buf[n] = pattern(100, n + i);
+		CHECK(f_write(&fil, buf, wsize(i), &bw));
+		EXPECT(bw == wsize(i));
+		CHECK(f_close(&fil));
+		if (i % 2) {
+			sprintf(path2, "/w/m%lu", (unsigned long)i);
+			CHECK(f_rename(&Fs, path, path2));
+			if (i % 4 == 1) CHECK(f_unlink(&Fs, path2));
+		}
+	}
+	return 0;
+}
+
+
+/* Create, find, rename, list and remove files with long names in a directory of its own */
+static void* namer (void* arg)
+{
+	UINT t = (UINT)(size_t)arg, i, k, n;
+	FIL fil = {0};
+	FFDIR dir = {0};
+	FILINFO fno;
+	char dpath[8], name[80], path[96], path2[96];
+
+
+	sprintf(dpath, "/n%u", t);
+	pthread_barrier_wait(&Start);
+	for (i = 0; i < NNFILE; i++) {
+		sprintf(name, "a file with a long name made by the thread %u, number %u.txt", t, i);
+		sprintf(path, "%s/%s", dpath, name);
+		CHECK(f_open(&Fs, &fil, path, FA_WRITE | FA_CREATE_NEW));
+		CHECK(f_close(&fil));
+		CHECK(f_stat(&Fs, path, &fno));
+		EXPECT(!strcmp(fno.fname, name));
+		sprintf(name, "the file %u renamed by the thread %u to another long name.txt", i, t);
+		sprintf(path2, "%s/%s", dpath, name);
+		CHECK(f_rename(&Fs, path, path2));
+		CHECK(f_stat(&Fs, path2, &fno));
+		EXPECT(!strcmp(fno.fname, name));
+	}
+	CHECK(f_opendir(&Fs, &dir, dpath));
+	for (n = 0; ; n++) {
+		CHECK(f_readdir(&dir, &fno));
+		if (!fno.fname[0]) break;
+		EXPECT(sscanf(fno.fname, "the file %u renamed by the thread %u", &i, &k) == 2);
+		EXPECT(k == t && i < NNFILE);
+	}
+	CHECK(f_closedir(&dir));
+	EXPECT(n == NNFILE);
+	for (i = 0; i < NNFILE; i++) {
+		sprintf(path, "%s/the file %u renamed by the thread %u to another long name.txt", dpath, i, t);
+		CHECK(f_unlink(&Fs, path));
+	}
+	return 0;
+}
+
+
+static void run (BYTE fmt, unsigned long size, DWORD au, const char* tag)
+{
+	pthread_t th[NREAD + 1 + NNAME];
+	fatfs_sync_statistics_t st;
+	FIL fil = {0};
+	FILINFO fno;
+	BYTE buf[20000];
+	DWORD fre0, fre1, ofs, i;
+	UINT t, n, bw;
+	char path[32];
+
+
+	EXPECT(ramdisk_create(size / 512, 512) == 0);
+	CHECK(f_mkfs(RAMDISK, 0, fmt | FM_SFD, au, Work, sizeof Work));
+	CHECK(f_mount(RAMDISK, 0, &Fs));
+	CHECK(f_getfree(&Fs, &fre0));
+	CHECK(f_mkdir(&Fs, "/w"));
+	for (t = 0; t < NNAME; t++) {
+		sprintf(path, "/n%u", t);
+		CHECK(f_mkdir(&Fs, path));
+	}
+	for (t = 0; t < NREAD; t++) {	/* The files of the readers, written at a time to be fragmented */
+		sprintf(path, "/r%u", t);
+		CHECK(f_open(&Fs, &fil, path, FA_WRITE | FA_CREATE_ALWAYS));
+		CHECK(f_close(&fil));
+	}
+	for (ofs = 0; ofs < RSIZE; ofs += n) {
+		n = (RSIZE - ofs < 3000) ? RSIZE - ofs : 3000;
+		for (t = 0; t < NREAD; t++) {
+			sprintf(path, "/r%u", t);
+			CHECK(f_open(&Fs, &fil, path, FA_WRITE | FA_OPEN_APPEND));
+			for (i = 0; i < n; i++) buf[i] = pattern(t, ofs + i);
+			CHECK(f_write(&fil, buf, n, &bw));
+			EXPECT(bw == n);
+			CHECK(f_close(&fil));
+		}
+	}
+
+	fatfs_sync_statistics_clear(Fs.sobj);
+	EXPECT(pthread_barrier_init(&Start, 0, NREAD + 1 + NNAME) == 0);
+	for (t = 0; t < NREAD; t++) EXPECT(pthread_create(&th[t], 0, reader, (void*)(size_t)t) == 0);
+	EXPECT(pthread_create(&th[NREAD], 0, writer, 0) == 0);
+	for (t = 0; t < NNAME; t++) EXPECT(pthread_create(&th[NREAD + 1 + t], 0, namer, (void*)(size_t)t) == 0);
+	for (t = 0; t < NREAD + 1 + NNAME; t++) EXPECT(pthread_join(th[t], 0) == 0);
+	pthread_barrier_destroy(&Start);
+	fatfs_sync_statistics(Fs.sobj, &st);	/* All zero without the statistics */
+	EXPECT(st.timeouts == 0);
+#if defined(OS_INCLUDE_CHAN_FATFS_SYNC_STATISTICS)
+	EXPECT(st.acquisitions > 0 && st.contentions <= st.acquisitions && st.wait_max_us <= st.wait_us);
+#endif
+
+	/* Check the files of the writer after a remount */
+	CHECK(f_mount(0, 0, &Fs));
+	CHECK(f_mount(RAMDISK, 0, &Fs));
+	for (i = 0; i < NWFILE; i++) {
+		sprintf(path, (i % 2) ? "/w/m%lu" : "/w/%lu", (unsigned long)i);
+		if (i % 4 == 1) {
+			EXPECT(f_stat(&Fs, path, &fno) == FR_NO_FILE);
+			continue;
+		}
+		CHECK(f_open(&Fs, &fil, path, FA_READ));
+		EXPECT(f_size(&fil) == wsize(i));
+		CHECK(f_read(&fil, buf, sizeof buf, &n));
+		for (ofs = 0; ofs < n && buf[ofs] == pattern(100, ofs + i); ofs++) ;
+		EXPECT(ofs == wsize(i));
+		CHECK(f_close(&fil));
+		CHECK(f_unlink(&Fs, path));
+	}
+	CHECK(f_unlink(&Fs, "/w"));
+	for (t = 0; t < NNAME; t++) {
+		sprintf(path, "/n%u", t);
+		CHECK(f_unlink(&Fs, path));
+	}
+	for (t = 0; t < NREAD; t++) {
+		sprintf(path, "/r%u", t);
+		CHECK(f_unlink(&Fs, path));
+	}
+	CHECK(f_mount(0, 0, &Fs));
+	CHECK(f_mount(RAMDISK, 0, &Fs));
+	Fs.free_clst = 0xFFFFFFFF;	/* Force a full FAT scan */
+	CHECK(f_getfree(&Fs, &fre1));
+	EXPECT(fre1 == fre0);
+	CHECK(f_mount(0, 0, &Fs));
+
+	printf("%-6s au=%5lu REENTRANT_FILE=%u: %u readers, a writer and %u name threads, %lu grants, %lu contended, ok\n",
+		tag, (unsigned long)au, (unsigned)FF_FS_REENTRANT_FILE, NREAD, NNAME,
+		(unsigned long)st.acquisitions, (unsigned long)st.contentions);
+	ramdisk_delete();
+}
+
+
+int main (void)
+{
+	run(FM_FAT, 16UL * 1024 * 1024, 512, "FAT16");
+	run(FM_FAT32, 64UL * 1024 * 1024, 512, "FAT32");
+	run(FM_EXFAT, 32UL * 1024 * 1024, 4096, "exFAT");
+	return 0;
+}
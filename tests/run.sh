@@ -0,0 +1,299 @@
+#! /bin/bash
+set -euo pipefail
+IFS=$'\n\t'
+
+# Build the host tests of the FatFs core against the sparse RAM disk
+# and run them in the configurations they were written for.
+#
+# To use this script:
+# - bash tests/run.sh [test...]
+#
+# CC, CXX and CFLAGS are taken from the environment; the binaries go to
+# ${TMPDIR:-/tmp}/chan-fatfs-tests.
+
+tests_folder="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+root_folder="$(dirname "${tests_folder}")"
+build_folder="${TMPDIR:-/tmp}/chan-fatfs-tests"
+
+CC="${CC:-cc}"
+CXX="${CXX:-c++}"
+CFLAGS="${CFLAGS:--O2}"
+
+mkdir -p "${build_folder}"
+
+# build <name> <test source> [-D options...]
+function build()
+{
+  local name="$1"
+  local source="$2"
+  shift 2
+
+  echo "Building ${name}" "$@"
+  IFS=' ' read -r -a cflags <<< "${CFLAGS}"
+  "${CC}" "${cflags[@]}" -std=gnu11 -Wall \
+    -I"${root_folder}/include" \
+    "$@" \
+    -o "${build_folder}/${name}" \
+    "${tests_folder}/${source}" \
+    "${tests_folder}/ramdisk.c" \
+    "${root_folder}/source/ff.c" \
+    "${root_folder}/source/ffunicode.c"
+}
+
+# build_ffsystem [-D options...]
+# The sync object of src/posix-io/ffsystem.cpp on std::timed_mutex,
+# to be linked with -lstdc++ -pthread.
+function build_ffsystem()
+{
+  echo "Building ffsystem" "$@"
+  IFS=' ' read -r -a cflags <<< "${CFLAGS}"
+  "${CXX}" "${cflags[@]}" -std=c++17 -Wall \
+    -I"${root_folder}/include" \
+    -DOS_USE_CHAN_FATFS_STD_MUTEX \
+    "$@" \
+    -c -o "${build_folder}/ffsystem.o" \
+    "${root_folder}/src/posix-io/ffsystem.cpp"
+}
+
+function test_lba64()
+{
+  build lba64-test lba64-test.c -DFF_LBA64=1 -DFF_USE_EXPAND=1 -DFF_MAX_SS=4096
+  "${build_folder}/lba64-test" 512
+  "${build_folder}/lba64-test" 4096
+}
+
+function test_xfer()
+{
+  local defs
+  for defs in "-DFF_FS_MAXXFER=0" "-DFF_FS_MAXXFER=256" "-DFF_FS_MAXXFER=256 -DFF_FS_EXTCACHE=4"
+  do
+    IFS=' ' read -r -a defs <<< "${defs}"
+    build xfer-bench xfer-bench.c "${defs[@]}"
+    "${build_folder}/xfer-bench"
+  done
+}
+
+function test_unlink()
+{
+  local defs
+  for defs in "" "-DFF_FS_WINCACHE=8 -DFF_FS_FREEMAP=4096 -DFF_FS_FREEEXT=16"
+  do
+    IFS=' ' read -r -a defs <<< "${defs}"
+    build unlink-bench unlink-bench.c -DFF_USE_EXPAND=1 "${defs[@]}"
+    "${build_folder}/unlink-bench"
+  done
+}
+
+function test_numname()
+{
+  local defs
+  for defs in "-DFF_FS_NUMNAME=0" "-DFF_FS_NUMNAME=1" "-DFF_FS_NUMNAME=1 -DFF_FS_NAMEINDEX=65536 -DFF_FS_DIRHINT=4"
+  do
+    IFS=' ' read -r -a defs <<< "${defs}"
+    build numname-bench numname-bench.c "${defs[@]}"
+    "${build_folder}/numname-bench"
+  done
+}
+
+function test_delalloc()
+{
+  local defs
+  for defs in "" "-DFF_USE_EXPAND=1 -DFF_FS_FREEMAP=4096 -DFF_FS_FREEEXT=16 -DFF_FS_WRITEBEHIND=4"
+  do
+    IFS=' ' read -r -a defs <<< "${defs}"
+    build delalloc-test delalloc-test.c -DFF_FS_DELALLOC=16 "${defs[@]}"
+    "${build_folder}/delalloc-test"
+  done
+}
+
+function test_frag()
+{
+  local defs
+  for defs in "-DFF_USE_EXTENT=1" "-DFF_FS_RESERVE=64" "-DFF_FS_RESERVE=64 -DFF_FS_FREEEXT=16 -DFF_FS_DELALLOC=16"
+  do
+    IFS=' ' read -r -a defs <<< "${defs}"
+    build frag-bench frag-bench.c -DFF_FS_MAXXFER=256 "${defs[@]}"
+    "${build_folder}/frag-bench"
+  done
+}
+
+function test_wincache()
+{
+  local defs
+  for defs in "-DFF_FS_WINCACHE=8" "-DFF_FS_WINCACHE=16 -DFF_FS_WINCACHE_WAYS=4" "-DFF_FS_WINCACHE=4 -DFF_FS_WINCACHE_WAYS=1"
+  do
+    IFS=' ' read -r -a defs <<< "${defs}"
+    build feature-test feature-test.c "${defs[@]}"
+    "${build_folder}/feature-test"
+  done
+}
+
+function test_freemap()
+{
+  local defs
+  for defs in "-DFF_FS_FREEMAP=4096" "-DFF_FS_FREEMAP=256"
+  do
+    IFS=' ' read -r -a defs <<< "${defs}"
+    build feature-test feature-test.c "${defs[@]}"
+    "${build_folder}/feature-test"
+  done
+}
+
+function test_getfree()
+{
+  local defs
+  for defs in "" "-DFF_FS_BULKBUF=8192" "-DFF_FS_BULKBUF=65536"
+  do
+    IFS=' ' read -r -a defs <<< "${defs}"
+    build feature-test feature-test.c "${defs[@]}"
+    "${build_folder}/feature-test"
+  done
+}
+
+function test_readahead()
+{
+  local defs
+  for defs in "-DFF_FS_READAHEAD=4" "-DFF_FS_READAHEAD=64 -DFF_FS_MAXXFER=256"
+  do
+    IFS=' ' read -r -a defs <<< "${defs}"
+    build feature-test feature-test.c "${defs[@]}"
+    "${build_folder}/feature-test"
+  done
+}
+
+function test_writebehind()
+{
+  local defs
+  for defs in "-DFF_FS_WRITEBEHIND=4" "-DFF_FS_WRITEBEHIND=16 -DFF_FS_READAHEAD=8"
+  do
+    IFS=' ' read -r -a defs <<< "${defs}"
+    build feature-test feature-test.c "${defs[@]}"
+    "${build_folder}/feature-test"
+  done
+}
+
+function test_extcache()
+{
+  local defs
+  for defs in "-DFF_FS_EXTCACHE=4" "-DFF_FS_EXTCACHE=64 -DFF_FS_MAXXFER=256"
+  do
+    IFS=' ' read -r -a defs <<< "${defs}"
+    build feature-test feature-test.c "${defs[@]}"
+    "${build_folder}/feature-test"
+  done
+}
+
+function test_reentrant()
+{
+  local defs
+  for defs in "-DFF_FS_REENTRANT=1" "-DFF_FS_REENTRANT=1 -DOS_INCLUDE_CHAN_FATFS_SYNC_STATISTICS" "-DFF_FS_REENTRANT=1 -DFF_FS_REENTRANT_FILE=1 -DOS_INCLUDE_CHAN_FATFS_SYNC_STATISTICS" "-DFF_FS_REENTRANT=1 -DFF_FS_REENTRANT_FILE=1 -DFF_FS_READAHEAD=4 -DFF_FS_EXTCACHE=8"
+  do
+    IFS=' ' read -r -a defs <<< "${defs}"
+    build_ffsystem "${defs[@]}"
+    build reentrant-test reentrant-test.c "${defs[@]}" \
+      "${build_folder}/ffsystem.o" -lstdc++ -pthread
+    "${build_folder}/reentrant-test"
+  done
+}
+
+function test_dcache()
+{
+  local defs
+  for defs in "-DFF_FS_DCACHE=64 -DFF_FS_DCNAME=40" "-DFF_FS_DCACHE=2 -DFF_FS_DCNAME=8"
+  do
+    IFS=' ' read -r -a defs <<< "${defs}"
+    build feature-test feature-test.c "${defs[@]}"
+    "${build_folder}/feature-test"
+  done
+}
+
+function test_nameindex()
+{
+  local defs
+  for defs in "-DFF_FS_NAMEINDEX=4096" "-DFF_FS_NAMEINDEX=512 -DFF_FS_NAMEINDEX_DIRS=1" "-DFF_FS_NAMEINDEX=4096 -DFF_FS_DCACHE=16 -DFF_FS_DIRHINT=4"
+  do
+    IFS=' ' read -r -a defs <<< "${defs}"
+    build feature-test feature-test.c "${defs[@]}"
+    "${build_folder}/feature-test"
+  done
+}
+
+function test_extent()
+{
+  local defs
+  for defs in "-DFF_USE_EXTENT=1" "-DFF_USE_EXTENT=1 -DFF_FS_EXTCACHE=4 -DFF_FS_DELALLOC=16" "-DFF_USE_EXTENT=1 -DFF_FS_WRITEBEHIND=4 -DFF_FS_READAHEAD=8"
+  do
+    IFS=' ' read -r -a defs <<< "${defs}"
+    build feature-test feature-test.c "${defs[@]}"
+    "${build_folder}/feature-test"
+  done
+}
+
+function test_forward()
+{
+  local defs
+  for defs in "" "-DFF_FS_READAHEAD=8" "-DFF_FS_WRITEBEHIND=4 -DFF_FS_EXTCACHE=4"
+  do
+    IFS=' ' read -r -a defs <<< "${defs}"
+    build feature-test feature-test.c "${defs[@]}"
+    "${build_folder}/feature-test"
+  done
+}
+
+function test_pread()
+{
+  local defs
+  for defs in "-DFF_USE_PREAD=1" "-DFF_USE_PREAD=1 -DFF_FS_READAHEAD=8 -DFF_FS_EXTCACHE=4" "-DFF_USE_PREAD=1 -DFF_FS_WRITEBEHIND=4 -DFF_FS_DELALLOC=16"
+  do
+    IFS=' ' read -r -a defs <<< "${defs}"
+    build feature-test feature-test.c "${defs[@]}"
+    "${build_folder}/feature-test"
+  done
+}
+
+function test_freeext()
+{
+  local defs
+  for defs in "-DFF_FS_FREEEXT=16" "-DFF_FS_FREEEXT=2" "-DFF_FS_FREEEXT=16 -DFF_FS_FREEMAP=4096" "-DFF_FS_FREEEXT=2 -DFF_FS_FREEMAP=256"
+  do
+    IFS=' ' read -r -a defs <<< "${defs}"
+    build feature-test feature-test.c "${defs[@]}"
+    "${build_folder}/feature-test"
+  done
+}
+
+function test_expand()
+{
+  local defs
+  for defs in "-DFF_USE_EXTENT=1" "-DFF_USE_EXTENT=1 -DFF_FS_FREEEXT=16 -DFF_FS_FREEMAP=4096" "-DFF_USE_EXTENT=1 -DFF_FS_DELALLOC=16 -DFF_FS_WRITEBEHIND=4"
+  do
+    IFS=' ' read -r -a defs <<< "${defs}"
+    build feature-test feature-test.c "${defs[@]}"
+    "${build_folder}/feature-test"
+  done
+}
+
+function test_reserve()
+{
+  local defs
+  for defs in "-DFF_FS_RESERVE=64" "-DFF_FS_RESERVE=8 -DFF_FS_FREEEXT=16 -DFF_FS_DELALLOC=16" "-DFF_FS_RESERVE=64 -DFF_FS_EXTCACHE=4 -DFF_FS_FREEMAP=256"
+  do
+    IFS=' ' read -r -a defs <<< "${defs}"
+    build feature-test feature-test.c "${defs[@]}"
+    "${build_folder}/feature-test"
+  done
+}
+
+all_tests=(lba64 xfer unlink numname delalloc frag wincache freemap getfree readahead writebehind extcache reentrant dcache nameindex extent forward pread freeext expand reserve)
+
+if [ $# -eq 0 ]
+then
+  set -- "${all_tests[@]}"
+fi
+
+for t in "$@"
+do
+  "test_${t}"
+done
+
+echo "Done."
@@ -0,0 +1,85 @@
+/*------------------------------------------------------------------------*/
+/* Benchmark of the cluster chain removal (f_unlink)                      */
+/*------------------------------------------------------------------------*/
+/* A contiguous file of 1.5 GiB and two files written by turns are
+/  created on a 2 GiB volume, and each is removed after a remount. The
+/  time and the disk calls of f_unlink() are printed, and the number of
+/  free clusters is checked against the empty volume after a full FAT
+/  scan.
+/
+/  usage: unlink-bench */
+
+#include <string.h>
+#include "ramdisk.h"
+
+#if !FF_USE_EXPAND
+#error Build it with FF_USE_EXPAND enabled
+#endif
+
+static FATFS Fs;
+static BYTE Work[FF_MAX_SS * 16];
+static BYTE Buf[256 * 1024];
+
+
+
+static void unlink_file (const char* path, const char* what, DWORD au, const char* tag)
+{
+	double t;
+
+
+	ramdisk_clear(); t = ramdisk_now();
+	CHECK(f_unlink(&Fs, path));
+	t = ramdisk_now() - t;
+	printf("%-6s au=%5lu unlink %-24s %8.3f ms, %5lu reads %5lu writes\n",
+		tag, (unsigned long)au, what, t * 1e3, ramdisk_stat.reads, ramdisk_stat.writes);
+}
+
+
+static void run (BYTE fmt, DWORD au, const char* tag)
+{
+	FIL f = {0}, g = {0};
+	DWORD fre0, fre1, i;
+	UINT n;
+
+
+	EXPECT(ramdisk_create(2048ULL * 1024 * 1024 / 512, 512) == 0);
+	CHECK(f_mkfs(RAMDISK, 0, fmt | FM_SFD, au, Work, sizeof Work));
+	CHECK(f_mount(RAMDISK, 0, &Fs));
+	CHECK(f_getfree(&Fs, &fre0));
+
+	CHECK(f_open(&Fs, &f, "/big", FA_WRITE | FA_CREATE_ALWAYS));
+	CHECK(f_expand(&f, (FSIZE_t)1536 * 1024 * 1024, 1));
+	CHECK(f_close(&f));
+	CHECK(f_open(&Fs, &f, "/fa", FA_WRITE | FA_CREATE_ALWAYS));
+	CHECK(f_open(&Fs, &g, "/fb", FA_WRITE | FA_CREATE_ALWAYS));
+	for (i = 0; i < 200UL * 1024 * 1024 / (3 * au); i++) {	/* 3 clusters to fa, 1 cluster to fb */
+		CHECK(f_write(&f, Buf, 3 * au, &n));
+		CHECK(f_write(&g, Buf, au, &n));
+	}
+	CHECK(f_close(&f));
+	CHECK(f_close(&g));
+	CHECK(f_mount(0, 0, &Fs));
+	CHECK(f_mount(RAMDISK, 0, &Fs));
+
+	unlink_file("/big", "1.5 GiB contiguous:", au, tag);
+	unlink_file("/fa", "150 MiB fragmented:", au, tag);
+	CHECK(f_unlink(&Fs, "/fb"));
+
+	CHECK(f_mount(0, 0, &Fs));
+	CHECK(f_mount(RAMDISK, 0, &Fs));
+	Fs.free_clst = 0xFFFFFFFF;	/* Force a full FAT scan */
+	CHECK(f_getfree(&Fs, &fre1));
+	EXPECT(fre1 == fre0);
+	CHECK(f_mount(0, 0, &Fs));
+	ramdisk_delete();
+}
+
+
+int main (void)
+{
+	run(FM_FAT32, 4096, "FAT32");
+	run(FM_FAT32, 1024, "FAT32");
+	run(FM_FAT, 65536, "FAT16");
+	run(FM_EXFAT, 4096, "exFAT");
+	return 0;
+}
@@ -0,0 +1,117 @@
+/*------------------------------------------------------------------------*/
+/* Benchmark of the multi-cluster transfer (FF_FS_MAXXFER)                */
+/*------------------------------------------------------------------------*/
+/* A contiguous file is written and read in calls of 1 MiB, and the calls
+/  of disk_write() and disk_read() are counted. A fragmented file, random
+/  unaligned reads and an overwrite in the middle of the file are checked
+/  as well. Build it with FF_FS_MAXXFER 0 and not 0 to compare.
+/
+/  usage: xfer-bench */
+
+#include <string.h>
+#include "ramdisk.h"
+
+#define DATA	(32UL * 1024 * 1024)	/* Size of the contiguous file */
+#define BLOCK	(1024UL * 1024)			/* Bytes per f_write()/f_read() */
+
+static FATFS Fs;
+static BYTE Work[FF_MAX_SS * 16];
+static BYTE *Src, *Dst;
+
+
+
+static void run (BYTE fmt, DWORD au, const char* tag)
+{
+	FIL f = {0}, g = {0};
+	UINT n, i;
+	DWORD ofs, len;
+	unsigned long nw, nr;
+	double tw, tr;
+
+
+	EXPECT(ramdisk_create(512UL * 1024 * 1024 / 512, 512) == 0);
+	CHECK(f_mkfs(RAMDISK, 0, fmt | FM_SFD, au, Work, sizeof Work));
+	CHECK(f_mount(RAMDISK, 0, &Fs));
+
+	/* Contiguous file */
+	ramdisk_clear(); tw = ramdisk_now();
+	CHECK(f_open(&Fs, &f, "/big.bin", FA_WRITE | FA_CREATE_ALWAYS));
+	for (ofs = 0; ofs < DATA; ofs += BLOCK) {
+		CHECK(f_write(&f, Src + ofs, BLOCK, &n));
+		EXPECT(n == BLOCK);
+	}
+	CHECK(f_close(&f));
+	tw = ramdisk_now() - tw; nw = ramdisk_stat.writes;
+
+	ramdisk_clear(); tr = ramdisk_now();
+	memset(Dst, 0, DATA);
+	CHECK(f_open(&Fs, &f, "/big.bin", FA_READ));
+	for (ofs = 0; ofs < DATA; ofs += BLOCK) {
+		CHECK(f_read(&f, Dst + ofs, BLOCK, &n));
+		EXPECT(n == BLOCK);
+	}
+	tr = ramdisk_now() - tr; nr = ramdisk_stat.reads;
+	EXPECT(!memcmp(Dst, Src, DATA));
+
+	for (i = 0; i < 200; i++) {	/* Random unaligned reads */
+		ofs = (DWORD)rand() % (DATA - 300000);
+		len = (DWORD)rand() % 300000;
+		CHECK(f_lseek(&f, ofs));
+		CHECK(f_read(&f, Dst, len, &n));
+		EXPECT(n == len && !memcmp(Dst, Src + ofs, len));
+	}
+	CHECK(f_close(&f));
+
+	/* Overwrite in the middle of the file */
+	CHECK(f_open(&Fs, &f, "/big.bin", FA_WRITE | FA_READ));
+	CHECK(f_lseek(&f, 12345));
+	CHECK(f_write(&f, Src + 7, 3000000, &n));
+	CHECK(f_lseek(&f, 12345));
+	CHECK(f_read(&f, Dst, 3000000, &n));
+	EXPECT(n == 3000000 && !memcmp(Dst, Src + 7, 3000000));
+	CHECK(f_close(&f));
+
+	/* Fragmented file, interleaved with another one */
+	CHECK(f_open(&Fs, &f, "/a.bin", FA_WRITE | FA_CREATE_ALWAYS));
+	CHECK(f_open(&Fs, &g, "/b.bin", FA_WRITE | FA_CREATE_ALWAYS));
+	for (i = 0; i < 64; i++) {
+		CHECK(f_write(&f, Src + i * 3 * au, 3 * au + 1, &n));
+		CHECK(f_lseek(&f, (i + 1) * 3 * au));
+		CHECK(f_write(&g, Src, au, &n));
+	}
+	CHECK(f_close(&f));
+	CHECK(f_close(&g));
+	CHECK(f_open(&Fs, &f, "/a.bin", FA_READ));
+	memset(Dst, 0, DATA);
+	CHECK(f_read(&f, Dst + 1, 64 * 3 * au + 1, &n));
+	EXPECT(n == 64 * 3 * au + 1 && !memcmp(Dst + 1, Src, 64 * 3 * au));
+	CHECK(f_close(&f));
+
+	CHECK(f_mount(0, 0, &Fs));
+	printf("%-6s au=%5lu MAXXFER=%-4u write %5lu calls %7.1f MB/s, read %5lu calls %7.1f MB/s\n",
+		tag, (unsigned long)au, (unsigned)FF_FS_MAXXFER, nw, DATA / tw / 1e6, nr, DATA / tr / 1e6);
+#if FF_FS_MAXXFER
+	/* A call of 1 MiB takes a few disk calls, plus the FAT and the directory */
+	EXPECT(nr <= DATA / BLOCK * (BLOCK / 512 / FF_FS_MAXXFER + 2) + 64);
+#endif
+	ramdisk_delete();
+}
+
+
+int main (void)
+{
+	DWORD i;
+
+
+	Src = malloc(DATA); Dst = malloc(DATA);
+	EXPECT(Src && Dst);
+	for (i = 0; i < DATA; i++) Src[i] = (BYTE)(i * 131 + (i >> 9));
+
+	run(FM_FAT32, 4096, "FAT32");
+	run(FM_FAT, 32768, "FAT16");
+	run(FM_EXFAT, 4096, "exFAT");
+	run(FM_EXFAT, 32768, "exFAT");
+
+	free(Src); free(Dst);
+	return 0;
+}